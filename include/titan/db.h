@@ -1,5 +1,8 @@
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "rocksdb/utilities/stackable_db.h"
 #include "titan/options.h"
 
@@ -77,6 +80,9 @@ class TitanDB : public StackableDB {
   Status DestroyColumnFamilyHandle(ColumnFamilyHandle* column_family) override =
       0;
 
+  // Iterators seek in total order, unless ReadOptions::prefix_same_as_start
+  // is set. In that case they seek in prefix mode as in RocksDB, using the
+  // prefix extractor and prefix bloom filters of the column family.
   using StackableDB::NewIterator;
   Iterator* NewIterator(const ReadOptions& opts,
                         ColumnFamilyHandle* column_family) override {
@@ -102,6 +108,104 @@ class TitanDB : public StackableDB {
       const std::vector<ColumnFamilyHandle*>& column_families,
       std::vector<Iterator*>* iterators) = 0;
 
+  using StackableDB::MultiGet;
+  // Batched version of MultiGet. Blob values of all the keys are fetched
+  // together, grouped by blob file, and returned through "values" without
+  // copying. "column_families", "keys", "values" and "statuses" must point
+  // to arrays of "num_keys" elements.
+  virtual void MultiGet(const ReadOptions& options, size_t num_keys,
+                        ColumnFamilyHandle** column_families, const Slice* keys,
+                        PinnableSlice* values, Status* statuses) = 0;
+
+  // Called with the status of AsyncGet() once the value is ready.
+  using AsyncGetCallback = std::function<void(const Status&)>;
+
+  // Asynchronous version of Get(). The key is looked up in the base DB in
+  // the calling thread, while the blob value, if any, is read by a pool of
+  // Titan threads (see TitanDBOptions::async_read_threads). The value is
+  // pinned to "value" without copying, then "callback" is called in the
+  // thread finishing the read, which may be the calling thread if the value
+  // is not in blob files. "value" and the snapshot of "options", if any,
+  // must be valid until "callback" is called.
+  virtual void AsyncGet(const ReadOptions& options,
+                        ColumnFamilyHandle* column_family, const Slice& key,
+                        PinnableSlice* value, AsyncGetCallback callback) = 0;
+
+  // Called by ScanBatch() with the keys and values of a batch, in key
+  // order. The slices are valid only during the call. Returning a non-OK
+  // status stops the scan, and ScanBatch() returns it.
+  using ScanBatchCallback = std::function<Status(
+      const std::vector<Slice>& keys, const std::vector<Slice>& values)>;
+
+  // Scans the keys in "range", [start, limit) where a null bound means
+  // unbounded, and passes them to "callback" in batches of up to
+  // "batch_size" entries. Blob values of a batch are read together, sorted
+  // by blob file and offset, with neighbouring records coalesced into one
+  // read, so that large scans such as exports and backfills read blob
+  // files mostly sequentially.
+  virtual Status ScanBatch(const TitanReadOptions& options,
+                           ColumnFamilyHandle* column_family,
+                           const RangePtr& range, size_t batch_size,
+                           const ScanBatchCallback& callback) = 0;
+  virtual Status ScanBatch(const TitanReadOptions& options,
+                           const RangePtr& range, size_t batch_size,
+                           const ScanBatchCallback& callback) {
+    return ScanBatch(options, DefaultColumnFamily(), range, batch_size,
+                     callback);
+  }
+
+  // Called by ParallelScan() with each entry and the number of the key
+  // range it belongs to. Ranges are numbered in key order. Returning a
+  // non-OK status stops the scan, and ParallelScan() returns it.
+  using ParallelScanCallback = std::function<Status(
+      size_t partition, const Slice& key, const Slice& value)>;
+
+  // Summary of a ParallelScan(), merged from all the threads.
+  struct ParallelScanResult {
+    // Number of key ranges the column family was split into.
+    size_t num_partitions{0};
+    uint64_t num_keys{0};
+    // Total size of the keys and values scanned.
+    uint64_t num_bytes{0};
+  };
+
+  // Scans the whole column family with "num_threads" threads. The column
+  // family is split into key ranges on the boundaries of its SST files,
+  // several times more ranges than threads to balance the work. Each thread
+  // scans one range at a time with its own iterator, so that blob values of
+  // different ranges are read in parallel. All the iterators read from the
+  // same snapshot. "callback" is called concurrently by the threads, with
+  // the entries of each range in key order. If "result" is not null, it is
+  // set to the summary of the scan.
+  virtual Status ParallelScan(const TitanReadOptions& options,
+                              ColumnFamilyHandle* column_family,
+                              size_t num_threads,
+                              const ParallelScanCallback& callback,
+                              ParallelScanResult* result) = 0;
+
+  // Called by ExportInBlobFileOrder() with each entry and the number of the
+  // blob file holding its value, or 0 if the value is inlined in the base
+  // DB. Returning a non-OK status stops the export, and
+  // ExportInBlobFileOrder() returns it.
+  using ExportCallback = std::function<Status(
+      uint64_t blob_file_number, const Slice& key, const Slice& value)>;
+
+  // Exports all the entries of the column family, reading blob files
+  // sequentially instead of in key order. Entries with inlined values are
+  // exported first, in key order. Then each blob file is read from start to
+  // end, with "options.readahead_size" bytes of readahead (2MB if zero),
+  // and a record is exported only if the key still points to it. That is
+  // checked by a merge-join of the records, which are sorted by key within
+  // a blob file, against a scan of the blob indexes in the base DB. Entries
+  // of a blob file are exported in key order, so each file can be written
+  // to an SST file of its own. Records of blob files sealed from value logs
+  // (see TitanCFOptions::separate_blob_on_write) are in write order, so
+  // the live entries of such a file are sorted by key and read again by
+  // random reads before they are exported.
+  virtual Status ExportInBlobFileOrder(const TitanReadOptions& options,
+                                       ColumnFamilyHandle* column_family,
+                                       const ExportCallback& callback) = 0;
+
   using StackableDB::Merge;
   Status Merge(const WriteOptions&, ColumnFamilyHandle*, const Slice& /*key*/,
                const Slice& /*value*/) override {
@@ -158,6 +262,20 @@ class TitanDB : public StackableDB {
     //  "rocksdb.titandb.obsolete-blob-file-size" - returns size of obsolete
     //      blob files.
     static const std::string kObsoleteBlobFileSize;
+    //  "rocksdb.titandb.num-iter-prefetcher-created" - returns number of blob
+    //      file prefetchers created by iterators.
+    static const std::string kNumIterPrefetcherCreated;
+    //  "rocksdb.titandb.num-iter-prefetcher-evicted" - returns number of blob
+    //      file prefetchers dropped by iterators to stay within
+    //      TitanReadOptions::max_blob_file_prefetchers.
+    static const std::string kNumIterPrefetcherEvicted;
+    //  "rocksdb.titandb.blob-buffer-pool-hit" - returns number of blob read
+    //      buffers reused from the blob buffer pool of the column family.
+    static const std::string kBlobBufferPoolHit;
+    //  "rocksdb.titandb.blob-buffer-pool-miss" - returns number of blob read
+    //      buffers newly allocated by the blob buffer pool of the column
+    //      family.
+    static const std::string kBlobBufferPoolMiss;
   };
 
   bool GetProperty(ColumnFamilyHandle* column_family, const Slice& property,
@@ -31,6 +31,31 @@ struct TitanDBOptions : public DBOptions {
   // Default: 10
   uint32_t purge_obsolete_files_period{10};  // 10s
 
+  // Number of threads reading blob values for TitanDB::AsyncGet(). The
+  // threads are started on the first call. If 0, AsyncGet() reads blob
+  // values in the calling thread.
+  //
+  // Default: 4
+  int32_t async_read_threads{4};
+
+  // Number of threads writing blob records for flush and compaction. If
+  // positive, a table builder hands large values to these threads, which
+  // compress and append them to the blob file in order, while it goes on
+  // building the table with the following keys. If 0, blob records are
+  // written in the flush or compaction thread.
+  //
+  // Default: 0
+  int32_t blob_write_threads{0};
+
+  // Number of threads compressing blob records for flush and compaction.
+  // If positive, records are compressed in batches, with the records of a
+  // batch compressed by these threads in parallel and appended to the blob
+  // file in order. If 0, records are compressed one at a time in the thread
+  // writing them.
+  //
+  // Default: 0
+  int32_t blob_compression_threads{0};
+
   TitanDBOptions() = default;
   explicit TitanDBOptions(const DBOptions& options) : DBOptions(options) {}
 
@@ -65,6 +90,63 @@ static auto& blob_run_mode_string_map =
 
 struct ImmutableTitanCFOptions;
 struct MutableTitanCFOptions;
+class BlobBufferPool;
+
+// Creates a pool of blob read buffers, which keeps at most "capacity"
+// bytes of free buffers for reuse.
+extern std::shared_ptr<BlobBufferPool> NewBlobBufferPool(size_t capacity);
+
+class BlobCacheAdmissionFilter;
+
+// Creates a frequency based admission filter of blob cache, which tracks
+// the accesses of about "num_entries" recent records. It should be close
+// to the number of records fitting in the blob cache.
+extern std::shared_ptr<BlobCacheAdmissionFilter> NewBlobCacheAdmissionFilter(
+    size_t num_entries);
+
+struct BlobPersistentCacheOptions {
+  // The directory to store cache files. It should be on a device faster
+  // than the one of blob files, and must not be shared by other caches.
+  std::string path;
+
+  // Max total size of cache files. The oldest cache file is dropped when
+  // the cache exceeds it.
+  //
+  // Default: 1GB
+  uint64_t capacity{1 << 30};
+
+  // The size of each cache file.
+  //
+  // Default: 64MB
+  uint64_t file_size{64 << 20};
+
+  // If true, a blob record is admitted to the cache only when it is
+  // offered the second time recently, so that records read only once
+  // don't wear out the device.
+  //
+  // Default: true
+  bool admission_control{true};
+
+  // Max total size of records offered to the cache but not written to
+  // cache files yet. Records are written by a background thread, and
+  // records offered beyond this size are dropped.
+  //
+  // Default: 8MB
+  uint64_t max_write_buffer_size{8 << 20};
+
+  // The env to access cache files. If nullptr, Env::Default() is used.
+  //
+  // Default: nullptr
+  Env* env{nullptr};
+};
+
+class BlobPersistentCache;
+
+// Opens a persistent blob cache, recovering records cached by previous
+// runs.
+extern Status NewBlobPersistentCache(
+    const BlobPersistentCacheOptions& options,
+    std::shared_ptr<BlobPersistentCache>* result);
 
 struct TitanCFOptions : public ColumnFamilyOptions {
   // The smallest value to store in blob files. Value smaller than
@@ -78,16 +160,93 @@ struct TitanCFOptions : public ColumnFamilyOptions {
   // Default: kNoCompression
   CompressionType blob_file_compression{kNoCompression};
 
+  // Options of blob_file_compression. With kZSTD, a non-zero max_dict_bytes
+  // enables dictionary compression of blob files written by flush and
+  // compaction. The dictionary of each blob file is trained from its first
+  // zstd_max_train_bytes of values, or copied from its first max_dict_bytes
+  // of values if zstd_max_train_bytes is zero, and is stored in the file.
+  // The records of a file are held in memory until its dictionary is built.
+  // Blob files written by GC and value logs don't use dictionaries.
+  //
+  // Default: CompressionOptions()
+  CompressionOptions blob_file_compression_options;
+
+  // If non-zero, blob records smaller than this size written by flush and
+  // compaction are packed into blob blocks of up to this size. A block is
+  // compressed as a whole and laid out in the blob file the same as a
+  // single record, so mid-sized values don't take a 4KB boundary and a
+  // compression frame each. Reads of packed records read and cache whole
+  // blocks, and holes are only punched for blocks whose records are all
+  // discardable. Blob files written by GC and value logs don't pack
+  // records.
+  //
+  // Default: 0
+  uint64_t blob_file_block_size{0};
+
   // The desirable blob file size. This is not a hard limit but a wish.
   //
   // Default: 256MB
   uint64_t blob_file_target_size{256 << 20};
 
+  // If true, values no smaller than min_blob_size are appended to a value
+  // log, an active blob file of the column family, as they are written by
+  // Put() and Write(). Only their blob indexes go through the WAL and the
+  // memtable, so large values are written once and don't fill up the
+  // memtable. The value log is sealed as a normal blob file when it grows
+  // to blob_file_target_size, or when the DB is closed. On recovery, the
+  // valid records of unsealed value logs are kept and the logs are sealed.
+  //
+  // The value log is synced along with the WAL if WriteOptions::sync is
+  // set, and before a flush installs SSTs pointing to it. Writes without
+  // sync are not safe on power loss or machine crash: the WAL may keep
+  // blob indexes of records lost from the tail of the value log. Recovery
+  // doesn't detect them, and reads of such keys return Corruption until
+  // they are overwritten or deleted. Use WriteOptions::sync, or leave this
+  // option off, if that is not acceptable.
+  //
+  // Default: false
+  bool separate_blob_on_write{false};
+
+  // If non-NULL, buffers to read and uncompress blob records are taken
+  // from the pool created by NewBlobBufferPool(), which can be shared by
+  // column families. Otherwise they are allocated by the memory allocator
+  // of blob_cache, if any. The pool must outlive blob_cache, since cached
+  // records are kept in buffers of the pool.
+  //
+  // Default: nullptr
+  std::shared_ptr<BlobBufferPool> blob_buffer_pool;
+
   // If non-NULL use the specified cache for blob records.
   //
   // Default: nullptr
   std::shared_ptr<Cache> blob_cache;
 
+  // If non-NULL, records read from blob files are inserted to blob_cache
+  // only if it has room for them or they are accessed frequently, as
+  // estimated by the filter created by NewBlobCacheAdmissionFilter(). It
+  // keeps large scans of cold records from evicting hot records. The
+  // filter should be shared by column families sharing blob_cache.
+  //
+  // Default: nullptr
+  std::shared_ptr<BlobCacheAdmissionFilter> blob_cache_admission_filter;
+
+  // If non-NULL, the persistent cache created by NewBlobPersistentCache()
+  // is used as the secondary tier of blob_cache. Records evicted from
+  // blob_cache are offered to it, and blob_cache misses are looked up in
+  // it before reading blob files. Without blob_cache, records read from
+  // blob files are offered to it directly.
+  //
+  // Default: nullptr
+  std::shared_ptr<BlobPersistentCache> blob_persistent_cache;
+
+  // Readahead of blob files grows up to this size while blob values are
+  // read sequentially by iterators. ReadOptions::readahead_size takes
+  // precedence if it is non-zero. Larger sizes help devices with expensive
+  // seeks, such as spinning disks. 0 disables readahead.
+  //
+  // Default: 256KB
+  uint64_t max_blob_readahead_size{256 << 10};
+
   // Max batch size for GC.
   //
   // Default: 750MB
@@ -161,8 +320,15 @@ struct ImmutableTitanCFOptions {
   explicit ImmutableTitanCFOptions(const TitanCFOptions& opts)
       : min_blob_size(opts.min_blob_size),
         blob_file_compression(opts.blob_file_compression),
+        blob_file_compression_options(opts.blob_file_compression_options),
+        blob_file_block_size(opts.blob_file_block_size),
         blob_file_target_size(opts.blob_file_target_size),
+        separate_blob_on_write(opts.separate_blob_on_write),
+        blob_buffer_pool(opts.blob_buffer_pool),
         blob_cache(opts.blob_cache),
+        blob_cache_admission_filter(opts.blob_cache_admission_filter),
+        blob_persistent_cache(opts.blob_persistent_cache),
+        max_blob_readahead_size(opts.max_blob_readahead_size),
         max_gc_batch_size(opts.max_gc_batch_size),
         min_gc_batch_size(opts.min_gc_batch_size),
         blob_file_discardable_ratio(opts.blob_file_discardable_ratio),
@@ -173,10 +339,24 @@ struct ImmutableTitanCFOptions {
 
   CompressionType blob_file_compression;
 
+  CompressionOptions blob_file_compression_options;
+
+  uint64_t blob_file_block_size;
+
   uint64_t blob_file_target_size;
 
+  bool separate_blob_on_write;
+
+  std::shared_ptr<BlobBufferPool> blob_buffer_pool;
+
   std::shared_ptr<Cache> blob_cache;
 
+  std::shared_ptr<BlobCacheAdmissionFilter> blob_cache_admission_filter;
+
+  std::shared_ptr<BlobPersistentCache> blob_persistent_cache;
+
+  uint64_t max_blob_readahead_size;
+
   uint64_t max_gc_batch_size;
 
   uint64_t min_gc_batch_size;
@@ -226,6 +406,34 @@ struct TitanReadOptions : public ReadOptions {
   // Default: false
   bool key_only{false};
 
+  // If non-zero, an iterator moving forward reads the blob values of up to
+  // this many following entries concurrently, using the threads of
+  // TitanDBOptions::async_read_threads. It helps scans of large values
+  // spread over many blob files, where each read waits for the device.
+  // Values of a blob file are read in order with the same readahead as
+  // the iterator's own reads.
+  //
+  // Default: 0
+  size_t blob_prefetch_depth{0};
+
+  // If true, an iterator reads the blob value of an entry only when
+  // value() is called for it, instead of on each positioning. Scans that
+  // check keys and take only a few values skip the reads of the others.
+  // Readahead still applies to the values read. blob_prefetch_depth is
+  // ignored in this mode.
+  //
+  // Default: false
+  bool lazy_blob_value{false};
+
+  // Max number of blob file prefetchers an iterator keeps. Each of them
+  // pins the reader of a blob file in the blob file cache. When the limit
+  // is reached, the least recently used prefetcher is dropped, so that
+  // long scans over many blob files don't hold all of their readers and
+  // file descriptors. Zero means no limit.
+  //
+  // Default: 64
+  size_t max_blob_file_prefetchers{64};
+
   TitanReadOptions() = default;
   explicit TitanReadOptions(const ReadOptions& options)
       : ReadOptions(options) {}
@@ -7,6 +7,11 @@ BaseDbListener::BaseDbListener(TitanDBImpl* db) : db_impl_(db) {}
 
 BaseDbListener::~BaseDbListener() {}
 
+void BaseDbListener::OnFlushBegin(DB* /*db*/,
+                                  const FlushJobInfo& flush_job_info) {
+  db_impl_->OnFlushBegin(flush_job_info);
+}
+
 void BaseDbListener::OnFlushCompleted(DB* /*db*/,
                                       const FlushJobInfo& flush_job_info) {
   db_impl_->OnFlushCompleted(flush_job_info);
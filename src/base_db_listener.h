@@ -12,6 +12,8 @@ class BaseDbListener final : public EventListener {
   BaseDbListener(TitanDBImpl* db);
   ~BaseDbListener();
 
+  void OnFlushBegin(DB* db, const FlushJobInfo& flush_job_info) override;
+
   void OnFlushCompleted(DB* db, const FlushJobInfo& flush_job_info) override;
 
   void OnCompactionCompleted(
@@ -0,0 +1,123 @@
+#include "blob_cache_admission_filter.h"
+
+#include <algorithm>
+
+#include "titan/options.h"
+#include "util/hash.h"
+
+namespace rocksdb {
+namespace titandb {
+
+namespace {
+
+const uint32_t kSeed1 = 0x5b3d1a4f;
+const uint32_t kSeed2 = 0x2c7e9e81;
+
+}  // namespace
+
+std::shared_ptr<BlobCacheAdmissionFilter> NewBlobCacheAdmissionFilter(
+    size_t num_entries) {
+  return std::make_shared<BlobCacheAdmissionFilter>(num_entries);
+}
+
+BlobCacheAdmissionFilter::BlobCacheAdmissionFilter(size_t num_entries) {
+  // Each row has about 4 counters per entry, and the counters are aged
+  // after as many accesses, so that noise of collisions stays below one.
+  width_ = 64;
+  while (width_ < num_entries * 4) {
+    width_ <<= 1;
+  }
+  sample_size_ = width_;
+  size_t num_bytes = kDepth * width_ / 2;
+  counters_.reset(new std::atomic<uint8_t>[num_bytes]);
+  for (size_t i = 0; i < num_bytes; i++) {
+    counters_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+size_t BlobCacheAdmissionFilter::CounterIndex(size_t row, uint32_t h1,
+                                              uint32_t h2) const {
+  return row * width_ + ((h1 + row * h2) & (width_ - 1));
+}
+
+uint8_t BlobCacheAdmissionFilter::GetCount(size_t index) const {
+  uint8_t bits = counters_[index / 2].load(std::memory_order_relaxed);
+  return (bits >> (index % 2 * 4)) & kMaxCount;
+}
+
+void BlobCacheAdmissionFilter::Increment(size_t index) {
+  auto& counter = counters_[index / 2];
+  size_t shift = index % 2 * 4;
+  uint8_t bits = counter.load(std::memory_order_relaxed);
+  // Losing an increment to a concurrent update of the byte is harmless.
+  if (((bits >> shift) & kMaxCount) < kMaxCount) {
+    counter.compare_exchange_weak(bits, bits + (1 << shift),
+                                  std::memory_order_relaxed);
+  }
+}
+
+void BlobCacheAdmissionFilter::Record(const Slice& key) {
+  uint32_t h1 = Hash(key.data(), key.size(), kSeed1);
+  uint32_t h2 = Hash(key.data(), key.size(), kSeed2);
+  for (size_t row = 0; row < kDepth; row++) {
+    Increment(CounterIndex(row, h1, h2));
+  }
+  // Only one thread sees the exact sample size, which ages the counters.
+  if (num_accesses_.fetch_add(1, std::memory_order_relaxed) + 1 ==
+      sample_size_) {
+    Age();
+  }
+}
+
+uint32_t BlobCacheAdmissionFilter::Estimate(const Slice& key) const {
+  uint32_t h1 = Hash(key.data(), key.size(), kSeed1);
+  uint32_t h2 = Hash(key.data(), key.size(), kSeed2);
+  uint32_t estimate = kMaxCount;
+  for (size_t row = 0; row < kDepth; row++) {
+    estimate = std::min<uint32_t>(estimate,
+                                  GetCount(CounterIndex(row, h1, h2)));
+  }
+  return estimate;
+}
+
+bool BlobCacheAdmissionFilter::Admit(const Slice& key, Cache* cache,
+                                     size_t charge) {
+  size_t accesses = num_accesses_.load(std::memory_order_relaxed);
+  size_t checked_at = usage_checked_at_.load(std::memory_order_relaxed);
+  // Aging decreases the number of accesses.
+  size_t distance =
+      accesses > checked_at ? accesses - checked_at : checked_at - accesses;
+  if (!usage_checked_.load(std::memory_order_relaxed) ||
+      distance >= kUsageCheckInterval) {
+    // Only the thread updating the check point checks the usage.
+    if (usage_checked_at_.compare_exchange_strong(
+            checked_at, accesses, std::memory_order_relaxed)) {
+      size_t usage = cache->GetUsage();
+      size_t capacity = cache->GetCapacity();
+      free_space_.store(usage < capacity ? capacity - usage : 0,
+                        std::memory_order_relaxed);
+      usage_checked_.store(true, std::memory_order_relaxed);
+    }
+  }
+  // Records are admitted while the cache is likely to have room for them.
+  size_t free_space = free_space_.load(std::memory_order_relaxed);
+  while (charge <= free_space) {
+    if (free_space_.compare_exchange_weak(free_space, free_space - charge,
+                                          std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return Estimate(key) >= kAdmitCount;
+}
+
+void BlobCacheAdmissionFilter::Age() {
+  // Halves both counters of each byte, dropping the bits shifted across.
+  for (size_t i = 0; i < kDepth * width_ / 2; i++) {
+    auto bits = counters_[i].load(std::memory_order_relaxed);
+    counters_[i].store((bits >> 1) & 0x77, std::memory_order_relaxed);
+  }
+  num_accesses_.fetch_sub(sample_size_ / 2, std::memory_order_relaxed);
+}
+
+}  // namespace titandb
+}  // namespace rocksdb
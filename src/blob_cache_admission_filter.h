@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "rocksdb/cache.h"
+#include "rocksdb/slice.h"
+
+namespace rocksdb {
+namespace titandb {
+
+// A TinyLFU style admission filter of blob cache.
+//
+// The filter estimates how often records are accessed recently with a
+// count-min sketch of 4-bit counters, two of which are packed in a byte.
+// All counters are halved after a number of accesses, so that the
+// estimation reflects recent accesses only. When the cache is full, a
+// record read from a blob file is admitted only if it is accessed
+// frequently, which keeps records read once by large scans from evicting
+// hot records.
+class BlobCacheAdmissionFilter {
+ public:
+  // "num_entries" is the number of records whose accesses are tracked,
+  // which should be close to the number of records fitting in the cache.
+  explicit BlobCacheAdmissionFilter(size_t num_entries);
+
+  // No copying allowed
+  BlobCacheAdmissionFilter(const BlobCacheAdmissionFilter&) = delete;
+  void operator=(const BlobCacheAdmissionFilter&) = delete;
+
+  // Records an access of the key.
+  void Record(const Slice& key);
+
+  // Returns the estimated number of recent accesses of the key.
+  uint32_t Estimate(const Slice& key) const;
+
+  // Returns true if the record of the key should be inserted to the cache
+  // with the charge. The access of the key should be recorded beforehand.
+  // Whether the cache is full is estimated from its usage checked once in
+  // a while, since getting the usage locks all the shards of the cache.
+  bool Admit(const Slice& key, Cache* cache, size_t charge);
+
+ private:
+  static const size_t kDepth = 4;
+  static const uint8_t kMaxCount = 15;
+  // A record is admitted to a full cache if it is accessed at least this
+  // many times recently, including the current access.
+  static const uint32_t kAdmitCount = 2;
+  // Number of accesses after which the cache usage is checked again.
+  static const size_t kUsageCheckInterval = 1024;
+
+  // Returns the index of the counter of the hashes in the row.
+  size_t CounterIndex(size_t row, uint32_t h1, uint32_t h2) const;
+  uint8_t GetCount(size_t index) const;
+  void Increment(size_t index);
+
+  // Halves all the counters.
+  void Age();
+
+  size_t width_;
+  // Number of accesses after which the counters are halved.
+  size_t sample_size_;
+  // Counter "i" is the low half of byte "i / 2" if "i" is even, or the
+  // high half otherwise.
+  std::unique_ptr<std::atomic<uint8_t>[]> counters_;
+  std::atomic<size_t> num_accesses_{0};
+
+  // Free space of the cache as of the last usage check, less the charges
+  // admitted since then.
+  std::atomic<size_t> free_space_{0};
+  // Value of num_accesses_ at the last usage check.
+  std::atomic<size_t> usage_checked_at_{0};
+  std::atomic<bool> usage_checked_{false};
+};
+
+}  // namespace titandb
+}  // namespace rocksdb
@@ -0,0 +1,55 @@
+#include "blob_cache_admission_filter.h"
+#include "util/string_util.h"
+#include "util/testharness.h"
+
+namespace rocksdb {
+namespace titandb {
+
+class BlobCacheAdmissionFilterTest : public testing::Test {};
+
+TEST(BlobCacheAdmissionFilterTest, Estimate) {
+  BlobCacheAdmissionFilter filter(1024);
+  ASSERT_EQ(0, filter.Estimate("k1"));
+  for (int i = 0; i < 3; i++) {
+    filter.Record("k1");
+  }
+  filter.Record("k2");
+  ASSERT_GE(filter.Estimate("k1"), 3);
+  ASSERT_GE(filter.Estimate("k2"), 1);
+  // Counters saturate without carrying over to the counters packed with
+  // them.
+  for (int i = 0; i < 20; i++) {
+    filter.Record("k3");
+  }
+  ASSERT_EQ(15, filter.Estimate("k3"));
+  ASSERT_LT(filter.Estimate("k4"), 15);
+
+  // Counters are halved periodically, so that keys not accessed recently
+  // fade out.
+  for (int i = 0; i < 1024 * 4; i++) {
+    filter.Record("other" + ToString(i));
+  }
+  ASSERT_LT(filter.Estimate("k1"), 3);
+}
+
+TEST(BlobCacheAdmissionFilterTest, Admit) {
+  auto cache = NewLRUCache(1024, 0 /* num_shard_bits */);
+  BlobCacheAdmissionFilter filter(1024);
+  // Records are admitted if the cache has room for them.
+  filter.Record("k1");
+  ASSERT_TRUE(filter.Admit("k1", cache.get(), 1024));
+  cache->Insert("k1", nullptr, 1024, [](const Slice&, void*) {});
+  // Otherwise only records accessed frequently are admitted.
+  filter.Record("k2");
+  ASSERT_FALSE(filter.Admit("k2", cache.get(), 1024));
+  filter.Record("k2");
+  ASSERT_TRUE(filter.Admit("k2", cache.get(), 1024));
+}
+
+}  // namespace titandb
+}  // namespace rocksdb
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
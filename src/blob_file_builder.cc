@@ -1,14 +1,28 @@
 #include "blob_file_builder.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "port/port.h"
+#include "table/meta_blocks.h"
+#include "util/mutexlock.h"
+#include "util/stop_watch.h"
+
 namespace rocksdb {
 namespace titandb {
 
 BlobFileBuilder::BlobFileBuilder(const TitanDBOptions& db_options,
                                  const TitanCFOptions& cf_options,
-                                 WritableFileWriter* file)
+                                 WritableFileWriter* file,
+                                 ThreadPool* compression_pool,
+                                 TitanStats* stats)
     : cf_options_(cf_options),
       file_(file),
-      encoder_(cf_options_.blob_file_compression) {
+      env_(db_options.env),
+      compression_pool_(compression_pool),
+      stats_(stats),
+      encoder_(cf_options_.blob_file_compression,
+               cf_options_.blob_file_compression_options) {
   BlobFileHeader header;
   std::string buffer;
   header.EncodeTo(&buffer);
@@ -18,19 +32,158 @@ BlobFileBuilder::BlobFileBuilder(const TitanDBOptions& db_options,
   remain_size_ = block_size_;
 }
 
+void BlobFileBuilder::SetCompressionDict(const Slice& dict) {
+  assert(file_->GetFileSize() == block_size_);
+  if (dict.empty() || (cf_options_.blob_file_compression != kZSTD &&
+                       cf_options_.blob_file_compression !=
+                           kZSTDNotFinalCompression)) {
+    return;
+  }
+  compression_dict_ = BlobCompressionDict::NewForCompression(
+      dict, cf_options_.blob_file_compression_options.level);
+  encoder_.SetCompressionDict(compression_dict_.get());
+  for (auto& encoder : batch_encoders_) {
+    encoder->SetCompressionDict(compression_dict_.get());
+  }
+}
+
 void BlobFileBuilder::Add(const BlobRecord& record, BlobHandle* handle) {
   if (!ok()) return;
 
-  encoder_.EncodeRecord(record);
-  handle->size = encoder_.GetEncodedSize();
-  if (remain_size_ != block_size_ && handle->size > remain_size_) {
+  Encode(&encoder_, &record, 1);
+  Append(encoder_.GetHeader(), encoder_.GetRecord(), handle, 1);
+}
+
+void BlobFileBuilder::AddBatch(const std::vector<BlobRecord>& records,
+                               std::vector<BlobHandle>* handles) {
+  handles->resize(records.size());
+  if (!ok()) return;
+
+  // Each unit is a record, or a blob block of neighbouring records.
+  std::vector<size_t> unit_ends;
+  SplitUnits(records, &unit_ends);
+  auto unit_begin = [&](size_t i) { return i == 0 ? 0 : unit_ends[i - 1]; };
+  size_t num_units = unit_ends.size();
+  if (compression_pool_ == nullptr || num_units <= 1 ||
+      cf_options_.blob_file_compression == kNoCompression) {
+    for (size_t i = 0; i < num_units && ok(); i++) {
+      size_t begin = unit_begin(i);
+      Encode(&encoder_, &records[begin], unit_ends[i] - begin);
+      Append(encoder_.GetHeader(), encoder_.GetRecord(), &(*handles)[begin],
+             unit_ends[i] - begin);
+    }
+    return;
+  }
+
+  size_t num_jobs =
+      std::min(num_units - 1,
+               static_cast<size_t>(compression_pool_->GetBackgroundThreads()));
+  while (batch_encoders_.size() < num_jobs + 1) {
+    batch_encoders_.emplace_back(
+        new BlobEncoder(cf_options_.blob_file_compression,
+                        cf_options_.blob_file_compression_options,
+                        compression_dict_.get()));
+  }
+  // Each thread takes an encoder of its own, and then the next unit to
+  // compress, so that large units don't hold up the others. The encoded
+  // units are kept until they are appended in order.
+  std::vector<std::string> encoded(num_units);
+  std::atomic<size_t> next_encoder{0};
+  std::atomic<size_t> next_unit{0};
+  auto encode = [&]() {
+    BlobEncoder* encoder = batch_encoders_[next_encoder.fetch_add(1)].get();
+    size_t i = 0;
+    while ((i = next_unit.fetch_add(1)) < num_units) {
+      size_t begin = unit_begin(i);
+      Encode(encoder, &records[begin], unit_ends[i] - begin);
+      encoded[i].reserve(encoder->GetEncodedSize());
+      encoded[i].append(encoder->GetHeader().data(), kBlobHeaderSize);
+      encoded[i].append(encoder->GetRecord().data(),
+                        encoder->GetRecord().size());
+    }
+  };
+  port::Mutex mutex;
+  port::CondVar cv(&mutex);
+  size_t num_running = num_jobs;
+  for (size_t i = 0; i < num_jobs; i++) {
+    compression_pool_->SubmitJob([&]() {
+      encode();
+      MutexLock l(&mutex);
+      if (--num_running == 0) {
+        cv.Signal();
+      }
+    });
+  }
+  encode();
+  {
+    MutexLock l(&mutex);
+    while (num_running > 0) {
+      cv.Wait();
+    }
+  }
+
+  for (size_t i = 0; i < num_units && ok(); i++) {
+    size_t begin = unit_begin(i);
+    Slice unit(encoded[i]);
+    Append(Slice(unit.data(), kBlobHeaderSize),
+           Slice(unit.data() + kBlobHeaderSize, unit.size() - kBlobHeaderSize),
+           &(*handles)[begin], unit_ends[i] - begin);
+  }
+}
+
+void BlobFileBuilder::SplitUnits(const std::vector<BlobRecord>& records,
+                                 std::vector<size_t>* unit_ends) const {
+  const uint64_t max_block_size = cf_options_.blob_file_block_size;
+  // Size of the open block, including the record count. Zero if there is
+  // no open block.
+  uint64_t size = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    uint64_t record_size = GetBlockRecordSize(records[i]);
+    if (size > 0 && size + record_size > max_block_size) {
+      unit_ends->push_back(i);
+      size = 0;
+    }
+    size += (size == 0 ? 4 : 0) + record_size;
+    if (size >= max_block_size) {
+      // A full block, or a record too large to be packed.
+      unit_ends->push_back(i + 1);
+      size = 0;
+    }
+  }
+  if (size > 0) {
+    unit_ends->push_back(records.size());
+  }
+}
+
+void BlobFileBuilder::Encode(BlobEncoder* encoder, const BlobRecord* records,
+                             size_t n) {
+  StopWatch compression_sw(env_, statistics(stats_),
+                           BLOB_DB_COMPRESSION_MICROS);
+  if (n == 1) {
+    encoder->EncodeRecord(records[0]);
+  } else {
+    encoder->EncodeBlock(records, n);
+  }
+}
+
+void BlobFileBuilder::Append(const Slice& header, const Slice& record,
+                             BlobHandle* handles, size_t n) {
+  StopWatch write_sw(env_, statistics(stats_), BLOB_DB_BLOB_FILE_WRITE_MICROS);
+  uint64_t size = header.size() + record.size();
+  if (remain_size_ != block_size_ && size > remain_size_) {
     file_->Append(Slice(zero_buffer_, remain_size_));
   }
-  handle->offset = file_->GetFileSize();
+  uint64_t offset = file_->GetFileSize();
+  for (size_t i = 0; i < n; i++) {
+    handles[i].offset = offset;
+    handles[i].size = size;
+    handles[i].index = n > 1 ? static_cast<uint32_t>(i) : 0;
+    handles[i].count = n > 1 ? static_cast<uint32_t>(n) : 0;
+  }
 
-  status_ = file_->Append(encoder_.GetHeader());
+  status_ = file_->Append(header);
   if (ok()) {
-    status_ = file_->Append(encoder_.GetRecord());
+    status_ = file_->Append(record);
   }
 
   remain_size_ = block_size_ - (file_->GetFileSize() % block_size_);
@@ -43,8 +196,13 @@ Status BlobFileBuilder::Finish() {
     file_->Append(Slice(zero_buffer_, remain_size_));
   }
 
-  std::string buffer;
   BlobFileFooter footer;
+  if (compression_dict_) {
+    WriteMetaBlocks(&footer.meta_index_handle);
+    if (!ok()) return status();
+  }
+
+  std::string buffer;
   footer.EncodeTo(&buffer);
 
   status_ = file_->Append(buffer);
@@ -55,6 +213,22 @@ Status BlobFileBuilder::Finish() {
   return status();
 }
 
+void BlobFileBuilder::WriteMetaBlocks(BlockHandle* meta_index_handle) {
+  std::string buffer;
+  BlockHandle dict_handle(file_->GetFileSize(),
+                          compression_dict_->raw().size());
+  AppendMetaBlock(compression_dict_->raw(), &buffer);
+
+  MetaIndexBuilder meta_index_builder;
+  meta_index_builder.Add(kCompressionDictBlockName, dict_handle);
+  Slice meta_index = meta_index_builder.Finish();
+  meta_index_handle->set_offset(file_->GetFileSize() + buffer.size());
+  meta_index_handle->set_size(meta_index.size());
+  AppendMetaBlock(meta_index, &buffer);
+
+  status_ = file_->Append(buffer);
+}
+
 void BlobFileBuilder::Abandon() {}
 
 }  // namespace titandb
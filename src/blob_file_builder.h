@@ -1,7 +1,12 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "blob_format.h"
+#include "rocksdb/threadpool.h"
 #include "titan/options.h"
+#include "titan_stats.h"
 #include "util/file_reader_writer.h"
 
 namespace rocksdb {
@@ -24,24 +29,53 @@ namespace titandb {
 //
 // 1. The sequence of blob records in the file are stored in sorted
 // order. These records come one after another at the beginning of the
-// file, and are compressed according to the compression options.
+// file, and are compressed according to the compression options. A
+// record starts at the next 4KB boundary if it doesn't fit in the rest
+// of the current 4KB block. Neighbouring small records may be packed
+// into a blob block, which is compressed and laid out as one record, see
+// TitanCFOptions::blob_file_block_size.
 //
 // 2. After the blob records we store a bunch of meta blocks, and a
 // meta index block with block handles pointed to the meta blocks. The
 // meta block and the meta index block are formatted the same as the
-// BlockBasedTable.
+// BlockBasedTable. The meta blocks start at a 4KB boundary, following
+// the padding of the last record block.
+//
+// 3. If the records are compressed with a zstd dictionary, the dictionary
+// is stored in the meta block named kCompressionDictBlockName. Files
+// without meta blocks point the footer to a null meta index handle.
 
 class BlobFileBuilder {
  public:
   // Constructs a builder that will store the contents of the file it
   // is building in "*file". Does not close the file. It is up to the
   // caller to sync and close the file after calling Finish().
+  //
+  // If "compression_pool" is not null, records added by AddBatch() are
+  // compressed by its threads. If "stats" is not null, the time to
+  // compress each record and to append it to the file is recorded in
+  // BLOB_DB_COMPRESSION_MICROS and BLOB_DB_BLOB_FILE_WRITE_MICROS.
   BlobFileBuilder(const TitanDBOptions& db_options,
-                  const TitanCFOptions& cf_options, WritableFileWriter* file);
+                  const TitanCFOptions& cf_options, WritableFileWriter* file,
+                  ThreadPool* compression_pool = nullptr,
+                  TitanStats* stats = nullptr);
 
   // Adds the record to the file and points the handle to it.
   void Add(const BlobRecord& record, BlobHandle* handle);
 
+  // Adds the records to the file in order and points "*handles" to them.
+  // Neighbouring records smaller than blob_file_block_size are packed into
+  // blob blocks. Blocks and the other records are compressed in parallel
+  // by the compression pool and this thread, so the file is the same as
+  // adding them in this thread.
+  void AddBatch(const std::vector<BlobRecord>& records,
+                std::vector<BlobHandle>* handles);
+
+  // Compresses the records with the raw zstd dictionary, which is stored
+  // in the file. Only takes effect with kZSTD blob_file_compression.
+  // REQUIRES: no record has been added.
+  void SetCompressionDict(const Slice& dict);
+
   // Returns non-ok iff some error has been detected.
   Status status() const { return status_; }
 
@@ -57,11 +91,35 @@ class BlobFileBuilder {
  private:
   bool ok() const { return status().ok(); }
 
+  // Splits the records into units encoded as a whole. Sets "*unit_ends"
+  // to the end of the records of each unit.
+  void SplitUnits(const std::vector<BlobRecord>& records,
+                  std::vector<size_t>* unit_ends) const;
+
+  // Encodes the "n" records, as a blob block if "n" is more than one.
+  void Encode(BlobEncoder* encoder, const BlobRecord* records, size_t n);
+
+  // Appends the header and the encoded record or block, and points the "n"
+  // handles of the records to it.
+  void Append(const Slice& header, const Slice& record, BlobHandle* handles,
+              size_t n);
+
   TitanCFOptions cf_options_;
   WritableFileWriter* file_;
+  Env* env_;
+  ThreadPool* compression_pool_;
+  TitanStats* stats_;
+
+  // Writes the meta blocks and points "*meta_index_handle" to the meta
+  // index block.
+  void WriteMetaBlocks(BlockHandle* meta_index_handle);
 
   Status status_;
+  std::shared_ptr<const BlobCompressionDict> compression_dict_;
   BlobEncoder encoder_;
+  // Encoders of AddBatch(), one for each thread compressing a batch. They
+  // keep their compression contexts and buffers for later batches.
+  std::vector<std::unique_ptr<BlobEncoder>> batch_encoders_;
   uint64_t remain_size_;
   static const uint64_t block_size_{4096};
   const char zero_buffer_[block_size_]{0};
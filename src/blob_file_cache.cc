@@ -2,6 +2,7 @@
 
 #include "util.h"
 #include "util/filename.h"
+#include "value_log.h"
 
 namespace rocksdb {
 namespace titandb {
@@ -16,11 +17,13 @@ Slice EncodeFileNumber(const uint64_t* number) {
 
 BlobFileCache::BlobFileCache(const TitanDBOptions& db_options,
                              const TitanCFOptions& cf_options,
-                             std::shared_ptr<Cache> cache, TitanStats* stats)
+                             uint32_t cf_id, std::shared_ptr<Cache> cache,
+                             TitanStats* stats)
     : env_(db_options.env),
       env_options_(db_options),
       db_options_(db_options),
       cf_options_(cf_options),
+      cf_id_(cf_id),
       cache_(cache),
       stats_(stats) {}
 
@@ -37,6 +40,23 @@ Status BlobFileCache::Get(const ReadOptions& options, uint64_t file_number,
   return s;
 }
 
+void BlobFileCache::MultiGet(const ReadOptions& options, uint64_t file_number,
+                             uint64_t file_size,
+                             std::vector<BlobReadRequest>* requests) {
+  Cache::Handle* cache_handle = nullptr;
+  Status s = FindFile(file_number, file_size, &cache_handle);
+  if (!s.ok()) {
+    for (auto& request : *requests) {
+      *request.status = s;
+    }
+    return;
+  }
+
+  auto reader = reinterpret_cast<BlobFileReader*>(cache_->Value(cache_handle));
+  reader->MultiGet(options, requests);
+  cache_->Release(cache_handle);
+}
+
 Status BlobFileCache::NewPrefetcher(
     uint64_t file_number, uint64_t file_size,
     std::unique_ptr<BlobFilePrefetcher>* result) {
@@ -68,7 +88,22 @@ Status BlobFileCache::FindFile(uint64_t file_number, uint64_t file_size,
   {
     std::unique_ptr<RandomAccessFile> f;
     auto file_name = BlobFileName(db_options_.dirname, file_number);
-    s = env_->NewRandomAccessFile(file_name, &f, env_options_);
+    if (file_size == 0) {
+      // A value log keeps growing, so it can't be memory mapped. It is
+      // renamed to the blob file name once sealed.
+      EnvOptions env_options(env_options_);
+      env_options.use_mmap_reads = false;
+      auto log_name = ValueLogFileName(db_options_.dirname, cf_id_,
+                                       file_number);
+      s = env_->NewRandomAccessFile(log_name, &f, env_options);
+      if (s.ok()) {
+        file_name = log_name;
+      } else {
+        s = env_->NewRandomAccessFile(file_name, &f, env_options);
+      }
+    } else {
+      s = env_->NewRandomAccessFile(file_name, &f, env_options_);
+    }
     if (!s.ok()) return s;
     if (db_options_.advise_random_on_open) {
       f->Hint(RandomAccessFile::RANDOM);
@@ -11,19 +11,26 @@ namespace titandb {
 
 class BlobFileCache {
  public:
-  // Constructs a blob file cache to cache opened files.
+  // Constructs a blob file cache to cache opened files of the column
+  // family.
   BlobFileCache(const TitanDBOptions& db_options,
-                const TitanCFOptions& cf_options, std::shared_ptr<Cache> cache,
-                TitanStats* stats);
+                const TitanCFOptions& cf_options, uint32_t cf_id,
+                std::shared_ptr<Cache> cache, TitanStats* stats);
 
   // Gets the blob record pointed by the handle in the specified file
   // number. The corresponding file size must be exactly "file_size"
-  // bytes. The provided buffer is used to store the record data, so
-  // the buffer must be valid when the record is used.
+  // bytes, or 0 if the file is a value log being written. The provided
+  // buffer is used to store the record data, so the buffer must be valid
+  // when the record is used.
   Status Get(const ReadOptions& options, uint64_t file_number,
              uint64_t file_size, const BlobHandle& handle, BlobRecord* record,
              PinnableSlice* buffer);
 
+  // Gets the blob records of a batch of requests in the specified file
+  // number. The status of each request is stored in its status field.
+  void MultiGet(const ReadOptions& options, uint64_t file_number,
+                uint64_t file_size, std::vector<BlobReadRequest>* requests);
+
   // Creates a prefetcher for the specified file number.
   Status NewPrefetcher(uint64_t file_number, uint64_t file_size,
                        std::unique_ptr<BlobFilePrefetcher>* result);
@@ -42,6 +49,7 @@ class BlobFileCache {
   EnvOptions env_options_;
   TitanDBOptions db_options_;
   TitanCFOptions cf_options_;
+  uint32_t cf_id_;
   std::shared_ptr<Cache> cache_;
   TitanStats* stats_;
 };
@@ -1,25 +1,36 @@
 #include "blob_file_iterator.h"
 
+#include <algorithm>
+
+#include "blob_file_reader.h"
 #include "util.h"
 #include "util/crc32c.h"
 
 namespace rocksdb {
 namespace titandb {
 
+// Readahead size of GC reading blob files with direct I/O, if
+// compaction_readahead_size is not set. Reads are not served by the page
+// cache then, so small reads of records are batched.
+const uint64_t kDefaultDirectReadaheadSize = 2 << 20;
+
 BlobFileIterator::BlobFileIterator(std::unique_ptr<PosixRandomRWFile>&& file,
                                    uint64_t file_name, uint64_t file_size,
                                    const TitanCFOptions& titan_cf_options)
     : file_(std::move(file)),
       file_number_(file_name),
       file_size_(file_size),
-      titan_cf_options_(titan_cf_options) {}
+      titan_cf_options_(titan_cf_options),
+      allocator_(GetBlobBufferAllocator(
+          titan_cf_options_.blob_buffer_pool.get(),
+          titan_cf_options_.blob_cache.get())) {}
 
 BlobFileIterator::~BlobFileIterator() {}
 
 bool BlobFileIterator::Init() {
   Slice slice;
   char header_buf[BlobFileHeader::kEncodedLength];
-  status_ = file_->Read(0, BlobFileHeader::kEncodedLength, &slice, header_buf);
+  status_ = ReadFile(0, BlobFileHeader::kEncodedLength, &slice, header_buf);
   if (!status_.ok()) {
     return false;
   }
@@ -29,13 +40,30 @@ bool BlobFileIterator::Init() {
     return false;
   }
   char footer_buf[BlobFileFooter::kEncodedLength];
-  status_ = file_->Read(file_size_ - BlobFileFooter::kEncodedLength,
-                        BlobFileFooter::kEncodedLength, &slice, footer_buf);
+  status_ = ReadFile(file_size_ - BlobFileFooter::kEncodedLength,
+                     BlobFileFooter::kEncodedLength, &slice, footer_buf);
   if (!status_.ok()) return false;
   BlobFileFooter blob_file_footer;
   status_ = blob_file_footer.DecodeFrom(&slice);
-  end_of_blob_record_ = file_size_ - BlobFileFooter::kEncodedLength -
-                        blob_file_footer.meta_index_handle.size();
+  if (!status_.ok()) return false;
+  std::string dict;
+  BlockHandle dict_handle;
+  status_ = ReadCompressionDict(
+      blob_file_footer,
+      [this](uint64_t offset, size_t n, Slice* result, char* scratch) {
+        return ReadFile(offset, n, result, scratch);
+      },
+      &dict, &dict_handle);
+  if (!status_.ok()) return false;
+  if (!dict.empty()) {
+    compression_dict_ = BlobCompressionDict::NewForUncompression(dict);
+    decoder_ = BlobDecoder(compression_dict_.get());
+    // Records end before the first meta block.
+    end_of_blob_record_ = dict_handle.offset();
+  } else {
+    end_of_blob_record_ = file_size_ - BlobFileFooter::kEncodedLength -
+                          blob_file_footer.meta_index_handle.size();
+  }
   assert(end_of_blob_record_ > BlobFileHeader::kEncodedLength);
   init_ = true;
   return true;
@@ -44,6 +72,8 @@ bool BlobFileIterator::Init() {
 void BlobFileIterator::SeekToFirst() {
   if (!init_ && !Init()) return;
   status_ = Status::OK();
+  block_index_ = 0;
+  block_records_ = 0;
   iterate_offset_ = BlobFileHeader::kEncodedLength;
   file_->SeekNextData(&iterate_offset_);
   Next();
@@ -69,6 +99,16 @@ Status BlobFileIterator::GetFileRealSize(uint64_t* size) const {
 }
 
 void BlobFileIterator::GetBlobRecord() {
+  if (block_index_ + 1 < block_records_) {
+    // The next record of the current blob block, which shares its offset
+    // and size.
+    block_index_++;
+    status_ = DecodeBlockRecord(block_, block_index_, &cur_blob_record_);
+    return;
+  }
+  block_index_ = 0;
+  block_records_ = 0;
+
   if (iterate_offset_ >= end_of_blob_record_) {
     valid_ = false;
     return;
@@ -87,8 +127,8 @@ void BlobFileIterator::GetBlobRecord() {
     }
     need_check_header = false;
   }
-  status_ = file_->Read(iterate_offset_, kBlobHeaderSize, &header_buffer,
-                        header_buffer.get());
+  status_ = Read(iterate_offset_, kBlobHeaderSize, &header_buffer,
+                 header_buffer.get());
   if (!status_.ok()) return;
   if (need_check_header &&
       memcmp(header_buffer.get(), empty_record_header_, kBlobHeaderSize) == 0) {
@@ -101,8 +141,8 @@ void BlobFileIterator::GetBlobRecord() {
     }
 
     // Read the header again
-    status_ = file_->Read(iterate_offset_, kBlobHeaderSize, &header_buffer,
-                          header_buffer.get());
+    status_ = Read(iterate_offset_, kBlobHeaderSize, &header_buffer,
+                   header_buffer.get());
     if (!status_.ok()) return;
   }
   status_ = decoder_.DecodeHeader(&header_buffer);
@@ -111,11 +151,18 @@ void BlobFileIterator::GetBlobRecord() {
   Slice record_slice;
   auto record_size = decoder_.GetRecordSize();
   buffer_.resize(record_size);
-  status_ = file_->Read(iterate_offset_ + kBlobHeaderSize, record_size,
-                        &record_slice, buffer_.data());
-  if (status_.ok()) {
-    status_ =
-        decoder_.DecodeRecord(&record_slice, &cur_blob_record_, &uncompressed_);
+  status_ = Read(iterate_offset_ + kBlobHeaderSize, record_size,
+                 &record_slice, buffer_.data());
+  if (status_.ok() && decoder_.IsBlock()) {
+    status_ = decoder_.DecodeBlock(&record_slice, &block_, &uncompressed_,
+                                   allocator_);
+    if (status_.ok()) {
+      status_ = DecodeBlockRecord(block_, 0, &cur_blob_record_,
+                                  &block_records_);
+    }
+  } else if (status_.ok()) {
+    status_ = decoder_.DecodeRecord(&record_slice, &cur_blob_record_,
+                                    &uncompressed_, allocator_);
   }
   if (!status_.ok()) return;
 
@@ -125,6 +172,54 @@ void BlobFileIterator::GetBlobRecord() {
   valid_ = true;
 }
 
+Status BlobFileIterator::Read(uint64_t offset, size_t n, Slice* result,
+                              char* scratch) {
+  if (readahead_size_ == 0 || n >= readahead_size_) {
+    return ReadFile(offset, n, result, scratch);
+  }
+  if (offset < readahead_begin_offset_ ||
+      offset + n > readahead_begin_offset_ + readahead_buffer_.size()) {
+    // Records end before the meta blocks, so readahead stops there.
+    uint64_t size = readahead_size_;
+    if (offset < end_of_blob_record_) {
+      size = std::min(size, end_of_blob_record_ - offset);
+    }
+    size = std::max<uint64_t>(size, n);
+    readahead_buffer_.resize(size);
+    Slice data;
+    Status s = ReadFile(offset, size, &data, readahead_buffer_.data());
+    if (!s.ok()) {
+      readahead_buffer_.clear();
+      return s;
+    }
+    if (data.data() != readahead_buffer_.data()) {
+      memcpy(readahead_buffer_.data(), data.data(), data.size());
+    }
+    readahead_buffer_.resize(data.size());
+    readahead_begin_offset_ = offset;
+  }
+  // Copies the data, since callers check the content of "scratch".
+  size_t available = 0;
+  if (offset - readahead_begin_offset_ < readahead_buffer_.size()) {
+    available = readahead_buffer_.size() - (offset - readahead_begin_offset_);
+  }
+  size_t size = std::min(n, available);
+  if (size > 0) {
+    memcpy(scratch,
+           readahead_buffer_.data() + (offset - readahead_begin_offset_), size);
+  }
+  *result = Slice(scratch, size);
+  return Status::OK();
+}
+
+Status BlobFileIterator::ReadFile(uint64_t offset, size_t n, Slice* result,
+                                  char* scratch) {
+  if (reader_) {
+    return reader_->Read(offset, n, result, scratch);
+  }
+  return file_->Read(offset, n, result, scratch);
+}
+
 // void BlobFileIterator::PrefetchAndGet() {
 //  if (iterate_offset_ >= end_of_blob_record_) {
 //    valid_ = false;
@@ -157,6 +252,37 @@ void BlobFileIterator::GetBlobRecord() {
 //  }
 //}
 
+Status NewGCBlobFileIterator(uint64_t file_number, uint64_t file_size,
+                             const TitanDBOptions& db_options,
+                             const TitanCFOptions& cf_options,
+                             const EnvOptions& env_options, Env* env,
+                             std::unique_ptr<BlobFileIterator>* result) {
+  std::unique_ptr<PosixRandomRWFile> rw_file;
+  Status s =
+      OpenBlobFile(file_number, 0, db_options, env_options, env, &rw_file);
+  if (!s.ok()) {
+    return s;
+  }
+  std::unique_ptr<BlobFileIterator> iter(new BlobFileIterator(
+      std::move(rw_file), file_number, file_size, cf_options));
+  if (db_options.use_direct_io_for_flush_and_compaction) {
+    EnvOptions direct_env_options(env_options);
+    direct_env_options.use_direct_reads = true;
+    std::unique_ptr<RandomAccessFileReader> reader;
+    s = NewBlobFileReader(file_number, 0, db_options, direct_env_options, env,
+                          &reader);
+    if (!s.ok()) {
+      return s;
+    }
+    iter->SetFileReader(std::move(reader));
+    iter->SetReadaheadSize(db_options.compaction_readahead_size > 0
+                               ? db_options.compaction_readahead_size
+                               : kDefaultDirectReadaheadSize);
+  }
+  *result = std::move(iter);
+  return s;
+}
+
 BlobFileMergeIterator::BlobFileMergeIterator(
     std::vector<std::unique_ptr<BlobFileIterator>>&& blob_file_iterators)
     : blob_file_iterators_(std::move(blob_file_iterators)) {}
@@ -33,6 +33,18 @@ class BlobFileIterator {
   Slice value() const;
   Status status() const { return status_; }
 
+  // Reads the file ahead by "size" bytes at a time, which helps iterating
+  // a whole file. Zero disables readahead.
+  void SetReadaheadSize(uint64_t size) { readahead_size_ = size; }
+
+  // Reads the file through "reader" instead of the read-write file, e.g.
+  // one opened with direct I/O, so that iterating a whole file doesn't
+  // fill the page cache. Holes are still found and punched through the
+  // read-write file.
+  void SetFileReader(std::unique_ptr<RandomAccessFileReader>&& reader) {
+    reader_ = std::move(reader);
+  }
+
   Status PunchHole(uint64_t offset, size_t n);
   Status GetFileRealSize(uint64_t* size) const;
 
@@ -41,12 +53,17 @@ class BlobFileIterator {
     blob_index.file_number = file_number_;
     blob_index.blob_handle.offset = cur_record_offset_;
     blob_index.blob_handle.size = cur_record_size_;
+    if (block_records_ > 0) {
+      blob_index.blob_handle.index = block_index_;
+      blob_index.blob_handle.count = block_records_;
+    }
     return blob_index;
   }
 
  private:
   // Blob file info
   const std::unique_ptr<PosixRandomRWFile> file_;
+  std::unique_ptr<RandomAccessFileReader> reader_;
   const uint64_t file_number_;
   const uint64_t file_size_;
   TitanCFOptions titan_cf_options_;
@@ -58,23 +75,47 @@ class BlobFileIterator {
   Status status_;
   bool valid_{false};
 
+  std::shared_ptr<const BlobCompressionDict> compression_dict_;
   BlobDecoder decoder_;
+  MemoryAllocator* allocator_;
   uint64_t iterate_offset_{0};
   std::vector<char> buffer_;
   OwnedSlice uncompressed_;
   BlobRecord cur_blob_record_;
   uint64_t cur_record_offset_;
   uint64_t cur_record_size_;
-
-  // uint64_t readahead_begin_offset_{0};
-  // uint64_t readahead_end_offset_{0};
-  // uint64_t readahead_size_{kMinReadaheadSize};
+  // Uncompressed contents of the current blob block, in uncompressed_ or
+  // buffer_. Zero block_records_ means the current record is not packed.
+  Slice block_;
+  uint32_t block_index_{0};
+  uint32_t block_records_{0};
+
+  uint64_t readahead_size_{0};
+  // Data of the file from readahead_begin_offset_.
+  uint64_t readahead_begin_offset_{0};
+  std::vector<char> readahead_buffer_;
   char empty_record_header_[kBlobHeaderSize]{0};
 
   //  void PrefetchAndGet();
   void GetBlobRecord();
+
+  // Reads "n" bytes at "offset" to "scratch", through the readahead buffer
+  // if readahead is enabled.
+  Status Read(uint64_t offset, size_t n, Slice* result, char* scratch);
+
+  // Reads "n" bytes at "offset" from the file, through reader_ if set.
+  Status ReadFile(uint64_t offset, size_t n, Slice* result, char* scratch);
 };
 
+// Opens an iterator of the blob file for GC. With direct I/O for flush and
+// compaction, the file is read with direct I/O too, so that GC doesn't
+// push index and filter blocks of the base DB out of the page cache.
+Status NewGCBlobFileIterator(uint64_t file_number, uint64_t file_size,
+                             const TitanDBOptions& db_options,
+                             const TitanCFOptions& cf_options,
+                             const EnvOptions& env_options, Env* env,
+                             std::unique_ptr<BlobFileIterator>* result);
+
 class BlobFileMergeIterator {
  public:
   explicit BlobFileMergeIterator(
@@ -120,6 +120,71 @@ TEST_F(BlobFileIteratorTest, Basic) {
   TestBlobFileIterator();
 }
 
+TEST_F(BlobFileIteratorTest, CompressionDict) {
+  if (!BlobCompressionDict::Supported()) {
+    return;
+  }
+  titan_options_.blob_file_compression = kZSTD;
+  NewBuilder();
+  builder_->SetCompressionDict(std::string(1024, 'v'));
+
+  const int n = 100;
+  std::vector<BlobHandle> handles(n);
+  for (int i = 0; i < n; i++) {
+    AddKeyValue(GenKey(i), GenValue(i), &handles[i]);
+  }
+  FinishBuilder();
+
+  // Records end before the dictionary block.
+  NewBlobFileIterator();
+  blob_file_iterator_->SeekToFirst();
+  for (int i = 0; i < n; blob_file_iterator_->Next(), i++) {
+    ASSERT_OK(blob_file_iterator_->status());
+    ASSERT_TRUE(blob_file_iterator_->Valid());
+    ASSERT_EQ(GenKey(i), blob_file_iterator_->key());
+    ASSERT_EQ(GenValue(i), blob_file_iterator_->value());
+    ASSERT_EQ(handles[i], blob_file_iterator_->GetBlobIndex().blob_handle);
+  }
+  ASSERT_OK(blob_file_iterator_->status());
+  ASSERT_FALSE(blob_file_iterator_->Valid());
+}
+
+TEST_F(BlobFileIteratorTest, BlobBlock) {
+  titan_options_.blob_file_compression = kLZ4Compression;
+  titan_options_.blob_file_block_size = 4 << 10;
+  titan_options_.min_blob_size = 128;
+  NewBuilder();
+
+  const int n = 1000;
+  std::vector<std::string> keys(n);
+  std::vector<std::string> values(n);
+  std::vector<BlobRecord> records(n);
+  for (int i = 0; i < n; i++) {
+    keys[i] = GenKey(i);
+    values[i] = GenValue(i);
+    records[i].key = keys[i];
+    records[i].value = values[i];
+  }
+  std::vector<BlobHandle> handles;
+  builder_->AddBatch(records, &handles);
+  ASSERT_OK(builder_->status());
+  ASSERT_TRUE(handles[0].packed());
+  FinishBuilder();
+
+  // Records packed in a block share the offset and size of the block.
+  NewBlobFileIterator();
+  blob_file_iterator_->SeekToFirst();
+  for (int i = 0; i < n; blob_file_iterator_->Next(), i++) {
+    ASSERT_OK(blob_file_iterator_->status());
+    ASSERT_TRUE(blob_file_iterator_->Valid());
+    ASSERT_EQ(keys[i], blob_file_iterator_->key());
+    ASSERT_EQ(values[i], blob_file_iterator_->value());
+    ASSERT_EQ(handles[i], blob_file_iterator_->GetBlobIndex().blob_handle);
+  }
+  ASSERT_OK(blob_file_iterator_->status());
+  ASSERT_FALSE(blob_file_iterator_->Valid());
+}
+
 TEST_F(BlobFileIteratorTest, MergeIterator) {
   const int kMaxKeyNum = 1000;
   std::vector<BlobHandle> handles(kMaxKeyNum);
@@ -6,6 +6,8 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+
 #include "util/crc32c.h"
 #include "util/filename.h"
 #include "util/string_util.h"
@@ -58,7 +60,17 @@ Status NewBlobFileReader(uint64_t file_number, uint64_t readahead_size,
   return s;
 }
 
-const uint64_t kMaxReadaheadSize = 256 << 10;
+// Reads skipping no more than this gap after the last one are still taken
+// as sequential by the prefetcher.
+const uint64_t kMaxReadaheadGapSize = 64 << 10;
+
+// Records separated by no more than this gap are fetched by one read in
+// MultiGet. Records are padded to 4KB boundaries, so the gap covers the
+// padding between neighbouring records.
+const uint64_t kMaxCoalesceGapSize = 4 << 10;
+
+// The upper bound of a coalesced read in MultiGet.
+const uint64_t kMaxCoalesceReadSize = 1 << 20;
 
 namespace {
 
@@ -77,6 +89,35 @@ void EncodeBlobCache(std::string* dst, const Slice& prefix, uint64_t offset) {
   PutVarint64(dst, offset);
 }
 
+// Value of blob cache which is offered to the persistent cache when it is
+// evicted from blob cache.
+struct PersistentCacheValue : public OwnedSlice {
+  std::shared_ptr<BlobPersistentCache> persistent_cache;
+  std::string key;
+};
+
+void DeletePersistentCacheValue(const Slice& /*key*/, void* value) {
+  auto cache_value =
+      static_cast<PersistentCacheValue*>(reinterpret_cast<OwnedSlice*>(value));
+  cache_value->persistent_cache->Insert(cache_value->key, *cache_value);
+  delete cache_value;
+}
+
+// Decodes the record of the handle from the data cached or read, which is
+// the uncompressed contents of the blob block if the record is packed.
+Status DecodeBlob(const Slice& data, const BlobHandle& handle,
+                  BlobRecord* record) {
+  if (handle.packed()) {
+    return DecodeBlockRecord(data, handle.index, record);
+  }
+  return DecodeInto(data, record);
+}
+
+template <class T>
+void ReleaseSharedPtr(void* arg1, void* /*arg2*/) {
+  delete reinterpret_cast<std::shared_ptr<T>*>(arg1);
+}
+
 }  // namespace
 
 Status BlobFileReader::Open(const TitanCFOptions& options,
@@ -84,6 +125,11 @@ Status BlobFileReader::Open(const TitanCFOptions& options,
                             uint64_t file_size,
                             std::unique_ptr<BlobFileReader>* result,
                             TitanStats* stats) {
+  if (file_size == 0) {
+    // A value log being written, which has no footer yet.
+    result->reset(new BlobFileReader(options, std::move(file), stats));
+    return Status::OK();
+  }
   if (file_size < BlobFileFooter::kEncodedLength) {
     return Status::Corruption("file is too short to be a blob file");
   }
@@ -101,8 +147,25 @@ Status BlobFileReader::Open(const TitanCFOptions& options,
     return s;
   }
 
+  std::string dict;
+  s = ReadCompressionDict(
+      footer,
+      [&file](uint64_t offset, size_t n, Slice* result, char* scratch) {
+        return file->Read(offset, n, result, scratch);
+      },
+      &dict);
+  if (!s.ok()) {
+    return s;
+  }
+
   auto reader = new BlobFileReader(options, std::move(file), stats);
   reader->footer_ = footer;
+  if (!dict.empty()) {
+    reader->compression_dict_ = BlobCompressionDict::NewForUncompression(dict);
+  }
+  // The file returns data out of the provided scratch buffer only if it is
+  // memory mapped, i.e. opened with allow_mmap_reads.
+  reader->mmap_reads_ = buffer.data() != buffer.get();
   result->reset(reader);
   return Status::OK();
 }
@@ -113,13 +176,24 @@ BlobFileReader::BlobFileReader(const TitanCFOptions& options,
     : options_(options),
       file_(std::move(file)),
       cache_(options.blob_cache),
+      admission_filter_(options.blob_cache_admission_filter),
+      allocator_(GetBlobBufferAllocator(options.blob_buffer_pool.get(),
+                                        cache_.get())),
       stats_(stats) {
   if (cache_) {
     GenerateCachePrefix(&cache_prefix_, cache_.get(), file_->file());
   }
+  if (options.blob_persistent_cache) {
+    char buffer[kMaxVarint64Length * 3 + 1];
+    auto size = file_->file()->GetUniqueId(buffer, sizeof(buffer));
+    if (size > 0) {
+      persistent_cache_ = options.blob_persistent_cache;
+      persistent_cache_prefix_.assign(buffer, size);
+    }
+  }
 }
 
-Status BlobFileReader::Get(const ReadOptions& /*options*/,
+Status BlobFileReader::Get(const ReadOptions& options,
                            const BlobHandle& handle, BlobRecord* record,
                            PinnableSlice* buffer) {
   TEST_SYNC_POINT("BlobFileReader::Get");
@@ -128,43 +202,141 @@ Status BlobFileReader::Get(const ReadOptions& /*options*/,
   Cache::Handle* cache_handle = nullptr;
   if (cache_) {
     EncodeBlobCache(&cache_key, cache_prefix_, handle.offset);
+    if (admission_filter_ && options.fill_cache) {
+      admission_filter_->Record(cache_key);
+    }
     cache_handle = cache_->Lookup(cache_key);
     if (cache_handle) {
       RecordTick(stats_, BLOCK_CACHE_DATA_HIT);
       RecordTick(stats_, BLOCK_CACHE_HIT);
       auto blob = reinterpret_cast<OwnedSlice*>(cache_->Value(cache_handle));
       buffer->PinSlice(*blob, UnrefCacheHandle, cache_.get(), cache_handle);
-      return DecodeInto(*blob, record);
+      return DecodeBlob(*blob, handle, record);
     }
   }
   RecordTick(stats_, BLOCK_CACHE_DATA_MISS);
   RecordTick(stats_, BLOCK_CACHE_MISS);
 
+  Status s;
+  if (persistent_cache_ &&
+      GetFromPersistentCache(handle, cache_key, options.fill_cache, record,
+                             buffer, &s)) {
+    return s;
+  }
+
   OwnedSlice blob;
-  Status s = ReadRecord(handle, record, &blob);
+  s = ReadRecord(handle, record, &blob);
   if (!s.ok()) {
     return s;
   }
 
-  if (cache_) {
-    auto cache_value = new OwnedSlice(std::move(blob));
-    auto cache_size = cache_value->size() + sizeof(*cache_value);
-    cache_->Insert(cache_key, cache_value, cache_size,
-                   &DeleteCacheValue<OwnedSlice>, &cache_handle);
-    buffer->PinSlice(*cache_value, UnrefCacheHandle, cache_.get(),
-                     cache_handle);
+  if (!blob.owned()) {
+    // The uncompressed record is read from the file mapping, which lives in
+    // page cache already, so it is not worth being copied to blob cache.
+    PinMapped(blob, buffer);
+  } else if (ShouldFillCache(options.fill_cache, cache_key,
+                             CacheCharge(blob))) {
+    InsertBlobCache(cache_key, handle.offset, std::move(blob), buffer);
   } else {
-    buffer->PinSlice(blob, OwnedSlice::CleanupFunc, blob.release(), nullptr);
+    PinOwned(handle.offset, options.fill_cache, std::move(blob), buffer);
   }
 
   return Status::OK();
 }
 
+bool BlobFileReader::GetFromPersistentCache(const BlobHandle& handle,
+                                            const std::string& cache_key,
+                                            bool fill_cache,
+                                            BlobRecord* record,
+                                            PinnableSlice* buffer,
+                                            Status* s) {
+  std::string key;
+  EncodeBlobCache(&key, persistent_cache_prefix_, handle.offset);
+  OwnedSlice blob;
+  // A corrupted record is taken as a miss and read from the blob file.
+  if (!persistent_cache_->Lookup(key, &blob).ok()) {
+    RecordTick(stats_, PERSISTENT_CACHE_MISS);
+    return false;
+  }
+  RecordTick(stats_, PERSISTENT_CACHE_HIT);
+  if (ShouldFillCache(fill_cache, cache_key, CacheCharge(blob))) {
+    auto cache_value = InsertBlobCache(cache_key, handle.offset,
+                                       std::move(blob), buffer);
+    *s = DecodeBlob(*cache_value, handle, record);
+  } else {
+    *s = DecodeBlob(blob, handle, record);
+    Slice data = blob;
+    auto allocator = blob.allocator();
+    buffer->PinSlice(data, OwnedSlice::CleanupFunc, blob.release(), allocator);
+  }
+  return true;
+}
+
+bool BlobFileReader::ShouldFillCache(bool fill_cache,
+                                     const std::string& cache_key,
+                                     size_t charge) const {
+  if (!cache_ || !fill_cache) {
+    return false;
+  }
+  return !admission_filter_ ||
+         admission_filter_->Admit(cache_key, cache_.get(), charge);
+}
+
+size_t BlobFileReader::CacheCharge(const OwnedSlice& blob) {
+  return blob.usable_size() + sizeof(OwnedSlice);
+}
+
+size_t BlobFileReader::CacheCharge(size_t size) const {
+  // Buffers of the pool are rounded up to its size classes.
+  if (options_.blob_buffer_pool) {
+    size = BlobBufferPool::AllocatedSize(size);
+  }
+  return size + sizeof(OwnedSlice);
+}
+
+OwnedSlice* BlobFileReader::InsertBlobCache(const std::string& cache_key,
+                                            uint64_t offset, OwnedSlice&& blob,
+                                            PinnableSlice* buffer) {
+  OwnedSlice* cache_value = nullptr;
+  void (*deleter)(const Slice&, void*) = nullptr;
+  if (persistent_cache_) {
+    auto value = new PersistentCacheValue();
+    value->persistent_cache = persistent_cache_;
+    EncodeBlobCache(&value->key, persistent_cache_prefix_, offset);
+    cache_value = value;
+    deleter = &DeletePersistentCacheValue;
+  } else {
+    cache_value = new OwnedSlice();
+    deleter = &DeleteCacheValue<OwnedSlice>;
+  }
+  *cache_value = std::move(blob);
+  auto cache_size = CacheCharge(*cache_value);
+  Cache::Handle* cache_handle = nullptr;
+  cache_->Insert(cache_key, cache_value, cache_size, deleter, &cache_handle);
+  buffer->PinSlice(*cache_value, UnrefCacheHandle, cache_.get(),
+                   cache_handle);
+  return cache_value;
+}
+
+void BlobFileReader::PinOwned(uint64_t offset, bool fill_cache,
+                              OwnedSlice&& blob, PinnableSlice* buffer) {
+  // With blob cache, records reach the persistent cache when they are
+  // evicted from blob cache.
+  if (persistent_cache_ && fill_cache && !cache_) {
+    std::string key;
+    EncodeBlobCache(&key, persistent_cache_prefix_, offset);
+    persistent_cache_->Insert(key, blob);
+  }
+  Slice data = blob;
+  auto allocator = blob.allocator();
+  buffer->PinSlice(data, OwnedSlice::CleanupFunc, blob.release(), allocator);
+}
+
 Status BlobFileReader::ReadRecord(const BlobHandle& handle, BlobRecord* record,
                                   OwnedSlice* buffer) {
   Slice blob;
-  CacheAllocationPtr ubuf(new char[handle.size]);
-  Status s = file_->Read(handle.offset, handle.size, &blob, ubuf.get());
+  CacheAllocationPtr ubuf;
+  Status s = Read(handle.offset, handle.size, &blob, &ubuf);
   if (!s.ok()) {
     return s;
   }
@@ -174,32 +346,241 @@ Status BlobFileReader::ReadRecord(const BlobHandle& handle, BlobRecord* record,
         " not equal to blob size " + ToString(handle.size));
   }
 
-  BlobDecoder decoder;
+  BlobDecoder decoder(compression_dict_.get());
   s = decoder.DecodeHeader(&blob);
   if (!s.ok()) {
     return s;
   }
   buffer->reset(std::move(ubuf), blob);
-  s = decoder.DecodeRecord(&blob, record, buffer);
-  return s;
+  return DecodeBody(handle, &decoder, &blob, record, buffer);
+}
+
+Status BlobFileReader::DecodeBody(const BlobHandle& handle,
+                                  BlobDecoder* decoder, Slice* src,
+                                  BlobRecord* record, OwnedSlice* buffer) {
+  if (decoder->IsBlock() != handle.packed()) {
+    return Status::Corruption("BlobRecord", "blob block mismatch");
+  }
+  if (!decoder->IsBlock()) {
+    return decoder->DecodeRecord(src, record, buffer, allocator_);
+  }
+  Slice block;
+  Status s = decoder->DecodeBlock(src, &block, buffer, allocator_);
+  if (!s.ok()) {
+    return s;
+  }
+  return DecodeBlockRecord(block, handle.index, record);
+}
+
+Status BlobFileReader::Read(uint64_t offset, size_t n, Slice* result,
+                            CacheAllocationPtr* buffer) {
+  if (mmap_reads_) {
+    return file_->Read(offset, n, result, nullptr);
+  }
+  // With direct I/O, the file reader reads the aligned range into its own
+  // buffer, which goes through the rate limiter and I/O stats as reads of
+  // SST files do.
+  *buffer = AllocateBlock(n, allocator_);
+  return file_->Read(offset, n, result, buffer->get());
+}
+
+void BlobFileReader::MultiGet(const ReadOptions& options,
+                              std::vector<BlobReadRequest>* requests) {
+  std::vector<BlobReadRequest*> misses;
+  misses.reserve(requests->size());
+  for (auto& request : *requests) {
+    std::string cache_key;
+    if (cache_) {
+      EncodeBlobCache(&cache_key, cache_prefix_, request.handle->offset);
+      if (admission_filter_ && options.fill_cache) {
+        admission_filter_->Record(cache_key);
+      }
+      auto cache_handle = cache_->Lookup(cache_key);
+      if (cache_handle) {
+        RecordTick(stats_, BLOCK_CACHE_DATA_HIT);
+        RecordTick(stats_, BLOCK_CACHE_HIT);
+        auto blob =
+            reinterpret_cast<OwnedSlice*>(cache_->Value(cache_handle));
+        request.buffer->PinSlice(*blob, UnrefCacheHandle, cache_.get(),
+                                 cache_handle);
+        *request.status = DecodeBlob(*blob, *request.handle, request.record);
+        continue;
+      }
+    }
+    RecordTick(stats_, BLOCK_CACHE_DATA_MISS);
+    RecordTick(stats_, BLOCK_CACHE_MISS);
+    if (persistent_cache_ &&
+        GetFromPersistentCache(*request.handle, cache_key, options.fill_cache,
+                               request.record, request.buffer,
+                               request.status)) {
+      continue;
+    }
+    misses.push_back(&request);
+  }
+
+  std::sort(misses.begin(), misses.end(),
+            [](const BlobReadRequest* a, const BlobReadRequest* b) {
+              return a->handle->offset < b->handle->offset;
+            });
+
+  for (size_t i = 0; i < misses.size();) {
+    uint64_t begin = misses[i]->handle->offset;
+    uint64_t end = begin + misses[i]->handle->size;
+    size_t j = i + 1;
+    for (; j < misses.size(); j++) {
+      const BlobHandle* next = misses[j]->handle;
+      uint64_t next_end = std::max(end, next->offset + next->size);
+      if (next->offset > end + kMaxCoalesceGapSize ||
+          next_end - begin > kMaxCoalesceReadSize) {
+        break;
+      }
+      end = next_end;
+    }
+    ReadCoalesced(
+        begin, end, options.fill_cache,
+        std::vector<BlobReadRequest*>(misses.begin() + i, misses.begin() + j));
+    i = j;
+  }
+}
+
+void BlobFileReader::ReadCoalesced(
+    uint64_t begin, uint64_t end, bool fill_cache,
+    const std::vector<BlobReadRequest*>& requests) {
+  Slice data;
+  CacheAllocationPtr ubuf;
+  Status s = Read(begin, end - begin, &data, &ubuf);
+  if (s.ok() && data.size() != end - begin) {
+    s = Status::Corruption("ReadCoalesced actual size: " +
+                           ToString(data.size()) + " not equal to " +
+                           ToString(end - begin));
+  }
+  if (!s.ok()) {
+    for (auto request : requests) {
+      *request->status = s;
+    }
+    return;
+  }
+  // Uncompressed records not inserted to blob cache are pinned directly to
+  // the shared read buffer, which is freed after the last of them is released.
+  std::shared_ptr<char> shared;
+  if (ubuf) {
+    CustomDeleter deleter = ubuf.get_deleter();
+    shared.reset(ubuf.release(), deleter);
+  }
+
+  for (auto request : requests) {
+    const BlobHandle& handle = *request->handle;
+    Slice blob(data.data() + (handle.offset - begin), handle.size);
+    BlobDecoder decoder(compression_dict_.get());
+    s = decoder.DecodeHeader(&blob);
+    if (!s.ok()) {
+      *request->status = s;
+      continue;
+    }
+    // The record, or the contents of the blob block, as it is stored.
+    Slice encoded(blob.data(), decoder.GetRecordSize());
+    OwnedSlice uncompressed;
+    s = DecodeBody(handle, &decoder, &blob, request->record, &uncompressed);
+    if (!s.ok()) {
+      *request->status = s;
+      continue;
+    }
+    bool compressed = decoder.GetCompressionType() != kNoCompression;
+    std::string cache_key;
+    if (cache_) {
+      EncodeBlobCache(&cache_key, cache_prefix_, handle.offset);
+    }
+
+    if (mmap_reads_ && !compressed) {
+      PinMapped(encoded, request->buffer);
+    } else if (ShouldFillCache(fill_cache, cache_key,
+                               compressed ? CacheCharge(uncompressed)
+                                          : CacheCharge(encoded.size()))) {
+      OwnedSlice cache_value;
+      if (compressed) {
+        cache_value = std::move(uncompressed);
+      } else {
+        CacheAllocationPtr copy = AllocateBlock(encoded.size(), allocator_);
+        memcpy(copy.get(), encoded.data(), encoded.size());
+        cache_value.reset(std::move(copy), encoded.size());
+      }
+      auto pinned = InsertBlobCache(cache_key, handle.offset,
+                                    std::move(cache_value), request->buffer);
+      s = DecodeBlob(*pinned, handle, request->record);
+    } else if (compressed) {
+      PinOwned(handle.offset, fill_cache, std::move(uncompressed),
+               request->buffer);
+    } else {
+      if (persistent_cache_ && fill_cache && !cache_) {
+        std::string key;
+        EncodeBlobCache(&key, persistent_cache_prefix_, handle.offset);
+        persistent_cache_->Insert(key, encoded);
+      }
+      request->buffer->PinSlice(encoded, ReleaseSharedPtr<char>,
+                                new std::shared_ptr<char>(shared), nullptr);
+    }
+    *request->status = s;
+  }
+}
+
+void BlobFileReader::PinMapped(const Slice& data, PinnableSlice* buffer) {
+  // Holds the file to keep the mapping valid even if the reader is evicted
+  // from the file cache.
+  buffer->PinSlice(data, ReleaseSharedPtr<RandomAccessFileReader>,
+                   new std::shared_ptr<RandomAccessFileReader>(file_),
+                   nullptr);
 }
 
 Status BlobFilePrefetcher::Get(const ReadOptions& options,
                                const BlobHandle& handle, BlobRecord* record,
                                PinnableSlice* buffer) {
-  if (handle.offset == last_offset_) {
-    last_offset_ = handle.offset + handle.size;
-    if (handle.offset + handle.size > readahead_limit_) {
-      readahead_size_ = std::max(handle.size, readahead_size_);
-      reader_->file_->Prefetch(handle.offset, readahead_size_);
-      readahead_limit_ = handle.offset + readahead_size_;
-      readahead_size_ = std::min(kMaxReadaheadSize, readahead_size_ * 2);
+  uint64_t max_readahead_size = options.readahead_size > 0
+                                    ? options.readahead_size
+                                    : reader_->options_.max_blob_readahead_size;
+  uint64_t end = handle.offset + handle.size;
+  if (handle.offset == last_begin_ && end == last_offset_) {
+    // Another record of the blob block read last time.
+    return reader_->Get(options, handle, record, buffer);
+  }
+  bool forward = handle.offset >= last_offset_ &&
+                 handle.offset - last_offset_ <= kMaxReadaheadGapSize;
+  // Reverse iteration reads records in descending offsets.
+  bool backward = !forward && end <= last_begin_ &&
+                  last_begin_ - end <= kMaxReadaheadGapSize;
+
+  if (!forward && !backward) {
+    // Shrinks the readahead if most of the last one was wasted. Otherwise
+    // keeps the size learnt so far, so that an occasional jump doesn't
+    // restart readahead from scratch.
+    uint64_t used = backward_ ? readahead_limit_ - last_begin_
+                              : last_offset_ - readahead_begin_;
+    if (readahead_limit_ > 0 && used * 2 < readahead_size_) {
+      readahead_size_ /= 2;
     }
-  } else {
-    last_offset_ = handle.offset + handle.size;
-    readahead_size_ = 0;
     readahead_limit_ = 0;
+  } else if ((readahead_limit_ == 0 || backward != backward_ ||
+              handle.offset < readahead_begin_ || end > readahead_limit_) &&
+             max_readahead_size > 0) {
+    // The last readahead in the same direction was used up, doubles the
+    // next one.
+    if (readahead_limit_ > 0 && backward == backward_) {
+      readahead_size_ *= 2;
+    }
+    readahead_size_ = std::min(max_readahead_size,
+                               std::max(handle.size, readahead_size_));
+    if (backward) {
+      readahead_begin_ = end > readahead_size_ ? end - readahead_size_ : 0;
+      readahead_limit_ = end;
+    } else {
+      readahead_begin_ = handle.offset;
+      readahead_limit_ = handle.offset + readahead_size_;
+    }
+    backward_ = backward;
+    reader_->file_->Prefetch(readahead_begin_,
+                             readahead_limit_ - readahead_begin_);
   }
+  last_begin_ = handle.offset;
+  last_offset_ = end;
 
   return reader_->Get(options, handle, record, buffer);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "blob_cache_admission_filter.h"
 #include "blob_format.h"
+#include "blob_persistent_cache.h"
 #include "env/io_posix.h"
 #include "titan/options.h"
 #include "titan_stats.h"
@@ -19,10 +21,21 @@ Status NewBlobFileReader(uint64_t file_number, uint64_t readahead_size,
                          const EnvOptions& env_options, Env* env,
                          std::unique_ptr<RandomAccessFileReader>* result);
 
+// A request to read one blob record as part of a batch. All the pointers
+// must be valid until the batch is done.
+struct BlobReadRequest {
+  const BlobHandle* handle{nullptr};
+  BlobRecord* record{nullptr};
+  PinnableSlice* buffer{nullptr};
+  Status* status{nullptr};
+};
+
 class BlobFileReader {
  public:
   // Opens a blob file and read the necessary metadata from it.
   // If successful, sets "*result" to the newly opened file reader.
+  // A "file_size" of 0 opens a value log that is still being written,
+  // which must not be memory mapped.
   static Status Open(const TitanCFOptions& options,
                      std::unique_ptr<RandomAccessFileReader> file,
                      uint64_t file_size,
@@ -31,10 +44,17 @@ class BlobFileReader {
 
   // Gets the blob record pointed by the handle in this file. The data
   // of the record is stored in the provided buffer, so the buffer
-  // must be valid when the record is used.
+  // must be valid when the record is used. A record packed in a blob
+  // block pins the whole block, which is cached as one entry.
   Status Get(const ReadOptions& options, const BlobHandle& handle,
              BlobRecord* record, PinnableSlice* buffer);
 
+  // Gets the blob records of a batch of requests. Requests are sorted
+  // by offset and neighbouring records are fetched with a single read.
+  // The status of each request is stored in its own status field.
+  void MultiGet(const ReadOptions& options,
+                std::vector<BlobReadRequest>* requests);
+
  private:
   friend class BlobFilePrefetcher;
 
@@ -45,19 +65,89 @@ class BlobFileReader {
   Status ReadRecord(const BlobHandle& handle, BlobRecord* record,
                     OwnedSlice* buffer);
 
+  // Reads "n" bytes from "offset" of the file. Sets "*buffer" to the
+  // buffer holding the data, which is left empty if the data points to
+  // the file mapping.
+  Status Read(uint64_t offset, size_t n, Slice* result,
+              CacheAllocationPtr* buffer);
+
+  // Reads the range [begin, end) of the file with a single read and
+  // decodes the records of the requests lying in that range.
+  void ReadCoalesced(uint64_t begin, uint64_t end, bool fill_cache,
+                     const std::vector<BlobReadRequest*>& requests);
+
+  // Decodes the record of the handle from the source following the
+  // decoded header. The uncompressed record or blob block is stored in
+  // "*buffer" if it is compressed.
+  Status DecodeBody(const BlobHandle& handle, BlobDecoder* decoder,
+                    Slice* src, BlobRecord* record, OwnedSlice* buffer);
+
+  // Looks up the record of the handle in the persistent cache. If found,
+  // pins the record to the buffer, decodes it into "*record", sets "*s"
+  // and returns true.
+  bool GetFromPersistentCache(const BlobHandle& handle,
+                              const std::string& cache_key, bool fill_cache,
+                              BlobRecord* record, PinnableSlice* buffer,
+                              Status* s);
+
+  // Returns true if the record read for the key should be inserted to the
+  // blob cache, where it is charged "charge".
+  bool ShouldFillCache(bool fill_cache, const std::string& cache_key,
+                       size_t charge) const;
+
+  // Returns the charge to the blob cache of the record held by the buffer,
+  // which counts the memory the buffer takes.
+  static size_t CacheCharge(const OwnedSlice& blob);
+
+  // Returns the charge to the blob cache of a copy of the record of the
+  // size, which is allocated from the buffer pool if there is one.
+  size_t CacheCharge(size_t size) const;
+
+  // Inserts the record at the offset to the blob cache and pins it to the
+  // buffer. The record is offered to the persistent cache when it is
+  // evicted from the blob cache.
+  OwnedSlice* InsertBlobCache(const std::string& cache_key, uint64_t offset,
+                              OwnedSlice&& blob, PinnableSlice* buffer);
+
+  // Pins the record read from the file to the buffer without inserting it
+  // to the blob cache.
+  void PinOwned(uint64_t offset, bool fill_cache, OwnedSlice&& blob,
+                PinnableSlice* buffer);
+
+  // Pins the data read from the file mapping to the buffer.
+  void PinMapped(const Slice& data, PinnableSlice* buffer);
+
   TitanCFOptions options_;
-  std::unique_ptr<RandomAccessFileReader> file_;
+  // Shared with the buffers pinning data of the file mapping.
+  std::shared_ptr<RandomAccessFileReader> file_;
+  // Whether the file is memory mapped. Reading a punched hole of the
+  // mapping gets zeros, which fails the checksum as a normal read does.
+  bool mmap_reads_{false};
 
   std::shared_ptr<Cache> cache_;
   std::string cache_prefix_;
+  std::shared_ptr<BlobCacheAdmissionFilter> admission_filter_;
+  // Only set if the file has a unique id, which keeps the keys of its
+  // records stable across restart.
+  std::shared_ptr<BlobPersistentCache> persistent_cache_;
+  std::string persistent_cache_prefix_;
+  // Allocator of read buffers, see GetBlobBufferAllocator().
+  MemoryAllocator* allocator_;
 
   // Information read from the file.
   BlobFileFooter footer_;
+  // Digested once and shared by the reads of the file.
+  std::shared_ptr<const BlobCompressionDict> compression_dict_;
 
   TitanStats* stats_;
 };
 
-// Performs readahead on continuous reads.
+// Performs readahead on continuous reads, allowing short gaps between
+// them. Reads with descending offsets, as issued by reverse iteration, get
+// readahead windows ending at the current record. The readahead size
+// doubles each time the last readahead is used up, up to
+// ReadOptions::readahead_size or TitanCFOptions::max_blob_readahead_size.
+// It is kept on random reads, unless most of the last readahead was wasted.
 class BlobFilePrefetcher : public Cleanable {
  public:
   // Constructs a prefetcher with the blob file reader.
@@ -67,11 +157,18 @@ class BlobFilePrefetcher : public Cleanable {
   Status Get(const ReadOptions& options, const BlobHandle& handle,
              BlobRecord* record, PinnableSlice* buffer);
 
+  uint64_t TEST_readahead_size() const { return readahead_size_; }
+
  private:
   BlobFileReader* reader_;
+  // Range of the last read.
+  uint64_t last_begin_{0};
   uint64_t last_offset_{0};
+  // Size, range and direction of the last readahead.
   uint64_t readahead_size_{0};
+  uint64_t readahead_begin_{0};
   uint64_t readahead_limit_{0};
+  bool backward_{false};
 };
 
 }  // namespace titandb
@@ -213,6 +213,65 @@ TEST_F(BlobFileTest, BlobFilePrefetcher) {
   TestBlobFilePrefetcher(options);
 }
 
+TEST_F(BlobFileTest, BlobFilePrefetcherReadahead) {
+  TitanOptions options;
+  options.dirname = dirname_;
+  TitanDBOptions db_options(options);
+  TitanCFOptions cf_options(options);
+  BlobFileCache cache(db_options, cf_options, {NewLRUCache(128)}, nullptr);
+
+  const int n = 100;
+  std::vector<BlobHandle> handles(n);
+  std::unique_ptr<WritableFileWriter> file;
+  {
+    std::unique_ptr<WritableFile> f;
+    ASSERT_OK(env_->NewWritableFile(file_name_, &f, env_options_));
+    file.reset(new WritableFileWriter(std::move(f), file_name_, env_options_));
+  }
+  BlobFileBuilder builder(db_options, cf_options, file.get());
+  for (int i = 0; i < n; i++) {
+    auto key = std::to_string(i);
+    auto value = std::string(1024, i);
+    BlobRecord record;
+    record.key = key;
+    record.value = value;
+    builder.Add(record, &handles[i]);
+    ASSERT_OK(builder.status());
+  }
+  ASSERT_OK(builder.Finish());
+  uint64_t file_size = 0;
+  ASSERT_OK(env_->GetFileSize(file_name_, &file_size));
+
+  ReadOptions ro;
+  ro.readahead_size = 16 << 10;
+  std::unique_ptr<BlobFilePrefetcher> prefetcher;
+  ASSERT_OK(cache.NewPrefetcher(file_number_, file_size, &prefetcher));
+  auto get = [&](int i) {
+    BlobRecord record;
+    PinnableSlice buffer;
+    ASSERT_OK(prefetcher->Get(ro, handles[i], &record, &buffer));
+    ASSERT_EQ(std::string(1024, i), record.value);
+  };
+  // Readahead grows up to the size of ReadOptions.
+  for (int i = 0; i < 20; i++) {
+    get(i);
+  }
+  ASSERT_EQ(ro.readahead_size, prefetcher->TEST_readahead_size());
+  // Short gaps are taken as sequential reads.
+  get(22);
+  get(25);
+  ASSERT_EQ(ro.readahead_size, prefetcher->TEST_readahead_size());
+  // Random reads don't restart readahead from scratch.
+  get(0);
+  get(1);
+  ASSERT_GE(prefetcher->TEST_readahead_size(), ro.readahead_size / 2);
+  // Reads with descending offsets get readahead as well.
+  for (int i = n - 1; i >= n - 20; i--) {
+    get(i);
+  }
+  ASSERT_EQ(ro.readahead_size, prefetcher->TEST_readahead_size());
+}
+
 TEST_F(BlobFileTest, BloblFile4KAlign) {
   TitanOptions options;
   TestBlobFile4KAlign(options);
@@ -1,5 +1,8 @@
 #include "blob_format.h"
 
+#include "rocksdb/comparator.h"
+#include "table/block.h"
+#include "table/meta_blocks.h"
 #include "util/crc32c.h"
 #include "util/sync_point.h"
 
@@ -34,18 +37,65 @@ bool operator==(const BlobRecord& lhs, const BlobRecord& rhs) {
   return lhs.key == rhs.key && lhs.value == rhs.value;
 }
 
+size_t GetBlockRecordSize(const BlobRecord& record) {
+  return VarintLength(record.key.size()) + record.key.size() +
+         VarintLength(record.value.size()) + record.value.size() + 4;
+}
+
+Status DecodeBlockRecord(const Slice& block, uint32_t index,
+                         BlobRecord* record, uint32_t* count) {
+  if (block.size() < 4) {
+    return Status::Corruption("BlobBlock", "too short");
+  }
+  uint32_t num_records = DecodeFixed32(block.data() + block.size() - 4);
+  uint64_t offsets_size = static_cast<uint64_t>(num_records) * 4 + 4;
+  if (num_records == 0 || offsets_size > block.size() ||
+      index >= num_records) {
+    return Status::Corruption("BlobBlock", "bad record index");
+  }
+  size_t records_size = block.size() - static_cast<size_t>(offsets_size);
+  uint32_t offset = DecodeFixed32(block.data() + records_size + index * 4);
+  if (offset >= records_size) {
+    return Status::Corruption("BlobBlock", "bad record offset");
+  }
+  Slice input(block.data() + offset, records_size - offset);
+  Status s = record->DecodeFrom(&input);
+  if (s.ok() && count) {
+    *count = num_records;
+  }
+  return s;
+}
+
 void BlobEncoder::EncodeRecord(const BlobRecord& record) {
   record_buffer_.clear();
+  record.EncodeTo(&record_buffer_);
+  Seal(0);
+}
+
+void BlobEncoder::EncodeBlock(const BlobRecord* records, size_t n) {
+  record_buffer_.clear();
+  std::vector<uint32_t> offsets(n);
+  for (size_t i = 0; i < n; i++) {
+    offsets[i] = static_cast<uint32_t>(record_buffer_.size());
+    records[i].EncodeTo(&record_buffer_);
+  }
+  for (auto offset : offsets) {
+    PutFixed32(&record_buffer_, offset);
+  }
+  PutFixed32(&record_buffer_, static_cast<uint32_t>(n));
+  Seal(kBlobBlockFlag);
+}
+
+void BlobEncoder::Seal(unsigned char flags) {
   compressed_buffer_.clear();
 
   CompressionType compression;
-  record.EncodeTo(&record_buffer_);
   record_ = Compress(compression_ctx_, record_buffer_, &compressed_buffer_,
-                     &compression);
+                     &compression, compression_dict_);
 
   assert(record_.size() < std::numeric_limits<uint32_t>::max());
   EncodeFixed32(header_ + 4, static_cast<uint32_t>(record_.size()));
-  header_[8] = compression;
+  header_[8] = static_cast<char>(compression | flags);
 
   uint32_t crc = crc32c::Value(header_ + 4, sizeof(header_) - 4);
   crc = crc32c::Extend(crc, record_.data(), record_.size());
@@ -62,13 +112,36 @@ Status BlobDecoder::DecodeHeader(Slice* src) {
   if (!GetFixed32(src, &record_size_) || !GetChar(src, &compression)) {
     return Status::Corruption("BlobHeader");
   }
-  compression_ = static_cast<CompressionType>(compression);
+  is_block_ = (compression & kBlobBlockFlag) != 0;
+  compression_ = static_cast<CompressionType>(compression & ~kBlobBlockFlag);
 
   return Status::OK();
 }
 
 Status BlobDecoder::DecodeRecord(Slice* src, BlobRecord* record,
-                                 OwnedSlice* buffer) {
+                                 OwnedSlice* buffer,
+                                 MemoryAllocator* allocator) {
+  if (is_block_) {
+    return Status::Corruption("BlobRecord", "unexpected blob block");
+  }
+  Slice data;
+  Status s = DecodeData(src, &data, buffer, allocator);
+  if (!s.ok()) {
+    return s;
+  }
+  return DecodeInto(data, record);
+}
+
+Status BlobDecoder::DecodeBlock(Slice* src, Slice* block, OwnedSlice* buffer,
+                                MemoryAllocator* allocator) {
+  if (!is_block_) {
+    return Status::Corruption("BlobBlock", "unexpected blob record");
+  }
+  return DecodeData(src, block, buffer, allocator);
+}
+
+Status BlobDecoder::DecodeData(Slice* src, Slice* data, OwnedSlice* buffer,
+                               MemoryAllocator* allocator) {
   TEST_SYNC_POINT_CALLBACK("BlobDecoder::DecodeRecord", &crc_);
 
   Slice input(src->data(), record_size_);
@@ -79,14 +152,15 @@ Status BlobDecoder::DecodeRecord(Slice* src, BlobRecord* record,
   }
 
   if (compression_ == kNoCompression) {
-    return DecodeInto(input, record);
+    *data = input;
+    return Status::OK();
   }
   UncompressionContext ctx(compression_);
-  Status s = Uncompress(ctx, input, buffer);
-  if (!s.ok()) {
-    return s;
+  Status s = Uncompress(ctx, input, buffer, allocator, compression_dict_);
+  if (s.ok()) {
+    *data = *buffer;
   }
-  return DecodeInto(*buffer, record);
+  return s;
 }
 
 void BlobHandle::EncodeTo(std::string* dst) const {
@@ -102,18 +176,23 @@ Status BlobHandle::DecodeFrom(Slice* src) {
 }
 
 bool operator==(const BlobHandle& lhs, const BlobHandle& rhs) {
-  return lhs.offset == rhs.offset && lhs.size == rhs.size;
+  return lhs.offset == rhs.offset && lhs.size == rhs.size &&
+         lhs.index == rhs.index && lhs.count == rhs.count;
 }
 
 void BlobIndex::EncodeTo(std::string* dst) const {
-  dst->push_back(kBlobRecord);
+  dst->push_back(blob_handle.packed() ? kBlockRecord : kBlobRecord);
   PutVarint64(dst, file_number);
   blob_handle.EncodeTo(dst);
+  if (blob_handle.packed()) {
+    PutVarint32(dst, blob_handle.index);
+    PutVarint32(dst, blob_handle.count);
+  }
 }
 
 Status BlobIndex::DecodeFrom(Slice* src) {
   unsigned char type;
-  if (!GetChar(src, &type) || type != kBlobRecord ||
+  if (!GetChar(src, &type) || (type != kBlobRecord && type != kBlockRecord) ||
       !GetVarint64(src, &file_number)) {
     return Status::Corruption("BlobIndex");
   }
@@ -121,6 +200,14 @@ Status BlobIndex::DecodeFrom(Slice* src) {
   if (!s.ok()) {
     return Status::Corruption("BlobIndex", s.ToString());
   }
+  blob_handle.index = 0;
+  blob_handle.count = 0;
+  if (type == kBlockRecord &&
+      (!GetVarint32(src, &blob_handle.index) ||
+       !GetVarint32(src, &blob_handle.count) || blob_handle.count == 0 ||
+       blob_handle.index >= blob_handle.count)) {
+    return Status::Corruption("BlobIndex", "bad block index");
+  }
   return s;
 }
 
@@ -143,7 +230,7 @@ Status BlobFileMeta::DecodeFrom(Slice* src) {
 
 bool operator==(const BlobFileMeta& lhs, const BlobFileMeta& rhs) {
   return (lhs.file_number_ == rhs.file_number_ &&
-          lhs.file_size_ == rhs.file_size_);
+          lhs.file_size_ == rhs.file_size_ && lhs.sorted_ == rhs.sorted_);
 }
 
 void BlobFileMeta::FileStateTransit(const FileEvent& event) {
@@ -190,6 +277,11 @@ void BlobFileMeta::FileStateTransit(const FileEvent& event) {
       assert(state_ != FileState::kObsolete);
       state_ = FileState::kObsolete;
       break;
+    case FileEvent::kValueLogSealed:
+      // keys of a value log are added to LSM before the log is sealed
+      assert(state_ == FileState::kInit);
+      state_ = FileState::kNormal;
+      break;
     default:
       assert(false);
   }
@@ -276,5 +368,83 @@ bool operator==(const BlobFileFooter& lhs, const BlobFileFooter& rhs) {
           lhs.meta_index_handle.size() == rhs.meta_index_handle.size());
 }
 
+const std::string kCompressionDictBlockName = "titan.compression_dict";
+
+void AppendMetaBlock(const Slice& contents, std::string* dst) {
+  dst->append(contents.data(), contents.size());
+  char trailer[kBlockTrailerSize];
+  trailer[0] = kNoCompression;
+  uint32_t crc = crc32c::Value(contents.data(), contents.size());
+  crc = crc32c::Extend(crc, trailer, 1);
+  EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+  dst->append(trailer, sizeof(trailer));
+}
+
+Status DecodeMetaBlock(Slice* block) {
+  if (block->size() < kBlockTrailerSize) {
+    return Status::Corruption("MetaBlock", "too short");
+  }
+  size_t size = block->size() - kBlockTrailerSize;
+  const char* trailer = block->data() + size;
+  uint32_t crc = crc32c::Value(block->data(), size + 1);
+  if (trailer[0] != kNoCompression ||
+      crc32c::Unmask(DecodeFixed32(trailer + 1)) != crc) {
+    return Status::Corruption("MetaBlock", "checksum mismatch");
+  }
+  *block = Slice(block->data(), size);
+  return Status::OK();
+}
+
+namespace {
+
+Status ReadMetaBlock(const BlockHandle& handle, const BlobFileReadFunc& read,
+                     std::string* contents) {
+  size_t size = static_cast<size_t>(handle.size()) + kBlockTrailerSize;
+  std::string buffer(size, '\0');
+  Slice block;
+  Status s = read(handle.offset(), size, &block, &buffer[0]);
+  if (!s.ok()) return s;
+  if (block.size() != size) {
+    return Status::Corruption("MetaBlock", "truncated");
+  }
+  s = DecodeMetaBlock(&block);
+  if (s.ok()) {
+    contents->assign(block.data(), block.size());
+  }
+  return s;
+}
+
+}  // namespace
+
+Status ReadCompressionDict(const BlobFileFooter& footer,
+                           const BlobFileReadFunc& read, std::string* dict,
+                           BlockHandle* dict_handle) {
+  dict->clear();
+  if (footer.meta_index_handle.size() == 0) {
+    // Files without meta blocks have a null meta index handle.
+    return Status::OK();
+  }
+  std::string meta_index;
+  Status s = ReadMetaBlock(footer.meta_index_handle, read, &meta_index);
+  if (!s.ok()) return s;
+
+  BlockContents contents(meta_index, false /* cachable */, kNoCompression);
+  Block block(std::move(contents), kDisableGlobalSequenceNumber);
+  std::unique_ptr<InternalIterator> iter(block.NewIterator<DataBlockIter>(
+      BytewiseComparator(), BytewiseComparator()));
+  BlockHandle handle;
+  s = FindMetaBlock(iter.get(), kCompressionDictBlockName, &handle);
+  if (s.IsCorruption()) {
+    // The file has no dictionary.
+    return Status::OK();
+  }
+  if (!s.ok()) return s;
+  s = ReadMetaBlock(handle, read, dict);
+  if (s.ok() && dict_handle) {
+    *dict_handle = handle;
+  }
+  return s;
+}
+
 }  // namespace titandb
 }  // namespace rocksdb
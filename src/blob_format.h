@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <string>
+
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
@@ -13,9 +17,13 @@ namespace titandb {
 //
 // crc          : fixed32
 // size         : fixed32
-// compression  : char
+// compression  : char, with kBlobBlockFlag set for blob blocks
 const uint64_t kBlobHeaderSize = 9;
 
+// Marks a blob block, which packs several blob records and is compressed
+// as a whole, see TitanCFOptions::blob_file_block_size.
+const unsigned char kBlobBlockFlag = 0x80;
+
 // Blob record format:
 //
 // key          : varint64 length + length bytes
@@ -30,46 +38,121 @@ struct BlobRecord {
   friend bool operator==(const BlobRecord& lhs, const BlobRecord& rhs);
 };
 
+// Blob block format:
+//
+// records      : N blob records
+// offsets      : N fixed32, offsets of the records in the block
+// count        : fixed32, N
+//
+// Returns the size of the record encoded in a blob block.
+size_t GetBlockRecordSize(const BlobRecord& record);
+
+// Decodes the record of the index from the uncompressed contents of a blob
+// block. If "count" is not null, sets "*count" to the number of records in
+// the block.
+Status DecodeBlockRecord(const Slice& block, uint32_t index,
+                         BlobRecord* record, uint32_t* count = nullptr);
+
 class BlobEncoder {
  public:
-  BlobEncoder(CompressionType compression) : compression_ctx_(compression) {}
+  // Records compressed with kZSTD use the dictionary if it is not null,
+  // which must be valid while the encoder is used.
+  BlobEncoder(CompressionType compression,
+              const CompressionOptions& options = CompressionOptions(),
+              const BlobCompressionDict* dict = nullptr)
+      : compression_ctx_(compression, options), compression_dict_(dict) {}
+
+  void SetCompressionDict(const BlobCompressionDict* dict) {
+    compression_dict_ = dict;
+  }
 
   void EncodeRecord(const BlobRecord& record);
 
+  // Encodes the "n" records as a blob block.
+  void EncodeBlock(const BlobRecord* records, size_t n);
+
   Slice GetHeader() const { return Slice(header_, sizeof(header_)); }
   Slice GetRecord() const { return record_; }
 
   size_t GetEncodedSize() const { return sizeof(header_) + record_.size(); }
 
  private:
+  // Compresses the encoded record or block and fills the header.
+  void Seal(unsigned char flags);
+
   char header_[kBlobHeaderSize];
   Slice record_;
   std::string record_buffer_;
   std::string compressed_buffer_;
   CompressionContext compression_ctx_;
+  const BlobCompressionDict* compression_dict_;
 };
 
 class BlobDecoder {
  public:
+  // Records compressed with kZSTD are uncompressed with the dictionary of
+  // their file if it is not null, which must be valid while the decoder is
+  // used.
+  explicit BlobDecoder(const BlobCompressionDict* dict = nullptr)
+      : compression_dict_(dict) {}
+
   Status DecodeHeader(Slice* src);
-  Status DecodeRecord(Slice* src, BlobRecord* record, OwnedSlice* buffer);
+  // Decodes the record from the source. If the record is compressed, the
+  // uncompressed data is stored in "*buffer", which is allocated from
+  // "allocator" if it is not null.
+  // REQUIRES: the header is not of a blob block.
+  Status DecodeRecord(Slice* src, BlobRecord* record, OwnedSlice* buffer,
+                      MemoryAllocator* allocator = nullptr);
+  // Decodes the blob block from the source and points "*block" to its
+  // uncompressed contents, which are stored in "*buffer" if the block is
+  // compressed.
+  // REQUIRES: the header is of a blob block.
+  Status DecodeBlock(Slice* src, Slice* block, OwnedSlice* buffer,
+                     MemoryAllocator* allocator = nullptr);
 
   size_t GetRecordSize() const { return record_size_; }
+  CompressionType GetCompressionType() const { return compression_; }
+  bool IsBlock() const { return is_block_; }
 
  private:
   uint32_t crc_{0};
   uint32_t header_crc_{0};
   uint32_t record_size_{0};
   CompressionType compression_{kNoCompression};
+  bool is_block_{false};
+  const BlobCompressionDict* compression_dict_;
+
+  // Verifies the checksum and uncompresses the data following the header.
+  Status DecodeData(Slice* src, Slice* data, OwnedSlice* buffer,
+                    MemoryAllocator* allocator);
 };
 
 // Blob handle format:
 //
 // offset       : varint64
 // size         : varint64
+//
+// A record packed in a blob block is addressed by the offset and size of
+// the block, along with its index in the block and the number of records
+// in the block, which are encoded in the blob index.
 struct BlobHandle {
   uint64_t offset{0};
   uint64_t size{0};
+  // Zero count means the record is not packed in a blob block.
+  uint32_t index{0};
+  uint32_t count{0};
+
+  bool packed() const { return count > 0; }
+
+  // Returns the size of the file taken by the record. Records packed in a
+  // block take equal shares of it, with the remainder taken by the first
+  // record, so that the shares add up to the block size.
+  uint64_t record_size() const {
+    if (!packed()) {
+      return size;
+    }
+    return size / count + (index == 0 ? size % count : 0);
+  }
 
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(Slice* src);
@@ -82,9 +165,12 @@ struct BlobHandle {
 // type         : char
 // file_number_  : varint64
 // blob_handle  : varint64 offset + varint64 size
+// block_index  : varint32 index + varint32 count, only for kBlockRecord
 struct BlobIndex {
   enum Type : unsigned char {
     kBlobRecord = 1,
+    // A record packed in a blob block.
+    kBlockRecord = 2,
   };
   uint64_t file_number{0};
   BlobHandle blob_handle;
@@ -99,6 +185,9 @@ struct BlobIndex {
 //
 // file_number_      : varint64
 // file_size_        : varint64
+//
+// Whether the records are sorted by key is persisted by the tag of the
+// version edit adding the file.
 class BlobFileMeta {
  public:
   enum class FileEvent {
@@ -111,6 +200,7 @@ class BlobFileMeta {
     kFlushOrCompactionOutput,
     kDbRestart,
     kDelete,
+    kValueLogSealed,
   };
 
   enum class FileState {
@@ -143,8 +233,37 @@ class BlobFileMeta {
   void set_real_file_size(uint64_t size) { real_file_size_ = size; }
   uint64_t real_file_size() const { return real_file_size_; }
 
+  // Records of flush, compaction and GC outputs are sorted by key, while
+  // records of a sealed value log are in the order they were written.
+  bool sorted() const { return sorted_; }
+  void set_sorted(bool sorted) { sorted_ = sorted; }
+
   void FileStateTransit(const FileEvent& event);
 
+  // Pins the file for a read that doesn't hold a snapshot, so that the
+  // file will not be purged until Unpin() is called. Returns false if the
+  // file has been purged already.
+  bool Pin() {
+    pins_.refs.fetch_add(1);
+    if (pins_.purged.load()) {
+      pins_.refs.fetch_sub(1);
+      return false;
+    }
+    return true;
+  }
+  void Unpin() { pins_.refs.fetch_sub(1, std::memory_order_release); }
+
+  // Marks the file as purged unless it is pinned by some reads. Returns
+  // false if the file is pinned and must be kept.
+  bool TryMarkPurged() {
+    pins_.purged.store(true);
+    if (pins_.refs.load() > 0) {
+      pins_.purged.store(false);
+      return false;
+    }
+    return true;
+  }
+
   void AddDiscardableSize(uint64_t _discardable_size);
   void FinishFreeSpace(uint64_t new_file_size, uint64_t reclaim_size);
   double GetDiscardableRatio() const;
@@ -154,6 +273,7 @@ class BlobFileMeta {
   // Persistent field
   uint64_t file_number_{0};
   uint64_t file_offset_{0};
+  bool sorted_{true};
 
   // Not persistent field
   FileState state_{FileState::kInit};
@@ -167,6 +287,19 @@ class BlobFileMeta {
   // gc_mark is set to true when this file is recovered from re-opening the DB
   // that means this file needs to be checked for GC
   bool gc_mark_{false};
+
+  // Pin state of snapshot-free reads. It is not copied along with the meta.
+  struct ReadPins {
+    ReadPins() = default;
+    ReadPins(const ReadPins&) {}
+    ReadPins& operator=(const ReadPins&) { return *this; }
+
+    // Number of reads pinning the file.
+    std::atomic<uint32_t> refs{0};
+    // Set once the file is removed from the blob storage.
+    std::atomic<bool> purged{false};
+  };
+  ReadPins pins_;
 };
 
 // Blob file header format.
@@ -206,6 +339,30 @@ struct BlobFileFooter {
   friend bool operator==(const BlobFileFooter& lhs, const BlobFileFooter& rhs);
 };
 
+// Name of the meta block holding the zstd dictionary that the records of
+// a blob file are compressed with.
+extern const std::string kCompressionDictBlockName;
+
+// Appends the meta block with the block trailer of BlockBasedTable, which
+// is a type char of kNoCompression and a masked crc32c.
+void AppendMetaBlock(const Slice& contents, std::string* dst);
+
+// Verifies the trailer of the meta block read from the file and removes
+// it from "*block".
+Status DecodeMetaBlock(Slice* block);
+
+// Reads "n" bytes at "offset" of a blob file to "scratch".
+typedef std::function<Status(uint64_t offset, size_t n, Slice* result,
+                             char* scratch)>
+    BlobFileReadFunc;
+
+// Reads the compression dictionary of the blob file. Leaves "*dict" empty
+// if the file has none. If "dict_handle" is not null, points it to the
+// dictionary block, the first meta block of the file.
+Status ReadCompressionDict(const BlobFileFooter& footer,
+                           const BlobFileReadFunc& read, std::string* dict,
+                           BlockHandle* dict_handle = nullptr);
+
 // A convenient template to decode a const slice.
 template <typename T>
 Status DecodeInto(const Slice& src, T* target) {
@@ -31,6 +31,21 @@ TEST(BlobFormatTest, BlobIndex) {
   input.blob_handle.offset = 2;
   input.blob_handle.size = 3;
   CheckCodec(input);
+  input.blob_handle.index = 4;
+  input.blob_handle.count = 5;
+  CheckCodec(input);
+}
+
+TEST(BlobFormatTest, BlockRecordSize) {
+  // Shares of the records packed in a block add up to the block size.
+  BlobHandle handle;
+  handle.size = 4099;
+  handle.count = 4;
+  uint64_t total = 0;
+  for (handle.index = 0; handle.index < handle.count; handle.index++) {
+    total += handle.record_size();
+  }
+  ASSERT_EQ(handle.size, total);
 }
 
 TEST(BlobFormatTest, BlobFileMeta) {
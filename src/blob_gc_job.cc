@@ -61,7 +61,7 @@ class BlobGCJob::GarbageCollectionWriteCallback : public WriteCallback {
 
   uint64_t read_bytes() { return read_bytes_; }
 
-  uint64_t blob_record_size() { return blob_index_.blob_handle.size; }
+  uint64_t blob_record_size() { return blob_index_.blob_handle.record_size(); }
 
  private:
   ColumnFamilyHandle* cfh_;
@@ -217,17 +217,16 @@ Status BlobGCJob::DoSample(const BlobFileMeta* file, bool* selected) {
   assert(selected != nullptr);
   Status s;
 
-  std::unique_ptr<PosixRandomRWFile> file_reader;
-  s = OpenBlobFile(file->file_number(), 0, db_options_, env_options_, env_,
-                   &file_reader);
+  std::unique_ptr<BlobFileIterator> iter;
+  s = NewGCBlobFileIterator(file->file_number(), file->file_size(),
+                             db_options_, blob_gc_->titan_cf_options(),
+                             env_options_, env_, &iter);
   if (!s.ok()) {
     return s;
   }
-  BlobFileIterator iter(std::move(file_reader), file->file_number(),
-                        file->file_size(), blob_gc_->titan_cf_options());
-  iter.SeekToFirst();
-  if (!iter.status().ok()) {
-    s = iter.status();
+  iter->SeekToFirst();
+  if (!iter->status().ok()) {
+    s = iter->status();
     ROCKS_LOG_ERROR(db_options_.info_log,
                     "SeekToFirst failed, file number[%" PRIu64 "] size[%" PRIu64
                     "] status[%s]",
@@ -235,16 +234,16 @@ Status BlobGCJob::DoSample(const BlobFileMeta* file, bool* selected) {
                     s.ToString().c_str());
     return s;
   }
-  assert(iter.Valid());
+  assert(iter->Valid());
 
   uint64_t iterated_size{0};
   uint64_t discardable_size{0};
-  for (; iter.Valid(); iter.Next()) {
-    BlobIndex blob_index = iter.GetBlobIndex();
-    uint64_t total_length = blob_index.blob_handle.size;
+  for (; iter->Valid(); iter->Next()) {
+    BlobIndex blob_index = iter->GetBlobIndex();
+    uint64_t total_length = blob_index.blob_handle.record_size();
     iterated_size += total_length;
     bool discardable = false;
-    s = DiscardEntry(iter.key(), blob_index, &discardable);
+    s = DiscardEntry(iter->key(), blob_index, &discardable);
     if (!s.ok()) {
       return s;
     }
@@ -253,7 +252,7 @@ Status BlobGCJob::DoSample(const BlobFileMeta* file, bool* selected) {
     }
   }
   metrics_.blob_db_bytes_read += iterated_size;
-  assert(iter.status().ok());
+  assert(iter->status().ok());
 
   *selected =
       discardable_size >=
@@ -301,7 +300,7 @@ Status BlobGCJob::DoRunGC() {
     }
     BlobIndex blob_index = gc_iter->GetBlobIndex();
     // count read bytes for blob record of gc candidate files
-    metrics_.blob_db_bytes_read += blob_index.blob_handle.size;
+    metrics_.blob_db_bytes_read += blob_index.blob_handle.record_size();
 
     if (!last_key.empty() && !gc_iter->key().compare(last_key)) {
       if (last_key_valid) {
@@ -319,7 +318,8 @@ Status BlobGCJob::DoRunGC() {
     }
     if (discardable) {
       metrics_.blob_db_gc_num_keys_overwritten++;
-      metrics_.blob_db_gc_bytes_overwritten += blob_index.blob_handle.size;
+      metrics_.blob_db_gc_bytes_overwritten +=
+          blob_index.blob_handle.record_size();
       continue;
     }
 
@@ -401,16 +401,16 @@ Status BlobGCJob::BuildIterator(
   assert(!inputs.empty());
   std::vector<std::unique_ptr<BlobFileIterator>> list;
   for (std::size_t i = 0; i < inputs.size(); ++i) {
-    std::unique_ptr<PosixRandomRWFile> file;
+    std::unique_ptr<BlobFileIterator> iter;
     // TODO(@DorianZheng) set read ahead size
-    s = OpenBlobFile(inputs[i]->file_number(), 0, db_options_, env_options_,
-                     env_, &file);
+    s = NewGCBlobFileIterator(inputs[i]->file_number(),
+                               inputs[i]->file_size(), db_options_,
+                               blob_gc_->titan_cf_options(), env_options_,
+                               env_, &iter);
     if (!s.ok()) {
       break;
     }
-    list.emplace_back(std::unique_ptr<BlobFileIterator>(new BlobFileIterator(
-        std::move(file), inputs[i]->file_number(), inputs[i]->file_size(),
-        blob_gc_->titan_cf_options())));
+    list.emplace_back(std::move(iter));
   }
 
   if (s.ok()) result->reset(new BlobFileMergeIterator(std::move(list)));
@@ -495,10 +495,16 @@ Status BlobGCJob::InstallOutputBlobFiles() {
     std::vector<std::pair<std::shared_ptr<BlobFileMeta>,
                           std::unique_ptr<BlobFileHandle>>>
         files;
+    // Records are merged in key order only if every input is sorted.
+    bool sorted = true;
+    for (auto input : blob_gc_->gc_inputs()) {
+      sorted = sorted && input->sorted();
+    }
     std::string tmp;
     for (auto& builder : this->blob_file_builders_) {
       auto file = std::make_shared<BlobFileMeta>(
           builder.first->GetNumber(), builder.first->GetFile()->GetFileSize());
+      file->set_sorted(sorted);
 
       if (!tmp.empty()) {
         tmp.append(" ");
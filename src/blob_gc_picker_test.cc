@@ -21,7 +21,7 @@ class BlobGCPickerTest : public testing::Test {
   void NewBlobStorageAndPicker(const TitanDBOptions& titan_db_options,
                                const TitanCFOptions& titan_cf_options) {
     auto blob_file_cache = std::make_shared<BlobFileCache>(
-        titan_db_options, titan_cf_options, NewLRUCache(128), nullptr);
+        titan_db_options, titan_cf_options, 0, NewLRUCache(128), nullptr);
     blob_storage_.reset(new BlobStorage(titan_db_options, titan_cf_options, 0,
                                         blob_file_cache, nullptr));
     basic_blob_gc_picker_.reset(
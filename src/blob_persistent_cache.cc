@@ -0,0 +1,360 @@
+#include "blob_persistent_cache.h"
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+#include "util/string_util.h"
+
+namespace rocksdb {
+namespace titandb {
+
+namespace {
+
+const std::string kCacheFileSuffix = ".bcache";
+
+// Max size of the record header: crc, key size and value size.
+const size_t kMaxRecordHeaderSize = 4 + kMaxVarint32Length * 2;
+
+}  // namespace
+
+Status NewBlobPersistentCache(const BlobPersistentCacheOptions& options,
+                              std::shared_ptr<BlobPersistentCache>* result) {
+  return BlobPersistentCache::Open(options, result);
+}
+
+BlobPersistentCache::BlobPersistentCache(
+    const BlobPersistentCacheOptions& options)
+    : options_(options),
+      env_(options.env ? options.env : Env::Default()),
+      admission_slots_(new std::atomic<uint32_t>[kAdmissionSlots]),
+      queue_cv_(&queue_mutex_) {
+  for (size_t i = 0; i < kAdmissionSlots; i++) {
+    admission_slots_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+BlobPersistentCache::~BlobPersistentCache() {
+  {
+    MutexLock l(&queue_mutex_);
+    closing_ = true;
+    queue_cv_.SignalAll();
+  }
+  if (writer_thread_.joinable()) {
+    writer_thread_.join();
+  }
+}
+
+Status BlobPersistentCache::Open(const BlobPersistentCacheOptions& options,
+                                 std::shared_ptr<BlobPersistentCache>* result) {
+  if (options.path.empty()) {
+    return Status::InvalidArgument("blob persistent cache path is empty");
+  }
+  if (options.file_size == 0 || options.capacity < options.file_size) {
+    return Status::InvalidArgument(
+        "blob persistent cache capacity must be no less than file size");
+  }
+  std::shared_ptr<BlobPersistentCache> cache(new BlobPersistentCache(options));
+  Status s = cache->Recover();
+  if (s.ok()) {
+    auto cache_ptr = cache.get();
+    cache->writer_thread_ =
+        port::Thread([cache_ptr]() { cache_ptr->BackgroundWrite(); });
+    *result = cache;
+  }
+  return s;
+}
+
+std::string BlobPersistentCache::CacheFileName(uint64_t file_number) const {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "/%06" PRIu64, file_number);
+  return options_.path + buf + kCacheFileSuffix;
+}
+
+Status BlobPersistentCache::Recover() {
+  Status s = env_->CreateDirIfMissing(options_.path);
+  if (!s.ok()) return s;
+  std::vector<std::string> children;
+  s = env_->GetChildren(options_.path, &children);
+  if (!s.ok()) return s;
+
+  std::vector<uint64_t> file_numbers;
+  for (auto& name : children) {
+    if (name.size() <= kCacheFileSuffix.size() ||
+        name.compare(name.size() - kCacheFileSuffix.size(),
+                     kCacheFileSuffix.size(), kCacheFileSuffix) != 0) {
+      continue;
+    }
+    Slice number(name.data(), name.size() - kCacheFileSuffix.size());
+    uint64_t file_number = 0;
+    if (!ConsumeDecimalNumber(&number, &file_number) || !number.empty()) {
+      continue;
+    }
+    file_numbers.push_back(file_number);
+  }
+  std::sort(file_numbers.begin(), file_numbers.end());
+
+  {
+    MutexLock l(&mutex_);
+    for (auto file_number : file_numbers) {
+      s = RecoverFile(file_number);
+      if (!s.ok()) return s;
+      writer_file_number_ = file_number;
+    }
+  }
+  // Records are always appended to a new file, in case the tail of the
+  // last file is corrupted.
+  s = NewCacheFile();
+  if (!s.ok()) return s;
+  MutexLock l(&mutex_);
+  EvictFiles();
+  return s;
+}
+
+Status BlobPersistentCache::RecoverFile(uint64_t file_number) {
+  auto file_name = CacheFileName(file_number);
+  std::string data;
+  Status s = ReadFileToString(env_, file_name, &data);
+  if (!s.ok()) return s;
+
+  CacheFile& file = files_[file_number];
+  std::unique_ptr<RandomAccessFile> reader;
+  s = env_->NewRandomAccessFile(file_name, &reader, EnvOptions());
+  if (!s.ok()) return s;
+  file.file.reset(reader.release());
+  file.size = data.size();
+  usage_ += file.size;
+
+  // Records after a truncated or corrupted one are dropped.
+  Slice input(data);
+  while (!input.empty()) {
+    uint64_t offset = data.size() - input.size();
+    Slice record = input;
+    uint32_t crc = 0;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    if (!GetFixed32(&input, &crc) || !GetVarint32(&input, &key_size) ||
+        !GetVarint32(&input, &value_size) ||
+        input.size() < static_cast<uint64_t>(key_size) + value_size) {
+      break;
+    }
+    size_t header_size = record.size() - input.size();
+    size_t record_size = header_size + key_size + value_size;
+    if (crc32c::Unmask(crc) !=
+        crc32c::Value(record.data() + 4, record_size - 4)) {
+      break;
+    }
+    std::string key(input.data(), key_size);
+    input.remove_prefix(key_size + value_size);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      // The key is cached again after the file of its previous record was
+      // dropped. Keeps the latest one.
+      it->second = RecordHandle{file_number, offset, record_size};
+    } else {
+      index_.emplace(key, RecordHandle{file_number, offset, record_size});
+    }
+    file.keys.push_back(std::move(key));
+  }
+  return s;
+}
+
+Status BlobPersistentCache::NewCacheFile() {
+  uint64_t file_number = writer_file_number_ + 1;
+  auto file_name = CacheFileName(file_number);
+  std::unique_ptr<WritableFile> writer;
+  Status s = env_->NewWritableFile(file_name, &writer, EnvOptions());
+  if (!s.ok()) return s;
+  std::unique_ptr<RandomAccessFile> reader;
+  s = env_->NewRandomAccessFile(file_name, &reader, EnvOptions());
+  if (!s.ok()) return s;
+  if (writer_) {
+    writer_->Close();
+  }
+  writer_ = std::move(writer);
+  writer_file_size_ = 0;
+  MutexLock l(&mutex_);
+  writer_file_number_ = file_number;
+  files_[file_number].file.reset(reader.release());
+  return s;
+}
+
+void BlobPersistentCache::EvictFiles() {
+  mutex_.AssertHeld();
+  while (usage_ > options_.capacity && files_.size() > 1) {
+    auto it = files_.begin();
+    assert(it->first != writer_file_number_);
+    for (auto& key : it->second.keys) {
+      auto record = index_.find(key);
+      if (record != index_.end() && record->second.file_number == it->first) {
+        index_.erase(record);
+      }
+    }
+    usage_ -= it->second.size;
+    // Readers holding the file can still finish their reads.
+    env_->DeleteFile(CacheFileName(it->first));
+    files_.erase(it);
+  }
+}
+
+bool BlobPersistentCache::Admit(const Slice& key) {
+  if (!options_.admission_control) {
+    return true;
+  }
+  uint32_t hash = Hash(key.data(), key.size(), 0);
+  // Zero marks an empty slot.
+  hash |= 1;
+  auto& slot = admission_slots_[hash % kAdmissionSlots];
+  return slot.exchange(hash, std::memory_order_relaxed) == hash;
+}
+
+Status BlobPersistentCache::Lookup(const Slice& key, OwnedSlice* value) {
+  std::shared_ptr<RandomAccessFile> file;
+  RecordHandle handle;
+  {
+    MutexLock l(&mutex_);
+    auto it = index_.find(key.ToString());
+    if (it == index_.end()) {
+      return Status::NotFound();
+    }
+    handle = it->second;
+    file = files_[handle.file_number].file;
+  }
+
+  Slice record;
+  CacheAllocationPtr buffer(new char[handle.size]);
+  Status s = file->Read(handle.offset, handle.size, &record, buffer.get());
+  if (!s.ok()) return s;
+  Slice input = record;
+  uint32_t crc = 0;
+  uint32_t key_size = 0;
+  uint32_t value_size = 0;
+  if (record.size() != handle.size || !GetFixed32(&input, &crc) ||
+      crc32c::Unmask(crc) !=
+          crc32c::Value(record.data() + 4, record.size() - 4) ||
+      !GetVarint32(&input, &key_size) || !GetVarint32(&input, &value_size) ||
+      input.size() != static_cast<uint64_t>(key_size) + value_size ||
+      Slice(input.data(), key_size) != key) {
+    return Status::Corruption("blob persistent cache record");
+  }
+  input.remove_prefix(key_size);
+  value->reset(std::move(buffer), input);
+  return s;
+}
+
+void BlobPersistentCache::Insert(const Slice& key, const Slice& value) {
+  if (!Admit(key)) {
+    return;
+  }
+  PendingRecord pending;
+  pending.key = key.ToString();
+  auto& record = pending.record;
+  record.reserve(kMaxRecordHeaderSize + key.size() + value.size());
+  record.resize(4);
+  PutVarint32(&record, static_cast<uint32_t>(key.size()));
+  PutVarint32(&record, static_cast<uint32_t>(value.size()));
+  record.append(key.data(), key.size());
+  record.append(value.data(), value.size());
+  if (record.size() > options_.file_size) {
+    return;
+  }
+  EncodeFixed32(&record[0],
+                crc32c::Mask(crc32c::Value(&record[4], record.size() - 4)));
+
+  MutexLock l(&queue_mutex_);
+  if (closing_ ||
+      queued_size_ + record.size() > options_.max_write_buffer_size) {
+    // The cache is best effort. The record may be offered again later.
+    return;
+  }
+  queued_size_ += record.size();
+  queue_.push_back(std::move(pending));
+  queue_cv_.Signal();
+}
+
+void BlobPersistentCache::WaitForWrites() {
+  MutexLock l(&queue_mutex_);
+  while ((!queue_.empty() || writing_) && !closing_) {
+    queue_cv_.Wait();
+  }
+}
+
+void BlobPersistentCache::BackgroundWrite() {
+  MutexLock l(&queue_mutex_);
+  while (true) {
+    while (queue_.empty() && !closing_) {
+      queue_cv_.Wait();
+    }
+    if (closing_) {
+      break;
+    }
+    PendingRecord pending = std::move(queue_.front());
+    queue_.pop_front();
+    writing_ = true;
+    queue_mutex_.Unlock();
+    WriteRecord(pending);
+    queue_mutex_.Lock();
+    queued_size_ -= pending.record.size();
+    writing_ = false;
+    queue_cv_.SignalAll();
+  }
+  queue_.clear();
+  queued_size_ = 0;
+  queue_cv_.SignalAll();
+}
+
+void BlobPersistentCache::WriteRecord(const PendingRecord& pending) {
+  {
+    MutexLock l(&mutex_);
+    if (index_.count(pending.key) > 0) {
+      return;
+    }
+  }
+  const std::string& record = pending.record;
+  Status s;
+  if (writer_file_size_ + record.size() > options_.file_size) {
+    s = NewCacheFile();
+  }
+  if (s.ok()) {
+    s = writer_->Append(record);
+  }
+  if (s.ok()) {
+    s = writer_->Flush();
+  }
+  if (!s.ok()) {
+    // The cache is best effort. Records will be appended to a new file
+    // next time.
+    NewCacheFile();
+    return;
+  }
+  uint64_t offset = writer_file_size_;
+  writer_file_size_ += record.size();
+
+  // Only the index is updated under the lock, after the record is
+  // written.
+  MutexLock l(&mutex_);
+  auto& file = files_[writer_file_number_];
+  index_.emplace(pending.key,
+                 RecordHandle{writer_file_number_, offset,
+                              static_cast<uint64_t>(record.size())});
+  file.keys.push_back(pending.key);
+  file.size += record.size();
+  usage_ += record.size();
+  EvictFiles();
+}
+
+uint64_t BlobPersistentCache::GetUsage() const {
+  MutexLock l(&mutex_);
+  return usage_;
+}
+
+}  // namespace titandb
+}  // namespace rocksdb
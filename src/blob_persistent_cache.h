@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "port/port.h"
+#include "rocksdb/env.h"
+#include "titan/options.h"
+#include "util.h"
+
+namespace rocksdb {
+namespace titandb {
+
+// A persistent cache of blob records, usually placed on a fast local
+// device as the secondary tier of blob cache.
+//
+// Records are appended to cache files under the configured path. When the
+// total size of cache files exceeds the capacity, the oldest file is
+// dropped along with its records. The index of records is kept in memory
+// and rebuilt by scanning the cache files when the cache is opened again,
+// so the cached records survive restart.
+//
+// Records offered to the cache are queued and written by a background
+// thread, so that readers evicting records from blob cache don't wait
+// for the device. Records offered while the queue is full are dropped.
+//
+// Cache file record format:
+//
+// crc          : fixed32
+// key size     : varint32
+// value size   : varint32
+// key          : key size bytes
+// value        : value size bytes
+class BlobPersistentCache {
+ public:
+  // Opens the cache and recovers the records in existing cache files.
+  static Status Open(const BlobPersistentCacheOptions& options,
+                     std::shared_ptr<BlobPersistentCache>* result);
+
+  // Stops the background writer. Records not written yet are dropped.
+  ~BlobPersistentCache();
+
+  // No copying allowed
+  BlobPersistentCache(const BlobPersistentCache&) = delete;
+  void operator=(const BlobPersistentCache&) = delete;
+
+  // Looks up the record of the key. If found, fills "*value" with the
+  // record and returns OK, otherwise returns NotFound.
+  Status Lookup(const Slice& key, OwnedSlice* value);
+
+  // Offers the record of the key to the cache. The record is stored only
+  // if it passes the admission control and is not in the cache already.
+  // It is found by lookups once the background writer writes it.
+  void Insert(const Slice& key, const Slice& value);
+
+  // Waits until the records offered so far are written or dropped.
+  void WaitForWrites();
+
+  // Total size of the cache files.
+  uint64_t GetUsage() const;
+
+ private:
+  // Position of a record in the cache files.
+  struct RecordHandle {
+    uint64_t file_number;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // A record waiting for the background writer.
+  struct PendingRecord {
+    std::string key;
+    std::string record;
+  };
+
+  struct CacheFile {
+    std::shared_ptr<RandomAccessFile> file;
+    uint64_t size{0};
+    // Keys of records in the file, which are removed from the index when
+    // the file is dropped.
+    std::vector<std::string> keys;
+  };
+
+  // Size of the admission filter, see Admit().
+  static const size_t kAdmissionSlots = 1 << 16;
+
+  explicit BlobPersistentCache(const BlobPersistentCacheOptions& options);
+
+  std::string CacheFileName(uint64_t file_number) const;
+
+  Status Recover();
+  Status RecoverFile(uint64_t file_number);
+
+  // Opens a new cache file for the writer.
+  // REQUIRES: called by the background writer, or before it starts
+  Status NewCacheFile();
+
+  // Writes queued records until the cache is destroyed.
+  void BackgroundWrite();
+
+  // Appends the record to the current cache file and publishes it to the
+  // index.
+  // REQUIRES: called by the background writer
+  void WriteRecord(const PendingRecord& pending);
+
+  // Drops the oldest cache files until the usage is within capacity.
+  // REQUIRES: mutex_ held
+  void EvictFiles();
+
+  // Returns true if the record of the key is admitted. A record is
+  // admitted when it is offered the second time recently, so that records
+  // read only once don't wear out the device.
+  bool Admit(const Slice& key);
+
+  const BlobPersistentCacheOptions options_;
+  Env* env_;
+
+  // Guards the index and the files, held only briefly by the background
+  // writer to publish records.
+  mutable port::Mutex mutex_;
+  std::unordered_map<std::string, RecordHandle> index_;
+  std::map<uint64_t, CacheFile> files_;
+  uint64_t writer_file_number_{0};
+  uint64_t usage_{0};
+
+  // Owned by the background writer.
+  std::unique_ptr<WritableFile> writer_;
+  uint64_t writer_file_size_{0};
+
+  port::Mutex queue_mutex_;
+  port::CondVar queue_cv_;
+  // The following fields are guarded by queue_mutex_.
+  std::deque<PendingRecord> queue_;
+  uint64_t queued_size_{0};
+  bool writing_{false};
+  bool closing_{false};
+  port::Thread writer_thread_;
+
+  std::unique_ptr<std::atomic<uint32_t>[]> admission_slots_;
+};
+
+}  // namespace titandb
+}  // namespace rocksdb
@@ -0,0 +1,141 @@
+#include "blob_persistent_cache.h"
+
+#include <algorithm>
+
+#include "util/filename.h"
+#include "util/testharness.h"
+
+namespace rocksdb {
+namespace titandb {
+
+class BlobPersistentCacheTest : public testing::Test {
+ public:
+  BlobPersistentCacheTest() : dirname_(test::TmpDir(env_)) {
+    options_.path = dirname_ + "/blob_persistent_cache";
+    options_.capacity = 4 << 10;
+    options_.file_size = 1 << 10;
+    options_.admission_control = false;
+    DestroyDir();
+  }
+
+  ~BlobPersistentCacheTest() { DestroyDir(); }
+
+  void DestroyDir() {
+    std::vector<std::string> filenames;
+    env_->GetChildren(options_.path, &filenames);
+    for (auto& fname : filenames) {
+      if (fname != "." && fname != "..") {
+        env_->DeleteFile(options_.path + "/" + fname);
+      }
+    }
+    env_->DeleteDir(options_.path);
+  }
+
+  void Open() {
+    cache_.reset();
+    ASSERT_OK(NewBlobPersistentCache(options_, &cache_));
+  }
+
+  // Records are written by the background writer, so the checks wait for
+  // the records offered before them.
+  void AssertHit(const std::string& key, const std::string& value) {
+    cache_->WaitForWrites();
+    OwnedSlice result;
+    ASSERT_OK(cache_->Lookup(key, &result));
+    ASSERT_EQ(value, result.ToString());
+  }
+
+  void AssertMiss(const std::string& key) {
+    cache_->WaitForWrites();
+    OwnedSlice result;
+    ASSERT_TRUE(cache_->Lookup(key, &result).IsNotFound());
+  }
+
+  Env* env_{Env::Default()};
+  std::string dirname_;
+  BlobPersistentCacheOptions options_;
+  std::shared_ptr<BlobPersistentCache> cache_;
+};
+
+TEST_F(BlobPersistentCacheTest, Basic) {
+  Open();
+  AssertMiss("k1");
+  cache_->Insert("k1", "v1");
+  cache_->Insert("k2", std::string(100, 'v'));
+  AssertHit("k1", "v1");
+  AssertHit("k2", std::string(100, 'v'));
+  AssertMiss("k3");
+
+  // Records larger than the file size are not cached.
+  cache_->Insert("k3", std::string(options_.file_size, 'v'));
+  AssertMiss("k3");
+}
+
+TEST_F(BlobPersistentCacheTest, AdmissionControl) {
+  options_.admission_control = true;
+  Open();
+  cache_->Insert("k1", "v1");
+  AssertMiss("k1");
+  cache_->Insert("k1", "v1");
+  AssertHit("k1", "v1");
+}
+
+TEST_F(BlobPersistentCacheTest, WriteBufferFull) {
+  options_.max_write_buffer_size = 64;
+  Open();
+  // Records are dropped if they don't fit in the write buffer.
+  cache_->Insert("k1", std::string(100, 'v'));
+  cache_->Insert("k2", "v2");
+  AssertMiss("k1");
+  AssertHit("k2", "v2");
+}
+
+TEST_F(BlobPersistentCacheTest, Eviction) {
+  Open();
+  std::string value(200, 'v');
+  for (int i = 0; i < 100; i++) {
+    cache_->Insert(ToString(i), value);
+    cache_->WaitForWrites();
+    ASSERT_LE(cache_->GetUsage(), options_.capacity);
+  }
+  // The oldest records are dropped along with their files.
+  AssertMiss("0");
+  AssertHit("99", value);
+}
+
+TEST_F(BlobPersistentCacheTest, Recover) {
+  Open();
+  cache_->Insert("k1", "v1");
+  cache_->Insert("k2", "v2");
+  cache_->WaitForWrites();
+  auto usage = cache_->GetUsage();
+  Open();
+  ASSERT_EQ(usage, cache_->GetUsage());
+  AssertHit("k1", "v1");
+  AssertHit("k2", "v2");
+
+  // Records following a corrupted one are dropped on recovery.
+  cache_->Insert("k3", "v3");
+  cache_->WaitForWrites();
+  cache_.reset();
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(options_.path, &filenames));
+  std::sort(filenames.begin(), filenames.end());
+  auto fname = options_.path + "/" + filenames.back();
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, fname, &data));
+  data[data.size() - 1]++;
+  ASSERT_OK(WriteStringToFile(env_, data, fname));
+  Open();
+  AssertHit("k1", "v1");
+  AssertHit("k2", "v2");
+  AssertMiss("k3");
+}
+
+}  // namespace titandb
+}  // namespace rocksdb
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
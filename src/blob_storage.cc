@@ -7,7 +7,7 @@ namespace titandb {
 
 Status BlobStorage::Get(const ReadOptions& options, const BlobIndex& index,
                         BlobRecord* record, PinnableSlice* buffer) {
-  auto sfile = FindFile(index.file_number).lock();
+  auto sfile = FindFileLockFree(index.file_number).lock();
   if (!sfile)
     return Status::Corruption("Missing blob file: " +
                               std::to_string(index.file_number));
@@ -15,9 +15,33 @@ Status BlobStorage::Get(const ReadOptions& options, const BlobIndex& index,
                           index.blob_handle, record, buffer);
 }
 
+void BlobStorage::MultiGet(const ReadOptions& options, uint64_t file_number,
+                           std::vector<BlobReadRequest>* requests) {
+  auto sfile = FindFileLockFree(file_number).lock();
+  if (!sfile) {
+    Status s = Status::Corruption("Missing blob file: " +
+                                  std::to_string(file_number));
+    for (auto& request : *requests) {
+      *request.status = s;
+    }
+    return;
+  }
+  file_cache_->MultiGet(options, sfile->file_number(), sfile->file_size(),
+                        requests);
+}
+
+std::shared_ptr<BlobFileMeta> BlobStorage::PinFile(
+    uint64_t file_number) const {
+  auto file = FindFileLockFree(file_number).lock();
+  if (file && file->Pin()) {
+    return file;
+  }
+  return nullptr;
+}
+
 Status BlobStorage::NewPrefetcher(uint64_t file_number,
                                   std::unique_ptr<BlobFilePrefetcher>* result) {
-  auto sfile = FindFile(file_number).lock();
+  auto sfile = FindFileLockFree(file_number).lock();
   if (!sfile)
     return Status::Corruption("Missing blob wfile: " +
                               std::to_string(file_number));
@@ -35,6 +59,55 @@ std::weak_ptr<BlobFileMeta> BlobStorage::FindFile(uint64_t file_number) const {
   return std::weak_ptr<BlobFileMeta>();
 }
 
+std::weak_ptr<BlobFileMeta> BlobStorage::FindFileLockFree(
+    uint64_t file_number) const {
+  PublishedPtr<FileMap>::ReadScope files(&published_files_);
+  auto it = files->find(file_number);
+  if (it != files->end()) {
+    assert(file_number == it->second->file_number());
+    return it->second;
+  }
+  return std::weak_ptr<BlobFileMeta>();
+}
+
+void BlobStorage::AddActiveFile(std::shared_ptr<BlobFileMeta> file) {
+  MutexLock l(&mutex_);
+  active_files_.emplace(file->file_number(), file);
+  PublishFiles();
+}
+
+void BlobStorage::RemoveActiveFile(uint64_t file_number) {
+  MutexLock l(&mutex_);
+  if (active_files_.erase(file_number) > 0) {
+    PublishFiles();
+    // The cached reader of the log doesn't read the footer or use mmap.
+    file_cache_->Evict(file_number);
+  }
+}
+
+bool BlobStorage::AddActiveFileDiscardableSize(uint64_t file_number,
+                                               uint64_t size) {
+  MutexLock l(&mutex_);
+  if (active_files_.count(file_number) == 0) {
+    return false;
+  }
+  active_discardable_sizes_[file_number] += size;
+  return true;
+}
+
+void BlobStorage::ApplyActiveFileDiscardableSize(uint64_t file_number) {
+  MutexLock l(&mutex_);
+  auto it = active_discardable_sizes_.find(file_number);
+  if (it == active_discardable_sizes_.end()) {
+    return;
+  }
+  auto file = files_.find(file_number);
+  if (file != files_.end()) {
+    file->second->AddDiscardableSize(it->second);
+  }
+  active_discardable_sizes_.erase(it);
+}
+
 void BlobStorage::ExportBlobFiles(
     std::map<uint64_t, std::weak_ptr<BlobFileMeta>>& ret) const {
   MutexLock l(&mutex_);
@@ -46,6 +119,7 @@ void BlobStorage::ExportBlobFiles(
 void BlobStorage::AddBlobFile(std::shared_ptr<BlobFileMeta>& file) {
   MutexLock l(&mutex_);
   files_.emplace(std::make_pair(file->file_number(), file));
+  PublishFiles();
   std::unique_ptr<PosixRandomRWFile> random_rw_file_;
   if (file->file_size() > 0) {
     Status s = OpenBlobFile(file->file_number(), 0, db_options_, EnvOptions(),
@@ -95,9 +169,14 @@ void BlobStorage::GetObsoleteFiles(std::vector<std::string>* obsolete_files,
     // by the time the blob file become obsolete. If so, the blob file is not
     // visible to all existing snapshots.
     if (oldest_sequence > obsolete_sequence) {
-      // remove obsolete files
       auto p = files_.find(file_number);
       assert(p != files_.end());
+      // Reads without snapshot pin the files they are accessing instead.
+      if (!p->second->TryMarkPurged()) {
+        ++it;
+        continue;
+      }
+      // remove obsolete files
       file_dropped++;
       file_dropped_size += p->second->file_size();
       files_.erase(p);
@@ -119,6 +198,11 @@ void BlobStorage::GetObsoleteFiles(std::vector<std::string>* obsolete_files,
     }
     ++it;
   }
+  if (file_dropped > 0) {
+    PublishFiles();
+  } else {
+    published_files_.Reclaim();
+  }
   SubStats(stats_, cf_id_, TitanInternalStats::OBSOLETE_BLOB_FILE_SIZE,
            file_dropped_size);
   SubStats(stats_, cf_id_, TitanInternalStats::NUM_OBSOLETE_BLOB_FILE,
@@ -18,11 +18,14 @@ class BlobStorage {
  public:
   BlobStorage(const BlobStorage& bs) : destroyed_(false) {
     this->files_ = bs.files_;
+    this->active_files_ = bs.active_files_;
+    this->active_discardable_sizes_ = bs.active_discardable_sizes_;
     this->file_cache_ = bs.file_cache_;
     this->db_options_ = bs.db_options_;
     this->cf_options_ = bs.cf_options_;
     this->cf_id_ = bs.cf_id_;
     this->stats_ = bs.stats_;
+    PublishFiles();
   }
 
   BlobStorage(const TitanDBOptions& _db_options,
@@ -39,6 +42,9 @@ class BlobStorage {
     for (auto& file : files_) {
       file_cache_->Evict(file.second->file_number());
     }
+    for (auto& file : active_files_) {
+      file_cache_->Evict(file.second->file_number());
+    }
   }
 
   // Gets the blob record pointed by the blob index. The provided
@@ -47,6 +53,16 @@ class BlobStorage {
   Status Get(const ReadOptions& options, const BlobIndex& index,
              BlobRecord* record, PinnableSlice* buffer);
 
+  // Pins the blob file so that it will not be purged by
+  // GetObsoleteFiles() until the file is unpinned. Returns nullptr if the
+  // file doesn't exist or has been purged.
+  std::shared_ptr<BlobFileMeta> PinFile(uint64_t file_number) const;
+
+  // Gets the blob records of a batch of requests in the specified file
+  // number. The status of each request is stored in its status field.
+  void MultiGet(const ReadOptions& options, uint64_t file_number,
+                std::vector<BlobReadRequest>* requests);
+
   // Creates a prefetcher for the specified file number.
   Status NewPrefetcher(uint64_t file_number,
                        std::unique_ptr<BlobFilePrefetcher>* result);
@@ -55,6 +71,29 @@ class BlobStorage {
   // corruption if the file doesn't exist.
   std::weak_ptr<BlobFileMeta> FindFile(uint64_t file_number) const;
 
+  // Same as FindFile(), but looks up the published view of the files
+  // without holding mutex. It is used on the read path. Value logs being
+  // written are found as files of size 0.
+  std::weak_ptr<BlobFileMeta> FindFileLockFree(uint64_t file_number) const;
+
+  // Adds a value log being written to the published view of the files,
+  // so that its records can be read before it is sealed. It is not seen
+  // by FindFile(), flush, compaction or GC.
+  void AddActiveFile(std::shared_ptr<BlobFileMeta> file);
+
+  // Removes the value log from the published view once it is sealed and
+  // added as a normal blob file.
+  void RemoveActiveFile(uint64_t file_number);
+
+  // Keeps the discardable size that compaction found in a value log being
+  // written, which is added to the blob file once the log is sealed.
+  // Returns false if the file is not a value log being written.
+  bool AddActiveFileDiscardableSize(uint64_t file_number, uint64_t size);
+
+  // Adds the discardable size kept for the value log to its sealed blob
+  // file, which must have been added.
+  void ApplyActiveFileDiscardableSize(uint64_t file_number);
+
   std::size_t NumBlobFiles() const {
     MutexLock l(&mutex_);
     return files_.size();
@@ -109,6 +148,8 @@ class BlobStorage {
 
   const TitanCFOptions& cf_options() { return cf_options_; }
 
+  uint32_t cf_id() const { return cf_id_; }
+
   void AddBlobFile(std::shared_ptr<BlobFileMeta>& file);
 
   void GetObsoleteFiles(std::vector<std::string>* obsolete_files,
@@ -124,6 +165,19 @@ class BlobStorage {
   friend class BlobGCJobTest;
   friend class BlobFileSizeCollectorTest;
 
+  using FileMap = std::unordered_map<uint64_t, std::shared_ptr<BlobFileMeta>>;
+
+  // Publishes a copy of files_ for lock-free readers, along with
+  // active_files_ which take precedence.
+  // REQUIRES: mutex_ held
+  void PublishFiles() {
+    auto files = new FileMap(files_);
+    for (auto& file : active_files_) {
+      (*files)[file.first] = file.second;
+    }
+    published_files_.Publish(files);
+  }
+
   TitanDBOptions db_options_;
   TitanCFOptions cf_options_;
   uint32_t cf_id_;
@@ -131,7 +185,14 @@ class BlobStorage {
   mutable port::Mutex mutex_;
 
   // Only BlobStorage OWNS BlobFileMeta
-  std::unordered_map<uint64_t, std::shared_ptr<BlobFileMeta>> files_;
+  FileMap files_;
+  // Value logs being written, see AddActiveFile().
+  FileMap active_files_;
+  // Discardable sizes of value logs being written, see
+  // AddActiveFileDiscardableSize().
+  std::unordered_map<uint64_t, uint64_t> active_discardable_sizes_;
+  // Copy-on-write view of files_, updated whenever files_ changes.
+  PublishedPtr<FileMap> published_files_;
   std::shared_ptr<BlobFileCache> file_cache_;
 
   std::vector<GCScore> gc_score_;
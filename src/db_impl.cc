@@ -6,6 +6,9 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "port/port.h"
 
 #include "base_db_listener.h"
@@ -13,6 +16,7 @@
 #include "blob_file_iterator.h"
 #include "blob_file_size_collector.h"
 #include "blob_gc.h"
+#include "db/write_batch_internal.h"
 #include "db_iter.h"
 #include "table_factory.h"
 #include "titan_build_version.h"
@@ -28,13 +32,19 @@ class TitanDBImpl::FileManager : public BlobFileManager {
     auto number = db_->vset_->NewFileNumber();
     auto name = BlobFileName(db_->dirname_, number);
 
+    // Blob files are written by flush, compaction and GC, so they follow
+    // the direct I/O setting of flush and compaction outputs.
+    EnvOptions env_options(db_->env_options_);
+    env_options.use_direct_writes =
+        db_->db_options_.use_direct_io_for_flush_and_compaction;
+
     Status s;
     std::unique_ptr<WritableFileWriter> file;
     {
       std::unique_ptr<WritableFile> f;
-      s = db_->env_->NewWritableFile(name, &f, db_->env_options_);
+      s = db_->env_->NewWritableFile(name, &f, env_options);
       if (!s.ok()) return s;
-      file.reset(new WritableFileWriter(std::move(f), name, db_->env_options_));
+      file.reset(new WritableFileWriter(std::move(f), name, env_options));
     }
 
     handle->reset(new FileHandle(number, name, std::move(file)));
@@ -120,6 +130,98 @@ class TitanDBImpl::FileManager : public BlobFileManager {
   TitanDBImpl* db_;
 };
 
+// Rewrites a write batch, appending large values to value logs and putting
+// their blob indexes instead. Other operations are copied as they are.
+class TitanDBImpl::BlobSeparator : public WriteBatch::Handler {
+ public:
+  BlobSeparator(const ValueLogMap* value_logs, WriteBatch* result)
+      : value_logs_(value_logs), result_(result) {}
+
+  Status PutCF(uint32_t cf_id, const Slice& key, const Slice& value) override {
+    auto it = value_logs_->find(cf_id);
+    if (it == value_logs_->end() || !it->second->ShouldSeparate(value)) {
+      return WriteBatchInternal::Put(result_, cf_id, key, value);
+    }
+    BlobIndex index;
+    Status s = it->second->Add(key, value, &index);
+    if (!s.ok()) return s;
+    auto& records = appended_[{it->second.get(), index.file_number}];
+    records.count++;
+    records.last_entry = WriteBatchInternal::Count(result_);
+    index_value_.clear();
+    index.EncodeTo(&index_value_);
+    return WriteBatchInternal::PutBlobIndex(result_, cf_id, key, index_value_);
+  }
+
+  Status DeleteCF(uint32_t cf_id, const Slice& key) override {
+    return WriteBatchInternal::Delete(result_, cf_id, key);
+  }
+
+  Status SingleDeleteCF(uint32_t cf_id, const Slice& key) override {
+    return WriteBatchInternal::SingleDelete(result_, cf_id, key);
+  }
+
+  Status DeleteRangeCF(uint32_t cf_id, const Slice& begin_key,
+                       const Slice& end_key) override {
+    return WriteBatchInternal::DeleteRange(result_, cf_id, begin_key, end_key);
+  }
+
+  Status MergeCF(uint32_t cf_id, const Slice& key,
+                 const Slice& value) override {
+    return WriteBatchInternal::Merge(result_, cf_id, key, value);
+  }
+
+  Status PutBlobIndexCF(uint32_t cf_id, const Slice& key,
+                        const Slice& value) override {
+    return WriteBatchInternal::PutBlobIndex(result_, cf_id, key, value);
+  }
+
+  void LogData(const Slice& blob) override { result_->PutLogData(blob); }
+
+  // Makes the appended values readable, and durable if "sync" is true.
+  Status Flush(bool sync) {
+    Status s;
+    ValueLog* flushed = nullptr;
+    for (auto& records : appended_) {
+      // Records of a log are ordered by file, so flushes of a log are
+      // adjacent.
+      if (records.first.first == flushed) continue;
+      flushed = records.first.first;
+      s = flushed->Flush(sync);
+      if (!s.ok()) break;
+    }
+    return s;
+  }
+
+  // Releases the appended values once "*result" is written with the
+  // status "s", see ValueLog::Release().
+  void Release(const Status& s) {
+    SequenceNumber sequence =
+        s.ok() ? WriteBatchInternal::Sequence(result_) : 0;
+    for (auto& records : appended_) {
+      records.first.first->Release(
+          records.first.second, records.second.count,
+          s.ok() ? sequence + records.second.last_entry : 0);
+    }
+    appended_.clear();
+  }
+
+  bool separated() const { return !appended_.empty(); }
+
+ private:
+  struct AppendedRecords {
+    uint64_t count{0};
+    // Index of the last blob index in the result.
+    uint64_t last_entry{0};
+  };
+
+  const ValueLogMap* value_logs_;
+  WriteBatch* result_;
+  // Records appended to each file of each log.
+  std::map<std::pair<ValueLog*, uint64_t>, AppendedRecords> appended_;
+  std::string index_value_;
+};
+
 TitanDBImpl::TitanDBImpl(const TitanDBOptions& options,
                          const std::string& dbname)
     : bg_cv_(&mutex_),
@@ -134,6 +236,13 @@ TitanDBImpl::TitanDBImpl(const TitanDBOptions& options,
   if (db_options_.statistics != nullptr) {
     stats_.reset(new TitanStats(db_options_.statistics.get()));
   }
+  if (db_options_.blob_write_threads > 0) {
+    blob_write_pool_.reset(NewThreadPool(db_options_.blob_write_threads));
+  }
+  if (db_options_.blob_compression_threads > 0) {
+    blob_compression_pool_.reset(
+        NewThreadPool(db_options_.blob_compression_threads));
+  }
   blob_manager_.reset(new FileManager(this));
 }
 
@@ -211,7 +320,7 @@ Status TitanDBImpl::Open(const std::vector<TitanCFDescriptor>& descs,
       base_table_factory_[cf_id] = base_table_factory;
       titan_table_factory_[cf_id] = std::make_shared<TitanTableFactory>(
           db_options_, descs[i].options, blob_manager_, &mutex_, vset_.get(),
-          stats_.get());
+          stats_.get(), blob_write_pool_.get(), blob_compression_pool_.get());
       base_descs[i].options.table_factory = titan_table_factory_[cf_id];
       // Add TableProperties for collecting statistics GC
       base_descs[i].options.table_properties_collector_factories.emplace_back(
@@ -226,6 +335,15 @@ Status TitanDBImpl::Open(const std::vector<TitanCFDescriptor>& descs,
   s = vset_->Open(column_families);
   if (!s.ok()) return s;
 
+  // Value logs must be recovered before the WAL, which may have blob
+  // indexes pointing to them.
+  s = ValueLog::Recover(db_options_, column_families, vset_.get(), &mutex_);
+  if (!s.ok()) return s;
+  {
+    MutexLock l(&mutex_);
+    AddValueLogs(column_families);
+  }
+
   static bool has_init_background_threads = false;
   if (!has_init_background_threads) {
     auto bottom_pri_threads_num =
@@ -272,6 +390,14 @@ Status TitanDBImpl::Close() {
     db_ = nullptr;
     db_impl_ = nullptr;
   }
+  // Table builders of the base DB wait for their blob records, so no job
+  // is left at this point.
+  if (blob_write_pool_ != nullptr) {
+    blob_write_pool_->JoinAllThreads();
+  }
+  if (blob_compression_pool_ != nullptr) {
+    blob_compression_pool_->JoinAllThreads();
+  }
   if (lock_) {
     env_->UnlockFile(lock_);
     lock_ = nullptr;
@@ -308,7 +434,79 @@ Status TitanDBImpl::CloseImpl() {
     mutex_.Unlock();
   }
 
-  return Status::OK();
+  // Finishes pending async reads, which still need the blob storages.
+  if (async_read_pool_ != nullptr) {
+    async_read_pool_->WaitForJobsAndJoinAllThreads();
+  }
+
+  // Seals value logs, so that they are not left to recovery.
+  std::vector<uint32_t> column_families;
+  {
+    MutexLock l(&mutex_);
+    for (auto& value_log : value_logs_) {
+      column_families.push_back(value_log.first);
+    }
+  }
+  return CloseValueLogs(column_families);
+}
+
+std::shared_ptr<ValueLog> TitanDBImpl::GetValueLog(uint32_t cf_id) const {
+  PublishedPtr<ValueLogMap>::ReadScope value_logs(&published_value_logs_);
+  auto it = value_logs->find(cf_id);
+  if (it != value_logs->end()) {
+    return it->second;
+  }
+  return nullptr;
+}
+
+void TitanDBImpl::AddValueLogs(
+    const std::map<uint32_t, TitanCFOptions>& column_families) {
+  mutex_.AssertHeld();
+  bool added = false;
+  for (auto& cf : column_families) {
+    if (cf.second.separate_blob_on_write) {
+      value_logs_[cf.first] = std::make_shared<ValueLog>(
+          db_options_, cf.second, cf.first, vset_.get(), &mutex_,
+          stats_.get());
+      added = true;
+    }
+  }
+  if (added) {
+    published_value_logs_.Publish(new ValueLogMap(value_logs_));
+  }
+}
+
+Status TitanDBImpl::CloseValueLogs(
+    const std::vector<uint32_t>& column_families) {
+  std::vector<std::shared_ptr<ValueLog>> value_logs;
+  {
+    MutexLock l(&mutex_);
+    for (auto cf_id : column_families) {
+      auto it = value_logs_.find(cf_id);
+      if (it != value_logs_.end()) {
+        value_logs.push_back(it->second);
+        value_logs_.erase(it);
+      }
+    }
+    if (value_logs.empty()) {
+      return Status::OK();
+    }
+    published_value_logs_.Publish(new ValueLogMap(value_logs_));
+  }
+  Status s;
+  for (auto& value_log : value_logs) {
+    Status close_status = value_log->Close();
+    if (s.ok()) {
+      s = close_status;
+    }
+  }
+  return s;
+}
+
+void TitanDBImpl::TEST_AbandonValueLogs() {
+  MutexLock l(&mutex_);
+  value_logs_.clear();
+  published_value_logs_.Publish(new ValueLogMap(value_logs_));
 }
 
 Status TitanDBImpl::CreateColumnFamilies(
@@ -323,7 +521,7 @@ Status TitanDBImpl::CreateColumnFamilies(
     base_table_factory.emplace_back(options.table_factory);
     titan_table_factory.emplace_back(std::make_shared<TitanTableFactory>(
         db_options_, desc.options, blob_manager_, &mutex_, vset_.get(),
-        stats_.get()));
+        stats_.get(), blob_write_pool_.get(), blob_compression_pool_.get()));
     options.table_factory = titan_table_factory.back();
     base_descs.emplace_back(desc.name, options);
   }
@@ -346,6 +544,7 @@ Status TitanDBImpl::CreateColumnFamilies(
         titan_table_factory_[cf_id] = titan_table_factory[i];
       }
       vset_->AddColumnFamilies(column_families);
+      AddValueLogs(column_families);
     }
   }
   if (s.ok()) {
@@ -375,6 +574,10 @@ Status TitanDBImpl::DropColumnFamilies(
     column_families_str += "[" + handle->GetName() + "]";
   }
   Status s = db_impl_->DropColumnFamilies(handles);
+  if (s.ok()) {
+    // Sealed value logs become obsolete along with other blob files.
+    s = CloseValueLogs(column_families);
+  }
   if (s.ok()) {
     MutexLock l(&mutex_);
     for (auto cf_id : column_families) {
@@ -445,13 +648,55 @@ Status TitanDBImpl::Put(const rocksdb::WriteOptions& options,
                         rocksdb::ColumnFamilyHandle* column_family,
                         const rocksdb::Slice& key,
                         const rocksdb::Slice& value) {
-  return HasBGError() ? GetBGError()
-                      : db_->Put(options, column_family, key, value);
+  if (HasBGError()) return GetBGError();
+  auto value_log = GetValueLog(column_family->GetID());
+  if (!value_log || !value_log->ShouldSeparate(value)) {
+    return db_->Put(options, column_family, key, value);
+  }
+  BlobIndex index;
+  Status s = value_log->Add(key, value, &index);
+  if (!s.ok()) return s;
+  s = value_log->Flush(options.sync);
+  WriteBatch batch;
+  if (s.ok()) {
+    std::string index_value;
+    index.EncodeTo(&index_value);
+    s = WriteBatchInternal::PutBlobIndex(&batch, column_family->GetID(), key,
+                                         index_value);
+  }
+  if (s.ok()) {
+    s = db_->Write(options, &batch);
+  }
+  value_log->Release(index.file_number, 1,
+                     s.ok() ? WriteBatchInternal::Sequence(&batch) : 0);
+  return s;
 }
 
 Status TitanDBImpl::Write(const rocksdb::WriteOptions& options,
                           rocksdb::WriteBatch* updates) {
-  return HasBGError() ? GetBGError() : db_->Write(options, updates);
+  if (HasBGError()) return GetBGError();
+  ValueLogMap value_logs;
+  {
+    // The logs are copied out, so that no read scope is held across the
+    // appends and syncs below.
+    PublishedPtr<ValueLogMap>::ReadScope published(&published_value_logs_);
+    if (published->empty()) {
+      return db_->Write(options, updates);
+    }
+    value_logs = *published;
+  }
+  WriteBatch separated_updates;
+  BlobSeparator separator(&value_logs, &separated_updates);
+  Status s = updates->Iterate(&separator);
+  if (s.ok()) {
+    s = separator.Flush(options.sync);
+  }
+  if (s.ok()) {
+    s = db_->Write(options,
+                   separator.separated() ? &separated_updates : updates);
+  }
+  separator.Release(s);
+  return s;
 }
 
 Status TitanDBImpl::Delete(const rocksdb::WriteOptions& options,
@@ -487,6 +732,16 @@ Status TitanDBImpl::Get(const ReadOptions& options, ColumnFamilyHandle* handle,
   if (options.snapshot) {
     return GetImpl(options, handle, key, value);
   }
+  // Instead of acquiring a snapshot, which touches the snapshot list of the
+  // base DB under its mutex, pin the blob file being read. If the file is
+  // purged between reading the blob index and pinning it, the index must
+  // have been rewritten by GC, so just read the index again.
+  for (int retry = 0; retry < kMaxGetWithoutSnapshotRetries; retry++) {
+    Status s = GetImpl(options, handle, key, value);
+    if (!s.IsTryAgain()) {
+      return s;
+    }
+  }
   ReadOptions ro(options);
   ManagedSnapshot snapshot(this);
   ro.snapshot = snapshot.snapshot();
@@ -509,13 +764,28 @@ Status TitanDBImpl::GetImpl(const ReadOptions& options,
   assert(s.ok());
   if (!s.ok()) return s;
 
-  BlobRecord record;
-  PinnableSlice buffer;
+  auto storage = vset_->GetBlobStorageLockFree(handle->GetID()).lock();
 
-  mutex_.Lock();
-  auto storage = vset_->GetBlobStorage(handle->GetID()).lock();
-  mutex_.Unlock();
+  std::shared_ptr<BlobFileMeta> pinned_file;
+  if (!options.snapshot) {
+    pinned_file = storage->PinFile(index.file_number);
+    if (!pinned_file) {
+      return Status::TryAgain("Blob file purged: " +
+                              std::to_string(index.file_number));
+    }
+  }
 
+  return GetBlobValue(options, key, storage.get(), index,
+                      std::move(pinned_file), value);
+}
+
+Status TitanDBImpl::GetBlobValue(const ReadOptions& options, const Slice& key,
+                                 BlobStorage* storage, const BlobIndex& index,
+                                 std::shared_ptr<BlobFileMeta> pinned_file,
+                                 PinnableSlice* value) {
+  Status s;
+  BlobRecord record;
+  PinnableSlice buffer;
   {
     StopWatch read_sw(env_, statistics(stats_.get()),
                       BLOB_DB_BLOB_FILE_READ_MICROS);
@@ -524,55 +794,208 @@ Status TitanDBImpl::GetImpl(const ReadOptions& options,
     RecordTick(statistics(stats_.get()), BLOB_DB_BLOB_FILE_BYTES_READ,
                index.blob_handle.size);
   }
+  if (pinned_file) {
+    pinned_file->Unpin();
+  }
   if (s.IsCorruption()) {
     ROCKS_LOG_ERROR(db_options_.info_log,
                     "Key:%s Snapshot:%" PRIu64 " GetBlobFile err:%s\n",
                     key.ToString(true).c_str(),
-                    options.snapshot->GetSequenceNumber(),
+                    options.snapshot ? options.snapshot->GetSequenceNumber()
+                                     : db_impl_->GetLatestSequenceNumber(),
                     s.ToString().c_str());
   }
   if (s.ok()) {
+    // Hand the cache handle or read buffer over to the caller, so that the
+    // value is not copied.
     value->Reset();
-    value->PinSelf(record.value);
+    value->PinSlice(record.value, &buffer);
   }
   return s;
 }
 
-std::vector<Status> TitanDBImpl::MultiGet(
-    const ReadOptions& options, const std::vector<ColumnFamilyHandle*>& handles,
-    const std::vector<Slice>& keys, std::vector<std::string>* values) {
-  auto options_copy = options;
-  options_copy.total_order_seek = true;
-  if (options_copy.snapshot) {
-    return MultiGetImpl(options_copy, handles, keys, values);
+void TitanDBImpl::AsyncGet(const ReadOptions& options,
+                           ColumnFamilyHandle* handle, const Slice& key,
+                           PinnableSlice* value, AsyncGetCallback callback) {
+  bool is_blob_index = false;
+  Status s = db_impl_->GetImpl(options, handle, key, value,
+                               nullptr /*value_found*/,
+                               nullptr /*read_callback*/, &is_blob_index);
+  if (!s.ok() || !is_blob_index) {
+    callback(s);
+    return;
   }
-  ReadOptions ro(options_copy);
-  ManagedSnapshot snapshot(this);
-  ro.snapshot = snapshot.snapshot();
-  return MultiGetImpl(ro, handles, keys, values);
+
+  BlobIndex index;
+  s = index.DecodeFrom(value);
+  assert(s.ok());
+  if (!s.ok()) {
+    callback(s);
+    return;
+  }
+
+  auto storage = vset_->GetBlobStorageLockFree(handle->GetID()).lock();
+  std::shared_ptr<BlobFileMeta> pinned_file;
+  if (!options.snapshot) {
+    pinned_file = storage->PinFile(index.file_number);
+    if (!pinned_file) {
+      // The index has been rewritten by GC, leaves the retries to Get().
+      std::string key_copy = key.ToString();
+      ScheduleAsyncRead([this, options, handle, key_copy, value, callback]() {
+        callback(Get(options, handle, key_copy, value));
+      });
+      return;
+    }
+  }
+
+  std::string key_copy = key.ToString();
+  ScheduleAsyncRead([this, options, key_copy, storage, index, pinned_file,
+                     value, callback]() {
+    StopWatch get_sw(env_, statistics(stats_.get()), BLOB_DB_GET_MICROS);
+    callback(GetBlobValue(options, key_copy, storage.get(), index,
+                          pinned_file, value));
+  });
+}
+
+void TitanDBImpl::ScheduleAsyncRead(std::function<void()>&& job) {
+  if (db_options_.async_read_threads <= 0) {
+    job();
+    return;
+  }
+  std::call_once(async_read_pool_once_, [this]() {
+    async_read_pool_.reset(NewThreadPool(db_options_.async_read_threads));
+  });
+  async_read_pool_->SubmitJob(std::move(job));
 }
 
-std::vector<Status> TitanDBImpl::MultiGetImpl(
+std::vector<Status> TitanDBImpl::MultiGet(
     const ReadOptions& options, const std::vector<ColumnFamilyHandle*>& handles,
     const std::vector<Slice>& keys, std::vector<std::string>* values) {
-  std::vector<Status> res;
-  res.resize(keys.size());
+  std::vector<ColumnFamilyHandle*> column_families(handles);
+  std::vector<Status> res(keys.size());
+  std::unique_ptr<PinnableSlice[]> pinnable_values(
+      new PinnableSlice[keys.size()]);
+  MultiGet(options, keys.size(), column_families.data(), keys.data(),
+           pinnable_values.get(), res.data());
   values->resize(keys.size());
   for (size_t i = 0; i < keys.size(); i++) {
-    auto value = &(*values)[i];
-    PinnableSlice pinnable_value(value);
-    res[i] = GetImpl(options, handles[i], keys[i], &pinnable_value);
-    if (res[i].ok() && pinnable_value.IsPinned()) {
-      value->assign(pinnable_value.data(), pinnable_value.size());
+    if (res[i].ok()) {
+      (*values)[i].assign(pinnable_values[i].data(), pinnable_values[i].size());
     }
   }
   return res;
 }
 
+void TitanDBImpl::MultiGet(const ReadOptions& options, size_t num_keys,
+                           ColumnFamilyHandle** handles, const Slice* keys,
+                           PinnableSlice* values, Status* statuses) {
+  // Like Get(), total_order_seek is left to the caller, so that prefix
+  // bloom filters can be used for point lookups.
+  if (options.snapshot) {
+    MultiGetImpl(options, num_keys, handles, keys, values, statuses);
+  } else {
+    ReadOptions ro(options);
+    ManagedSnapshot snapshot(this);
+    ro.snapshot = snapshot.snapshot();
+    MultiGetImpl(ro, num_keys, handles, keys, values, statuses);
+  }
+}
+
+void TitanDBImpl::MultiGetImpl(const ReadOptions& options, size_t num_keys,
+                               ColumnFamilyHandle** handles, const Slice* keys,
+                               PinnableSlice* values, Status* statuses) {
+  std::vector<BlobIndex> indexes(num_keys);
+  std::vector<BlobRecord> records(num_keys);
+  std::vector<bool> is_blob(num_keys, false);
+  std::unique_ptr<PinnableSlice[]> buffers(new PinnableSlice[num_keys]);
+
+  // Resolves all the keys in the base DB first, and groups the blob
+  // indexes by column family and blob file.
+  std::map<std::pair<uint32_t, uint64_t>, std::vector<BlobReadRequest>>
+      requests;
+  for (size_t i = 0; i < num_keys; i++) {
+    bool is_blob_index = false;
+    statuses[i] = db_impl_->GetImpl(options, handles[i], keys[i], &values[i],
+                                    nullptr /*value_found*/,
+                                    nullptr /*read_callback*/, &is_blob_index);
+    if (!statuses[i].ok() || !is_blob_index) continue;
+
+    statuses[i] = DecodeInto(values[i], &indexes[i]);
+    assert(statuses[i].ok());
+    if (!statuses[i].ok()) continue;
+
+    BlobReadRequest request;
+    request.handle = &indexes[i].blob_handle;
+    request.record = &records[i];
+    request.buffer = &buffers[i];
+    request.status = &statuses[i];
+    requests[std::make_pair(handles[i]->GetID(), indexes[i].file_number)]
+        .push_back(request);
+    is_blob[i] = true;
+  }
+  if (requests.empty()) return;
+
+  StopWatch multiget_sw(env_, statistics(stats_.get()),
+                        BLOB_DB_MULTIGET_MICROS);
+  RecordTick(statistics(stats_.get()), BLOB_DB_NUM_MULTIGET);
+
+  std::map<uint32_t, std::shared_ptr<BlobStorage>> storages;
+  for (auto& group : requests) {
+    auto cf_id = group.first.first;
+    if (storages.count(cf_id) == 0) {
+      storages.emplace(cf_id, vset_->GetBlobStorageLockFree(cf_id).lock());
+    }
+  }
+
+  for (auto& group : requests) {
+    auto cf_id = group.first.first;
+    auto& storage = storages[cf_id];
+    if (!storage) {
+      Status s = Status::NotFound("Column family id: " +
+                                  std::to_string(cf_id) + " not Found.");
+      for (auto& request : group.second) {
+        *request.status = s;
+      }
+      continue;
+    }
+    StopWatch read_sw(env_, statistics(stats_.get()),
+                      BLOB_DB_BLOB_FILE_READ_MICROS);
+    storage->MultiGet(options, group.first.second, &group.second);
+  }
+
+  for (size_t i = 0; i < num_keys; i++) {
+    if (!is_blob[i]) continue;
+    RecordTick(statistics(stats_.get()), BLOB_DB_NUM_KEYS_READ);
+    RecordTick(statistics(stats_.get()), BLOB_DB_BLOB_FILE_BYTES_READ,
+               indexes[i].blob_handle.size);
+    if (statuses[i].IsCorruption()) {
+      ROCKS_LOG_ERROR(db_options_.info_log,
+                      "Key:%s Snapshot:%" PRIu64 " GetBlobFile err:%s\n",
+                      keys[i].ToString(true).c_str(),
+                      options.snapshot->GetSequenceNumber(),
+                      statuses[i].ToString().c_str());
+    }
+    if (statuses[i].ok()) {
+      // Hands the blob buffer over to the value instead of copying it.
+      values[i].Reset();
+      values[i].PinSlice(records[i].value, &buffers[i]);
+    }
+  }
+}
+
+void TitanDBImpl::SetIteratorSeekMode(TitanReadOptions* options) {
+  // Prefix mode is used only if the caller asks for it with
+  // prefix_same_as_start, which keeps the iterator within the prefix of
+  // the seek key, where prefix bloom filters give correct results.
+  if (!options->prefix_same_as_start) {
+    options->total_order_seek = true;
+  }
+}
+
 Iterator* TitanDBImpl::NewIterator(const TitanReadOptions& options,
                                    ColumnFamilyHandle* handle) {
   TitanReadOptions options_copy = options;
-  options_copy.total_order_seek = true;
+  SetIteratorSeekMode(&options_copy);
   std::shared_ptr<ManagedSnapshot> snapshot;
   if (options_copy.snapshot) {
     return NewIteratorImpl(options_copy, handle, snapshot);
@@ -588,16 +1011,25 @@ Iterator* TitanDBImpl::NewIteratorImpl(
     std::shared_ptr<ManagedSnapshot> snapshot) {
   auto cfd = reinterpret_cast<ColumnFamilyHandleImpl*>(handle)->cfd();
 
-  mutex_.Lock();
-  auto storage = vset_->GetBlobStorage(handle->GetID());
-  mutex_.Unlock();
+  auto storage = vset_->GetBlobStorageLockFree(handle->GetID());
 
   std::unique_ptr<ArenaWrappedDBIter> iter(db_impl_->NewIteratorImpl(
       options, cfd, options.snapshot->GetSequenceNumber(),
       nullptr /*read_callback*/, true /*allow_blob*/, true /*allow_refresh*/));
-  return new TitanDBIterator(options, storage.lock().get(), snapshot,
-                             std::move(iter), env_, stats_.get(),
-                             db_options_.info_log.get());
+  std::unique_ptr<ArenaWrappedDBIter> lookahead;
+  if (options.blob_prefetch_depth > 0 && !options.key_only &&
+      !options.lazy_blob_value) {
+    lookahead.reset(db_impl_->NewIteratorImpl(
+        options, cfd, options.snapshot->GetSequenceNumber(),
+        nullptr /*read_callback*/, true /*allow_blob*/,
+        true /*allow_refresh*/));
+  }
+  return new TitanDBIterator(
+      options, storage.lock().get(), snapshot, this, std::move(iter), env_,
+      stats_.get(), db_options_.info_log.get(), std::move(lookahead),
+      [this](std::function<void()>&& job) {
+        ScheduleAsyncRead(std::move(job));
+      });
 }
 
 Status TitanDBImpl::NewIterators(
@@ -605,7 +1037,7 @@ Status TitanDBImpl::NewIterators(
     const std::vector<ColumnFamilyHandle*>& handles,
     std::vector<Iterator*>* iterators) {
   TitanReadOptions ro(options);
-  ro.total_order_seek = true;
+  SetIteratorSeekMode(&ro);
   std::shared_ptr<ManagedSnapshot> snapshot;
   if (!ro.snapshot) {
     snapshot.reset(new ManagedSnapshot(this));
@@ -619,6 +1051,397 @@ Status TitanDBImpl::NewIterators(
   return Status::OK();
 }
 
+Status TitanDBImpl::ScanBatch(const TitanReadOptions& options,
+                              ColumnFamilyHandle* handle, const RangePtr& range,
+                              size_t batch_size,
+                              const ScanBatchCallback& callback) {
+  if (batch_size == 0) {
+    return Status::InvalidArgument("ScanBatch batch size must be positive");
+  }
+  TitanReadOptions ro(options);
+  SetIteratorSeekMode(&ro);
+  ro.iterate_upper_bound = range.limit;
+  std::unique_ptr<ManagedSnapshot> snapshot;
+  if (!ro.snapshot) {
+    snapshot.reset(new ManagedSnapshot(this));
+    ro.snapshot = snapshot->snapshot();
+  }
+  auto storage = vset_->GetBlobStorageLockFree(handle->GetID()).lock();
+  if (!storage) {
+    return Status::NotFound("Column family id: " +
+                            std::to_string(handle->GetID()) + " not Found.");
+  }
+  auto cfd = reinterpret_cast<ColumnFamilyHandleImpl*>(handle)->cfd();
+  std::unique_ptr<ArenaWrappedDBIter> iter(db_impl_->NewIteratorImpl(
+      ro, cfd, ro.snapshot->GetSequenceNumber(), nullptr /*read_callback*/,
+      true /*allow_blob*/, false /*allow_refresh*/));
+  if (range.start) {
+    iter->Seek(*range.start);
+  } else {
+    iter->SeekToFirst();
+  }
+
+  // Buffers are reused by all the batches.
+  std::vector<std::string> keys(batch_size);
+  std::vector<std::string> inline_values(batch_size);
+  std::vector<BlobIndex> indexes(batch_size);
+  std::vector<BlobRecord> records(batch_size);
+  std::vector<Status> statuses(batch_size);
+  std::vector<bool> is_blob(batch_size, false);
+  std::unique_ptr<PinnableSlice[]> buffers(new PinnableSlice[batch_size]);
+  std::vector<Slice> batch_keys;
+  std::vector<Slice> batch_values;
+  batch_keys.reserve(batch_size);
+  batch_values.reserve(batch_size);
+  Status s;
+  while (iter->Valid()) {
+    // Collects a batch of entries, and groups the blob indexes by blob file.
+    // Requests of a blob file are sorted by offset and coalesced by
+    // MultiGet().
+    std::map<uint64_t, std::vector<BlobReadRequest>> requests;
+    size_t n = 0;
+    for (; n < batch_size && iter->Valid(); n++, iter->Next()) {
+      keys[n].assign(iter->key().data(), iter->key().size());
+      buffers[n].Reset();
+      statuses[n] = Status::OK();
+      is_blob[n] = iter->IsBlob();
+      if (!is_blob[n]) {
+        inline_values[n].assign(iter->value().data(), iter->value().size());
+        continue;
+      }
+      s = DecodeInto(iter->value(), &indexes[n]);
+      if (!s.ok()) {
+        ROCKS_LOG_ERROR(db_options_.info_log,
+                        "ScanBatch: failed to decode blob index %s: %s",
+                        iter->value().ToString(true /*hex*/).c_str(),
+                        s.ToString().c_str());
+        return s;
+      }
+      BlobReadRequest request;
+      request.handle = &indexes[n].blob_handle;
+      request.record = &records[n];
+      request.buffer = &buffers[n];
+      request.status = &statuses[n];
+      requests[indexes[n].file_number].push_back(request);
+    }
+    if (!iter->status().ok()) {
+      return iter->status();
+    }
+
+    {
+      StopWatch read_sw(env_, statistics(stats_.get()),
+                        BLOB_DB_BLOB_FILE_READ_MICROS);
+      for (auto& group : requests) {
+        storage->MultiGet(ro, group.first, &group.second);
+      }
+    }
+
+    batch_keys.clear();
+    batch_values.clear();
+    for (size_t i = 0; i < n; i++) {
+      batch_keys.emplace_back(keys[i]);
+      if (!is_blob[i]) {
+        batch_values.emplace_back(inline_values[i]);
+        continue;
+      }
+      if (!statuses[i].ok()) {
+        ROCKS_LOG_ERROR(db_options_.info_log,
+                        "ScanBatch: key:%s snapshot:%" PRIu64
+                        " failed to read blob file %" PRIu64 ": %s\n",
+                        Slice(keys[i]).ToString(true).c_str(),
+                        ro.snapshot->GetSequenceNumber(),
+                        indexes[i].file_number,
+                        statuses[i].ToString().c_str());
+        return statuses[i];
+      }
+      RecordTick(statistics(stats_.get()), BLOB_DB_NUM_KEYS_READ);
+      RecordTick(statistics(stats_.get()), BLOB_DB_BLOB_FILE_BYTES_READ,
+                 indexes[i].blob_handle.size);
+      batch_values.emplace_back(records[i].value);
+    }
+    s = callback(batch_keys, batch_values);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return iter->status();
+}
+
+Status TitanDBImpl::ParallelScan(const TitanReadOptions& options,
+                                 ColumnFamilyHandle* handle,
+                                 size_t num_threads,
+                                 const ParallelScanCallback& callback,
+                                 ParallelScanResult* result) {
+  // Ranges per thread, so that threads finishing small ranges early pick up
+  // the remaining ones.
+  const size_t kPartitionsPerThread = 4;
+  if (num_threads == 0) {
+    return Status::InvalidArgument("ParallelScan needs at least one thread");
+  }
+  TitanReadOptions ro(options);
+  // The ranges cover the whole column family.
+  ro.iterate_lower_bound = nullptr;
+  ro.iterate_upper_bound = nullptr;
+  ro.prefix_same_as_start = false;
+  ro.total_order_seek = true;
+  std::shared_ptr<ManagedSnapshot> snapshot;
+  if (!ro.snapshot) {
+    snapshot.reset(new ManagedSnapshot(this));
+    ro.snapshot = snapshot->snapshot();
+  }
+  std::vector<std::string> boundaries;
+  GetScanBoundaries(handle, num_threads * kPartitionsPerThread, &boundaries);
+  size_t num_partitions = boundaries.size() + 1;
+
+  std::atomic<size_t> next_partition{0};
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> num_keys{0};
+  std::atomic<uint64_t> num_bytes{0};
+  port::Mutex mutex;
+  Status status;
+  auto scan = [&]() {
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+    Status s;
+    while (s.ok() && !stop.load(std::memory_order_relaxed)) {
+      size_t partition = next_partition.fetch_add(1);
+      if (partition >= num_partitions) break;
+      TitanReadOptions partition_ro(ro);
+      Slice upper_bound;
+      if (partition < boundaries.size()) {
+        upper_bound = boundaries[partition];
+        partition_ro.iterate_upper_bound = &upper_bound;
+      }
+      std::unique_ptr<Iterator> iter(
+          NewIteratorImpl(partition_ro, handle, snapshot));
+      if (partition > 0) {
+        iter->Seek(boundaries[partition - 1]);
+      } else {
+        iter->SeekToFirst();
+      }
+      for (; iter->Valid() && !stop.load(std::memory_order_relaxed);
+           iter->Next()) {
+        s = callback(partition, iter->key(), iter->value());
+        if (!s.ok()) break;
+        keys++;
+        bytes += iter->key().size() + iter->value().size();
+      }
+      if (s.ok()) {
+        s = iter->status();
+      }
+    }
+    if (!s.ok()) {
+      MutexLock l(&mutex);
+      if (status.ok()) {
+        status = s;
+      }
+      stop.store(true, std::memory_order_relaxed);
+    }
+    num_keys.fetch_add(keys, std::memory_order_relaxed);
+    num_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  };
+
+  std::vector<port::Thread> threads;
+  size_t num_workers = std::min(num_threads, num_partitions);
+  for (size_t i = 1; i < num_workers; i++) {
+    threads.emplace_back(scan);
+  }
+  scan();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (result != nullptr) {
+    result->num_partitions = num_partitions;
+    result->num_keys = num_keys.load();
+    result->num_bytes = num_bytes.load();
+  }
+  return status;
+}
+
+void TitanDBImpl::GetScanBoundaries(ColumnFamilyHandle* handle,
+                                    size_t num_partitions,
+                                    std::vector<std::string>* boundaries) {
+  boundaries->clear();
+  auto ucmp = reinterpret_cast<ColumnFamilyHandleImpl*>(handle)
+                  ->cfd()
+                  ->user_comparator();
+  std::vector<LiveFileMetaData> metadata;
+  db_impl_->GetLiveFilesMetaData(&metadata);
+  std::vector<std::pair<std::string, uint64_t>> files;
+  uint64_t total_size = 0;
+  for (auto& file : metadata) {
+    if (file.column_family_name == handle->GetName()) {
+      files.emplace_back(file.smallestkey, file.size);
+      total_size += file.size;
+    }
+  }
+  if (num_partitions <= 1 || files.size() <= 1) {
+    return;
+  }
+  std::sort(files.begin(), files.end(),
+            [ucmp](const std::pair<std::string, uint64_t>& a,
+                   const std::pair<std::string, uint64_t>& b) {
+              return ucmp->Compare(a.first, b.first) < 0;
+            });
+  // Files of different levels overlap, but any key is a valid split point.
+  // Ranges are cut where the size of the files before reaches the next
+  // multiple of the target size.
+  uint64_t target_size = std::max<uint64_t>(total_size / num_partitions, 1);
+  uint64_t size = 0;
+  for (auto& file : files) {
+    if (size >= target_size * (boundaries->size() + 1) &&
+        (boundaries->empty() ||
+         ucmp->Compare(boundaries->back(), file.first) < 0)) {
+      boundaries->push_back(file.first);
+    }
+    size += file.second;
+  }
+}
+
+Status TitanDBImpl::ExportInBlobFileOrder(const TitanReadOptions& options,
+                                          ColumnFamilyHandle* handle,
+                                          const ExportCallback& callback) {
+  const uint64_t kDefaultExportReadaheadSize = 2 << 20;
+  TitanReadOptions ro(options);
+  ro.iterate_lower_bound = nullptr;
+  ro.iterate_upper_bound = nullptr;
+  ro.prefix_same_as_start = false;
+  ro.total_order_seek = true;
+  std::unique_ptr<ManagedSnapshot> snapshot;
+  if (!ro.snapshot) {
+    snapshot.reset(new ManagedSnapshot(this));
+    ro.snapshot = snapshot->snapshot();
+  }
+  auto storage = vset_->GetBlobStorageLockFree(handle->GetID()).lock();
+  if (!storage) {
+    return Status::NotFound("Column family id: " +
+                            std::to_string(handle->GetID()) + " not Found.");
+  }
+  Status s;
+  // Records of the value log are exported with other blob files once it is
+  // sealed.
+  auto value_log = GetValueLog(handle->GetID());
+  if (value_log) {
+    s = value_log->Seal();
+    if (!s.ok()) return s;
+  }
+  auto cfd = reinterpret_cast<ColumnFamilyHandleImpl*>(handle)->cfd();
+  std::unique_ptr<ArenaWrappedDBIter> iter(db_impl_->NewIteratorImpl(
+      ro, cfd, ro.snapshot->GetSequenceNumber(), nullptr /*read_callback*/,
+      true /*allow_blob*/, false /*allow_refresh*/));
+
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    if (iter->IsBlob()) continue;
+    s = callback(0 /*blob_file_number*/, iter->key(), iter->value());
+    if (!s.ok()) return s;
+  }
+  if (!iter->status().ok()) {
+    return iter->status();
+  }
+
+  // Blob files referenced by the snapshot are kept until it is released,
+  // so files purged meanwhile have no records to export.
+  std::map<uint64_t, std::weak_ptr<BlobFileMeta>> files;
+  storage->ExportBlobFiles(files);
+  uint64_t readahead_size =
+      ro.readahead_size > 0 ? ro.readahead_size : kDefaultExportReadaheadSize;
+  for (auto& file_number : files) {
+    auto file = storage->PinFile(file_number.first);
+    if (!file) continue;
+    s = ExportBlobFile(*file, storage.get(), readahead_size,
+                       cfd->user_comparator(), iter.get(), callback);
+    file->Unpin();
+    if (!s.ok()) return s;
+  }
+  return s;
+}
+
+Status TitanDBImpl::ExportBlobFile(const BlobFileMeta& file,
+                                   BlobStorage* storage,
+                                   uint64_t readahead_size,
+                                   const Comparator* ucmp,
+                                   ArenaWrappedDBIter* index_iter,
+                                   const ExportCallback& callback) {
+  // Steps to move the index iterator forward before seeking instead, in
+  // case the records of the file are sparse in the key space.
+  const int kMaxSequentialSkip = 8;
+  std::unique_ptr<PosixRandomRWFile> rw_file;
+  Status s = OpenBlobFile(file.file_number(), 0 /*readahead_size*/,
+                          db_options_, env_options_, env_, &rw_file);
+  if (!s.ok()) return s;
+  BlobFileIterator blob_iter(std::move(rw_file), file.file_number(),
+                             file.file_size(), storage->cf_options());
+  blob_iter.SetReadaheadSize(readahead_size);
+
+  // Live records of a file not sorted by key, exported after the scan.
+  std::vector<std::pair<std::string, BlobIndex>> unsorted;
+  std::string last_key;
+  bool seeked = false;
+  BlobIndex index;
+  for (blob_iter.SeekToFirst(); blob_iter.Valid(); blob_iter.Next()) {
+    Slice key = blob_iter.key();
+    // Moves the index iterator to the first key not less than the record
+    // key. Records are usually sorted by key, so it takes a few steps.
+    if (!seeked || ucmp->Compare(key, last_key) < 0) {
+      index_iter->Seek(key);
+      seeked = true;
+    } else {
+      int skipped = 0;
+      while (index_iter->Valid() && ucmp->Compare(index_iter->key(), key) < 0) {
+        if (++skipped > kMaxSequentialSkip) {
+          index_iter->Seek(key);
+          break;
+        }
+        index_iter->Next();
+      }
+    }
+    last_key.assign(key.data(), key.size());
+    if (!index_iter->Valid()) {
+      if (!index_iter->status().ok()) return index_iter->status();
+      continue;
+    }
+    if (!index_iter->IsBlob() || ucmp->Compare(index_iter->key(), key) != 0) {
+      continue;
+    }
+    s = DecodeInto(index_iter->value(), &index);
+    if (!s.ok()) return s;
+    // Older versions of the key, or versions overwritten by GC, are not
+    // exported.
+    if (index == blob_iter.GetBlobIndex()) {
+      if (!file.sorted()) {
+        unsorted.emplace_back(key.ToString(), index);
+        continue;
+      }
+      s = callback(file.file_number(), key, blob_iter.value());
+      if (!s.ok()) return s;
+    }
+  }
+  if (!blob_iter.status().ok() || unsorted.empty()) {
+    return blob_iter.status();
+  }
+
+  // Records of a sealed value log are in the order they were written. The
+  // live ones are sorted by key and read again, instead of keeping all the
+  // values of the file in memory.
+  std::sort(unsorted.begin(), unsorted.end(),
+            [ucmp](const std::pair<std::string, BlobIndex>& a,
+                   const std::pair<std::string, BlobIndex>& b) {
+              return ucmp->Compare(a.first, b.first) < 0;
+            });
+  ReadOptions read_options;
+  read_options.fill_cache = false;
+  for (auto& entry : unsorted) {
+    BlobRecord record;
+    PinnableSlice buffer;
+    s = storage->Get(read_options, entry.second, &record, &buffer);
+    if (!s.ok()) return s;
+    s = callback(file.file_number(), entry.first, record.value);
+    if (!s.ok()) return s;
+  }
+  return s;
+}
+
 const Snapshot* TitanDBImpl::GetSnapshot() { return db_->GetSnapshot(); }
 
 void TitanDBImpl::ReleaseSnapshot(const Snapshot* snapshot) {
@@ -827,6 +1650,10 @@ Status TitanDBImpl::SetOptions(
       table_factory->SetBlobRunMode(mode);
       mutable_cf_options_[cf_id].blob_run_mode = mode;
     }
+    auto value_log = GetValueLog(cf_id);
+    if (value_log) {
+      value_log->SetBlobRunMode(mode);
+    }
   }
   return Status::OK();
 }
@@ -860,6 +1687,11 @@ bool TitanDBImpl::GetProperty(ColumnFamilyHandle* column_family,
                               const Slice& property, std::string* value) {
   assert(column_family != nullptr);
   bool s = false;
+  uint64_t int_value = 0;
+  if (GetBlobBufferPoolProperty(column_family, property, &int_value)) {
+    *value = std::to_string(int_value);
+    return true;
+  }
   if (stats_.get() != nullptr) {
     auto stats = stats_->internal_stats(column_family->GetID());
     if (stats != nullptr) {
@@ -877,6 +1709,9 @@ bool TitanDBImpl::GetIntProperty(ColumnFamilyHandle* column_family,
                                  const Slice& property, uint64_t* value) {
   assert(column_family != nullptr);
   bool s = false;
+  if (GetBlobBufferPoolProperty(column_family, property, value)) {
+    return true;
+  }
   if (stats_.get() != nullptr) {
     auto stats = stats_->internal_stats(column_family->GetID());
     if (stats != nullptr) {
@@ -890,25 +1725,75 @@ bool TitanDBImpl::GetIntProperty(ColumnFamilyHandle* column_family,
   }
 }
 
+bool TitanDBImpl::GetBlobBufferPoolProperty(ColumnFamilyHandle* column_family,
+                                            const Slice& property,
+                                            uint64_t* value) {
+  bool is_hit = property == TitanDB::Properties::kBlobBufferPoolHit;
+  if (!is_hit && property != TitanDB::Properties::kBlobBufferPoolMiss) {
+    return false;
+  }
+  std::shared_ptr<BlobBufferPool> pool;
+  {
+    MutexLock l(&mutex_);
+    auto it = immutable_cf_options_.find(column_family->GetID());
+    if (it != immutable_cf_options_.end()) {
+      pool = it->second.blob_buffer_pool;
+    }
+  }
+  if (!pool) {
+    return false;
+  }
+  *value = is_hit ? pool->hit_count() : pool->miss_count();
+  return true;
+}
+
+void TitanDBImpl::OnFlushBegin(const FlushJobInfo& flush_job_info) {
+  // Writes without sync leave records of the value log unsynced, while the
+  // flushed SST points to them and replaces the WAL. So the log is synced
+  // before the SST is installed.
+  auto value_log = GetValueLog(flush_job_info.cf_id);
+  if (!value_log) {
+    return;
+  }
+  Status s = value_log->Flush(true /*sync*/);
+  if (!s.ok()) {
+    ROCKS_LOG_ERROR(db_options_.info_log,
+                    "OnFlushBegin[%d]: failed to sync value log of column "
+                    "family %" PRIu32 ": %s",
+                    flush_job_info.job_id, flush_job_info.cf_id,
+                    s.ToString().c_str());
+    MutexLock l(&mutex_);
+    SetBGError(s);
+  }
+}
+
 void TitanDBImpl::OnFlushCompleted(const FlushJobInfo& flush_job_info) {
   const auto& tps = flush_job_info.table_properties;
   auto ucp_iter = tps.user_collected_properties.find(
       BlobFileSizeCollector::kPropertiesName);
+  std::map<uint64_t, uint64_t> blob_files_size;
+  if (ucp_iter != tps.user_collected_properties.end()) {
+    Slice src{ucp_iter->second};
+    if (!BlobFileSizeCollector::Decode(&src, &blob_files_size)) {
+      // TODO: Should treat it as background error and make DB read-only.
+      ROCKS_LOG_ERROR(db_options_.info_log,
+                      "OnFlushCompleted[%d]: failed to decode table property, "
+                      "property size: %" ROCKSDB_PRIszt ".",
+                      flush_job_info.job_id, ucp_iter->second.size());
+      assert(false);
+    }
+  }
+  // Records of the value log not referenced by the flushed SSTs become
+  // discardable once all their blob indexes are flushed.
+  auto value_log = GetValueLog(flush_job_info.cf_id);
+  if (value_log) {
+    value_log->OnFlushCompleted(flush_job_info.largest_seqno,
+                                blob_files_size);
+  }
   // sst file doesn't contain any blob index
-  if (ucp_iter == tps.user_collected_properties.end()) {
+  if (blob_files_size.empty()) {
     return;
   }
-  std::map<uint64_t, uint64_t> blob_files_size;
-  Slice src{ucp_iter->second};
-  if (!BlobFileSizeCollector::Decode(&src, &blob_files_size)) {
-    // TODO: Should treat it as background error and make DB read-only.
-    ROCKS_LOG_ERROR(db_options_.info_log,
-                    "OnFlushCompleted[%d]: failed to decode table property, "
-                    "property size: %" ROCKSDB_PRIszt ".",
-                    flush_job_info.job_id, ucp_iter->second.size());
-    assert(false);
-  }
-  assert(!blob_files_size.empty());
   std::set<uint64_t> outputs;
   for (const auto f : blob_files_size) {
     outputs.insert(f.first);
@@ -1039,7 +1924,12 @@ void TitanDBImpl::OnCompactionCompleted(
       }
       auto file = bs->FindFile(bfs.first).lock();
       if (!file) {
-        // file has been gc out
+        // The value log being written gets the size once it is sealed.
+        if (bs->AddActiveFileDiscardableSize(
+                bfs.first, static_cast<uint64_t>(-bfs.second))) {
+          delta += -bfs.second;
+        }
+        // Otherwise file has been gc out
         continue;
       }
       if (!file->is_obsolete()) {
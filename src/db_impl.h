@@ -1,11 +1,15 @@
 #pragma once
 
+#include <mutex>
+
 #include "blob_file_manager.h"
 #include "db/db_impl.h"
 #include "rocksdb/statistics.h"
+#include "rocksdb/threadpool.h"
 #include "table_factory.h"
 #include "titan/db.h"
 #include "util/repeatable_thread.h"
+#include "value_log.h"
 #include "version_set.h"
 
 namespace rocksdb {
@@ -72,12 +76,20 @@ class TitanDBImpl : public TitanDB {
   Status Get(const ReadOptions& options, ColumnFamilyHandle* handle,
              const Slice& key, PinnableSlice* value) override;
 
+  void AsyncGet(const ReadOptions& options, ColumnFamilyHandle* handle,
+                const Slice& key, PinnableSlice* value,
+                AsyncGetCallback callback) override;
+
   using TitanDB::MultiGet;
   std::vector<Status> MultiGet(const ReadOptions& options,
                                const std::vector<ColumnFamilyHandle*>& handles,
                                const std::vector<Slice>& keys,
                                std::vector<std::string>* values) override;
 
+  void MultiGet(const ReadOptions& options, size_t num_keys,
+                ColumnFamilyHandle** handles, const Slice* keys,
+                PinnableSlice* values, Status* statuses) override;
+
   using TitanDB::NewIterator;
   Iterator* NewIterator(const TitanReadOptions& options,
                         ColumnFamilyHandle* handle) override;
@@ -87,6 +99,20 @@ class TitanDBImpl : public TitanDB {
                       const std::vector<ColumnFamilyHandle*>& handles,
                       std::vector<Iterator*>* iterators) override;
 
+  using TitanDB::ScanBatch;
+  Status ScanBatch(const TitanReadOptions& options, ColumnFamilyHandle* handle,
+                   const RangePtr& range, size_t batch_size,
+                   const ScanBatchCallback& callback) override;
+
+  Status ParallelScan(const TitanReadOptions& options,
+                      ColumnFamilyHandle* handle, size_t num_threads,
+                      const ParallelScanCallback& callback,
+                      ParallelScanResult* result) override;
+
+  Status ExportInBlobFileOrder(const TitanReadOptions& options,
+                               ColumnFamilyHandle* handle,
+                               const ExportCallback& callback) override;
+
   const Snapshot* GetSnapshot() override;
 
   void ReleaseSnapshot(const Snapshot* snapshot) override;
@@ -118,6 +144,8 @@ class TitanDBImpl : public TitanDB {
   bool GetIntProperty(ColumnFamilyHandle* column_family, const Slice& property,
                       uint64_t* value) override;
 
+  void OnFlushBegin(const FlushJobInfo& flush_job_info);
+
   void OnFlushCompleted(const FlushJobInfo& flush_job_info);
 
   void OnCompactionCompleted(const CompactionJobInfo& compaction_job_info);
@@ -126,27 +154,82 @@ class TitanDBImpl : public TitanDB {
 
   Status TEST_StartGC(uint32_t column_family_id);
   Status TEST_PurgeObsoleteFiles();
+  // Drops the value logs without sealing them, as if the DB crashed. They
+  // are sealed on recovery.
+  void TEST_AbandonValueLogs();
 
  private:
   class FileManager;
   friend class FileManager;
+  class BlobSeparator;
   friend class BlobGCJobTest;
   friend class BaseDbListener;
   friend class TitanDBTest;
   friend class TitanThreadSafetyTest;
 
+  // Max times Get() without snapshot re-reads the blob index because the
+  // blob file was purged, before it falls back to acquire a snapshot.
+  static const int kMaxGetWithoutSnapshotRetries = 3;
+
+  // If options.snapshot is not set, the blob file is pinned during the
+  // read, and TryAgain is returned if the file has been purged.
   Status GetImpl(const ReadOptions& options, ColumnFamilyHandle* handle,
                  const Slice& key, PinnableSlice* value);
 
-  std::vector<Status> MultiGetImpl(
-      const ReadOptions& options,
-      const std::vector<ColumnFamilyHandle*>& handles,
-      const std::vector<Slice>& keys, std::vector<std::string>* values);
+  // Reads the blob value of the index into "*value". "pinned_file", if
+  // any, is unpinned after the read.
+  Status GetBlobValue(const ReadOptions& options, const Slice& key,
+                      BlobStorage* storage, const BlobIndex& index,
+                      std::shared_ptr<BlobFileMeta> pinned_file,
+                      PinnableSlice* value);
+
+  // Runs the job in the pool of async blob reads, which is started on the
+  // first call. The job is run inline if there are no threads for it.
+  void ScheduleAsyncRead(std::function<void()>&& job);
+
+  void MultiGetImpl(const ReadOptions& options, size_t num_keys,
+                    ColumnFamilyHandle** handles, const Slice* keys,
+                    PinnableSlice* values, Status* statuses);
+
+  // Gets the blob buffer pool stats of the column family. Returns false if
+  // the property is not about the pool or the column family has no pool.
+  bool GetBlobBufferPoolProperty(ColumnFamilyHandle* column_family,
+                                 const Slice& property, uint64_t* value);
+
+  // Iterators use total order seek unless the caller asks for prefix mode.
+  static void SetIteratorSeekMode(TitanReadOptions* options);
 
   Iterator* NewIteratorImpl(const TitanReadOptions& options,
                             ColumnFamilyHandle* handle,
                             std::shared_ptr<ManagedSnapshot> snapshot);
 
+  // Splits the column family into about "num_partitions" key ranges of
+  // similar data size, on the smallest keys of its SST files. Sets
+  // "*boundaries" to the sorted split keys, each of which starts a range.
+  void GetScanBoundaries(ColumnFamilyHandle* handle, size_t num_partitions,
+                         std::vector<std::string>* boundaries);
+
+  using ValueLogMap = std::unordered_map<uint32_t, std::shared_ptr<ValueLog>>;
+
+  // Returns the value log of the column family, or nullptr if the column
+  // family doesn't separate values on write.
+  std::shared_ptr<ValueLog> GetValueLog(uint32_t cf_id) const;
+
+  // Adds value logs of the column families separating values on write.
+  // REQUIRES: mutex_ held
+  void AddValueLogs(const std::map<uint32_t, TitanCFOptions>& column_families);
+
+  // Removes the value logs of the column families and closes them.
+  // REQUIRES: mutex_ not held
+  Status CloseValueLogs(const std::vector<uint32_t>& column_families);
+
+  // Exports the records of the blob file that "index_iter", an iterator of
+  // blob indexes in the base DB, points to. See ExportInBlobFileOrder().
+  Status ExportBlobFile(const BlobFileMeta& file, BlobStorage* storage,
+                        uint64_t readahead_size, const Comparator* ucmp,
+                        ArenaWrappedDBIter* index_iter,
+                        const ExportCallback& callback);
+
   // REQUIRE: mutex_ held
   void AddToGCQueue(uint32_t column_family_id) {
     mutex_.AssertHeld();
@@ -237,8 +320,23 @@ class TitanDBImpl : public TitanDB {
   // handle for purging obsolete blob files at fixed intervals
   std::unique_ptr<RepeatableThread> thread_purge_obsolete_;
 
+  // Threads reading blob values for AsyncGet().
+  std::once_flag async_read_pool_once_;
+  std::unique_ptr<ThreadPool> async_read_pool_;
+  // Threads writing blob records for table builders, see
+  // TitanDBOptions::blob_write_threads. Joined after the base DB is closed.
+  std::unique_ptr<ThreadPool> blob_write_pool_;
+  // Threads compressing blob records for table builders, see
+  // TitanDBOptions::blob_compression_threads.
+  std::unique_ptr<ThreadPool> blob_compression_pool_;
+
   std::unique_ptr<VersionSet> vset_;
   std::set<uint64_t> pending_outputs_;
+
+  // Guarded by mutex_.
+  ValueLogMap value_logs_;
+  // Copy-on-write view of value_logs_, used on the write path.
+  PublishedPtr<ValueLogMap> published_value_logs_;
   std::shared_ptr<BlobFileManager> blob_manager_;
 
   // gc_queue_ hold column families that we need to gc.
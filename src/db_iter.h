@@ -6,12 +6,18 @@
 
 #include <inttypes.h>
 
+#include <deque>
+#include <functional>
+#include <list>
 #include <memory>
 #include <unordered_map>
 
 #include "db/db_iter.h"
+#include "port/port.h"
 #include "rocksdb/env.h"
 #include "util/logging.h"
+#include "util/mutexlock.h"
+#include "util/sync_point.h"
 
 #include "titan_stats.h"
 
@@ -20,18 +26,32 @@ namespace titandb {
 
 class TitanDBIterator : public Iterator {
  public:
+  // Runs a job in background threads.
+  using Scheduler = std::function<void(std::function<void()>&&)>;
+
+  // If "lookahead" is set, it iterates ahead of "iter" over the same
+  // snapshot, so that blob values of the following entries are read
+  // concurrently by "scheduler". See TitanReadOptions::blob_prefetch_depth.
   TitanDBIterator(const TitanReadOptions& options, BlobStorage* storage,
-                  std::shared_ptr<ManagedSnapshot> snap,
+                  std::shared_ptr<ManagedSnapshot> snap, DB* db,
                   std::unique_ptr<ArenaWrappedDBIter> iter, Env* env,
-                  TitanStats* stats, Logger* info_log)
+                  TitanStats* stats, Logger* info_log,
+                  std::unique_ptr<ArenaWrappedDBIter> lookahead = nullptr,
+                  Scheduler scheduler = nullptr)
       : options_(options),
         storage_(storage),
         snap_(snap),
+        db_(db),
         iter_(std::move(iter)),
+        lookahead_(std::move(lookahead)),
+        scheduler_(std::move(scheduler)),
+        prefetch_cv_(&prefetch_mutex_),
         env_(env),
         stats_(stats),
         info_log_(info_log) {}
 
+  ~TitanDBIterator() { WaitForPendingReads(); }
+
   bool Valid() const override { return iter_->Valid() && status_.ok(); }
 
   Status status() const override {
@@ -45,6 +65,10 @@ class TitanDBIterator : public Iterator {
 
   void SeekToFirst() override {
     iter_->SeekToFirst();
+    if (lookahead_) {
+      ResetLookahead(true /*active*/);
+      lookahead_->SeekToFirst();
+    }
     if (ShouldGetBlobValue()) {
       StopWatch seek_sw(env_, statistics(stats_), BLOB_DB_SEEK_MICROS);
       GetBlobValue();
@@ -54,6 +78,7 @@ class TitanDBIterator : public Iterator {
 
   void SeekToLast() override {
     iter_->SeekToLast();
+    ResetLookahead(false /*active*/);
     if (ShouldGetBlobValue()) {
       StopWatch seek_sw(env_, statistics(stats_), BLOB_DB_SEEK_MICROS);
       GetBlobValue();
@@ -63,6 +88,10 @@ class TitanDBIterator : public Iterator {
 
   void Seek(const Slice& target) override {
     iter_->Seek(target);
+    if (lookahead_) {
+      ResetLookahead(true /*active*/);
+      lookahead_->Seek(target);
+    }
     if (ShouldGetBlobValue()) {
       StopWatch seek_sw(env_, statistics(stats_), BLOB_DB_SEEK_MICROS);
       GetBlobValue();
@@ -72,6 +101,7 @@ class TitanDBIterator : public Iterator {
 
   void SeekForPrev(const Slice& target) override {
     iter_->SeekForPrev(target);
+    ResetLookahead(false /*active*/);
     if (ShouldGetBlobValue()) {
       StopWatch seek_sw(env_, statistics(stats_), BLOB_DB_SEEK_MICROS);
       GetBlobValue();
@@ -82,6 +112,11 @@ class TitanDBIterator : public Iterator {
   void Next() override {
     assert(Valid());
     iter_->Next();
+    if (lookahead_ && !lookahead_active_ && iter_->Valid()) {
+      // Resumes reading ahead after moving backward.
+      ResetLookahead(true /*active*/);
+      lookahead_->Seek(iter_->key());
+    }
     if (ShouldGetBlobValue()) {
       StopWatch next_sw(env_, statistics(stats_), BLOB_DB_NEXT_MICROS);
       GetBlobValue();
@@ -92,6 +127,7 @@ class TitanDBIterator : public Iterator {
   void Prev() override {
     assert(Valid());
     iter_->Prev();
+    ResetLookahead(false /*active*/);
     if (ShouldGetBlobValue()) {
       StopWatch prev_sw(env_, statistics(stats_), BLOB_DB_PREV_MICROS);
       GetBlobValue();
@@ -99,6 +135,48 @@ class TitanDBIterator : public Iterator {
     }
   }
 
+  // Moves the iterator to the latest state of the DB. The iterator must be
+  // positioned again afterwards. Prefetchers of blob files that are still
+  // live are kept, so that a reused iterator reads them with warm
+  // readahead. Like the base DB, iterators created with a snapshot of the
+  // caller are not refreshed.
+  Status Refresh() override {
+    if (!snap_) {
+      return Status::NotSupported("Refresh() is not supported on iterators "
+                                  "created with a snapshot");
+    }
+    WaitForPendingReads();
+    ResetLookahead(false /*active*/);
+    kept_.clear();
+    current_.reset();
+    // The snapshot is taken before the inner iterators move to the latest
+    // sequence, so that it keeps the blob files they refer to.
+    std::shared_ptr<ManagedSnapshot> snap(new ManagedSnapshot(db_));
+    Status s = iter_->Refresh();
+    if (s.ok() && lookahead_) {
+      s = lookahead_->Refresh();
+    }
+    if (!s.ok()) {
+      return s;
+    }
+    snap_ = std::move(snap);
+    // Reads of blob values use the options along with the new snapshot.
+    options_.snapshot = snap_->snapshot();
+    for (auto it = prefetchers_.begin(); it != prefetchers_.end();) {
+      auto file = storage_->FindFileLockFree(it->first).lock();
+      if (!file || file->is_obsolete()) {
+        files_.erase(it->first);
+        it = prefetchers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    status_ = Status::OK();
+    blob_value_pending_ = false;
+    buffer_.Reset();
+    return s;
+  }
+
   Slice key() const override {
     assert(Valid());
     return iter_->key();
@@ -108,11 +186,42 @@ class TitanDBIterator : public Iterator {
     assert(Valid() && !options_.key_only);
     if (options_.key_only) return Slice();
     if (!iter_->IsBlob()) return iter_->value();
+    if (blob_value_pending_) {
+      // In lazy mode, the blob value is read on the first call for the
+      // current entry. Failures are reported by status().
+      auto self = const_cast<TitanDBIterator*>(this);
+      self->blob_value_pending_ = false;
+      self->ReadBlobValue();
+      if (!status_.ok()) return Slice();
+    }
+    if (current_) return current_->record.value;
     return record_.value;
   }
 
  private:
+  // A blob value read ahead of the iterator.
+  struct PrefetchedValue {
+    BlobIndex index;
+    BlobRecord record;
+    PinnableSlice buffer;
+    Status status;
+    // Guarded by prefetch_mutex_.
+    bool done{false};
+  };
+
+  // A blob file prefetcher used by both the iterator and the reads ahead.
+  struct SharedPrefetcher {
+    std::unique_ptr<BlobFilePrefetcher> prefetcher;
+    // Serializes the uses of the prefetcher.
+    port::Mutex mutex;
+    // Values waiting to be read ahead, and whether a job is reading them.
+    // Guarded by prefetch_mutex_.
+    std::deque<std::shared_ptr<PrefetchedValue>> queue;
+    bool reading{false};
+  };
+
   bool ShouldGetBlobValue() {
+    blob_value_pending_ = false;
     if (!iter_->Valid() || !iter_->IsBlob() || options_.key_only) {
       status_ = iter_->status();
       return false;
@@ -121,6 +230,14 @@ class TitanDBIterator : public Iterator {
   }
 
   void GetBlobValue() {
+    if (options_.lazy_blob_value) {
+      blob_value_pending_ = true;
+      return;
+    }
+    ReadBlobValue();
+  }
+
+  void ReadBlobValue() {
     assert(iter_->status().ok());
 
     BlobIndex index;
@@ -133,23 +250,36 @@ class TitanDBIterator : public Iterator {
       return;
     }
 
-    auto it = files_.find(index.file_number);
-    if (it == files_.end()) {
-      std::unique_ptr<BlobFilePrefetcher> prefetcher;
-      status_ = storage_->NewPrefetcher(index.file_number, &prefetcher);
-      if (!status_.ok()) {
-        ROCKS_LOG_ERROR(
-            info_log_,
-            "Titan iterator: failed to create prefetcher for blob file %" PRIu64
-            ": %s",
-            index.file_number, status_.ToString().c_str());
+    current_.reset();
+    if (lookahead_active_) {
+      FillLookahead();
+      // The lookahead iterator started from the same position, so the first
+      // prefetched value is the current one, unless something went wrong.
+      if (!prefetched_.empty() && prefetched_.front()->index == index) {
+        GetPrefetchedValue();
         return;
       }
-      it = files_.emplace(index.file_number, std::move(prefetcher)).first;
+      ResetLookahead(false /*active*/);
+    }
+
+    std::shared_ptr<SharedPrefetcher> prefetcher;
+    status_ = GetPrefetcher(index.file_number, &prefetcher);
+    if (!status_.ok()) {
+      ROCKS_LOG_ERROR(
+          info_log_,
+          "Titan iterator: failed to create prefetcher for blob file %" PRIu64
+          ": %s",
+          index.file_number, status_.ToString().c_str());
+      return;
     }
 
     buffer_.Reset();
-    status_ = it->second->Get(options_, index.blob_handle, &record_, &buffer_);
+    {
+      // Reads ahead of the file may still be running.
+      MutexLock l(&prefetcher->mutex);
+      status_ = prefetcher->prefetcher->Get(options_, index.blob_handle,
+                                            &record_, &buffer_);
+    }
     if (!status_.ok()) {
       ROCKS_LOG_ERROR(
           info_log_,
@@ -161,15 +291,196 @@ class TitanDBIterator : public Iterator {
     return;
   }
 
+  // Returns the prefetcher of the blob file, creating it if it's not kept.
+  // Keeps at most "max_blob_file_prefetchers" of them, dropping the least
+  // recently used one.
+  Status GetPrefetcher(uint64_t file_number,
+                       std::shared_ptr<SharedPrefetcher>* result) {
+    auto it = files_.find(file_number);
+    if (it != files_.end()) {
+      prefetchers_.splice(prefetchers_.begin(), prefetchers_, it->second);
+      *result = it->second->second;
+      return Status::OK();
+    }
+    std::shared_ptr<SharedPrefetcher> prefetcher(new SharedPrefetcher);
+    Status s = storage_->NewPrefetcher(file_number, &prefetcher->prefetcher);
+    if (!s.ok()) return s;
+    AddStats(stats_, storage_->cf_id(),
+             TitanInternalStats::NUM_ITER_PREFETCHER_CREATED, 1);
+    if (options_.max_blob_file_prefetchers > 0 &&
+        prefetchers_.size() >= options_.max_blob_file_prefetchers) {
+      // Releases the reader of the evicted file from the blob file cache.
+      files_.erase(prefetchers_.back().first);
+      prefetchers_.pop_back();
+      AddStats(stats_, storage_->cf_id(),
+               TitanInternalStats::NUM_ITER_PREFETCHER_EVICTED, 1);
+    }
+    prefetchers_.emplace_front(file_number, std::move(prefetcher));
+    files_.emplace(file_number, prefetchers_.begin());
+    *result = prefetchers_.front().second;
+    return s;
+  }
+
+  void WaitForPendingReads() {
+    // Pending reads write to the prefetched values and signal the iterator.
+    MutexLock l(&prefetch_mutex_);
+    while (num_pending_reads_ > 0) {
+      prefetch_cv_.Wait();
+    }
+  }
+
+  // Stops reading ahead. The values read ahead so far are kept, so that
+  // reading ahead again over the same entries, like moving forward after
+  // a few Prev(), reuses them instead of reading them again. Reads ahead
+  // from the next positioning of the lookahead iterator if "active" is true.
+  void ResetLookahead(bool active) {
+    if (!prefetched_.empty()) {
+      kept_ = std::move(prefetched_);
+      prefetched_.clear();
+    }
+    lookahead_active_ = lookahead_ && active;
+  }
+
+  // Reads blob values ahead until "blob_prefetch_depth" values are pending.
+  void FillLookahead() {
+    while (prefetched_.size() < options_.blob_prefetch_depth &&
+           lookahead_->Valid()) {
+      if (lookahead_->IsBlob()) {
+        std::shared_ptr<PrefetchedValue> value(new PrefetchedValue);
+        // Leaves the error to the main iterator.
+        if (!DecodeInto(lookahead_->value(), &value->index).ok()) break;
+        auto kept = TakeKeptValue(value->index);
+        if (kept) {
+          TEST_SYNC_POINT("TitanDBIterator::ReuseValue");
+          prefetched_.push_back(std::move(kept));
+        } else {
+          ReadAhead(value);
+          prefetched_.push_back(std::move(value));
+        }
+      }
+      lookahead_->Next();
+    }
+  }
+
+  // Returns the kept value read ahead for the blob index, if any.
+  std::shared_ptr<PrefetchedValue> TakeKeptValue(const BlobIndex& index) {
+    for (auto it = kept_.begin(); it != kept_.end(); ++it) {
+      if ((*it)->index == index) {
+        auto value = std::move(*it);
+        kept_.erase(it);
+        return value;
+      }
+    }
+    return nullptr;
+  }
+
+  // Queues the read of the value to the prefetcher of its blob file, and
+  // schedules a job doing the queued reads of the file if none is running.
+  // So the reads of a file are done in the order of iteration, and the
+  // prefetcher reads ahead of them as it does for the iterator.
+  void ReadAhead(const std::shared_ptr<PrefetchedValue>& value) {
+    std::shared_ptr<SharedPrefetcher> prefetcher;
+    Status s = GetPrefetcher(value->index.file_number, &prefetcher);
+    {
+      MutexLock l(&prefetch_mutex_);
+      if (!s.ok()) {
+        // Leaves the error to the main iterator.
+        value->status = s;
+        value->done = true;
+        return;
+      }
+      num_pending_reads_++;
+      prefetcher->queue.push_back(value);
+      if (prefetcher->reading) {
+        return;
+      }
+      prefetcher->reading = true;
+    }
+    // The scheduler may run the job in the calling thread.
+    scheduler_([this, prefetcher]() mutable {
+      ReadQueuedValues(std::move(prefetcher));
+    });
+  }
+
+  void ReadQueuedValues(std::shared_ptr<SharedPrefetcher> prefetcher) {
+    prefetch_mutex_.Lock();
+    while (!prefetcher->queue.empty()) {
+      auto value = std::move(prefetcher->queue.front());
+      prefetcher->queue.pop_front();
+      prefetch_mutex_.Unlock();
+      TEST_SYNC_POINT("TitanDBIterator::ReadAhead");
+      Status s;
+      {
+        MutexLock l(&prefetcher->mutex);
+        s = prefetcher->prefetcher->Get(options_, value->index.blob_handle,
+                                        &value->record, &value->buffer);
+      }
+      prefetch_mutex_.Lock();
+      value->status = s;
+      value->done = true;
+      num_pending_reads_--;
+      prefetch_cv_.SignalAll();
+    }
+    prefetcher->reading = false;
+    // Releases the prefetcher before the iterator may be destroyed.
+    prefetcher.reset();
+    prefetch_mutex_.Unlock();
+  }
+
+  void GetPrefetchedValue() {
+    auto value = prefetched_.front();
+    prefetched_.pop_front();
+    // Keeps the pipeline full before waiting for the current value.
+    FillLookahead();
+    {
+      MutexLock l(&prefetch_mutex_);
+      while (!value->done) {
+        prefetch_cv_.Wait();
+      }
+    }
+    status_ = value->status;
+    if (!status_.ok()) {
+      ROCKS_LOG_ERROR(
+          info_log_,
+          "Titan iterator: failed to read blob value from file %" PRIu64
+          ", offset %" PRIu64 ", size %" PRIu64 ": %s\n",
+          value->index.file_number, value->index.blob_handle.offset,
+          value->index.blob_handle.size, status_.ToString().c_str());
+    }
+    current_ = std::move(value);
+  }
+
   Status status_;
   BlobRecord record_;
   PinnableSlice buffer_;
+  // Whether the blob value of the current entry is not read yet in lazy
+  // mode.
+  bool blob_value_pending_{false};
 
   TitanReadOptions options_;
   BlobStorage* storage_;
   std::shared_ptr<ManagedSnapshot> snap_;
+  DB* db_;
   std::unique_ptr<ArenaWrappedDBIter> iter_;
-  std::unordered_map<uint64_t, std::unique_ptr<BlobFilePrefetcher>> files_;
+  // Prefetchers of blob files, from the most recently used one.
+  using PrefetcherList =
+      std::list<std::pair<uint64_t, std::shared_ptr<SharedPrefetcher>>>;
+  PrefetcherList prefetchers_;
+  std::unordered_map<uint64_t, PrefetcherList::iterator> files_;
+
+  std::unique_ptr<ArenaWrappedDBIter> lookahead_;
+  Scheduler scheduler_;
+  bool lookahead_active_{false};
+  // Values being read ahead, in the order of iteration.
+  std::deque<std::shared_ptr<PrefetchedValue>> prefetched_;
+  // Values read ahead before the last ResetLookahead(), for reuse.
+  std::deque<std::shared_ptr<PrefetchedValue>> kept_;
+  // The prefetched value of the current entry, if any.
+  std::shared_ptr<PrefetchedValue> current_;
+  port::Mutex prefetch_mutex_;
+  port::CondVar prefetch_cv_;
+  // Guarded by prefetch_mutex_.
+  int num_pending_reads_{0};
 
   Env* env_;
   TitanStats* stats_;
@@ -33,16 +33,13 @@ Status DigHoleJob::Exec(const std::vector<BlobFileMeta *> &inputs) {
 Status DigHoleJob::Exec(BlobFileMeta *input) {
   Status s;
   // open file
-  std::unique_ptr<PosixRandomRWFile>
-      file;  // TODO(@DorianZheng) set read ahead size
-  s = OpenBlobFile(input->file_number(), 0, db_options_, env_options_, env_,
-                   &file);
+  std::unique_ptr<BlobFileIterator> record_iter;
+  s = NewGCBlobFileIterator(input->file_number(), input->file_size(),
+                            db_options_, titan_cf_options_, env_options_, env_,
+                            &record_iter);
   if (!s.ok()) {
     return s;
   }
-  auto record_iter =
-      std::make_shared<BlobFileIterator>(std::move(file), input->file_number(),
-                                         input->file_size(), titan_cf_options_);
   // pre size
   uint64_t before_size = 0, after_size = 0;
   record_iter->GetFileRealSize(&before_size);
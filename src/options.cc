@@ -24,6 +24,15 @@ void TitanDBOptions::Dump(Logger* logger) const {
   ROCKS_LOG_HEADER(logger,
                    "TitanDBOptions.purge_obsolete_files_period: %" PRIu32,
                    purge_obsolete_files_period);
+  ROCKS_LOG_HEADER(logger,
+                   "TitanDBOptions.async_read_threads         : %" PRIi32,
+                   async_read_threads);
+  ROCKS_LOG_HEADER(logger,
+                   "TitanDBOptions.blob_write_threads         : %" PRIi32,
+                   blob_write_threads);
+  ROCKS_LOG_HEADER(logger,
+                   "TitanDBOptions.blob_compression_threads   : %" PRIi32,
+                   blob_compression_threads);
 }
 
 TitanCFOptions::TitanCFOptions(const ColumnFamilyOptions& cf_opts,
@@ -32,8 +41,16 @@ TitanCFOptions::TitanCFOptions(const ColumnFamilyOptions& cf_opts,
     : ColumnFamilyOptions(cf_opts),
       min_blob_size(immutable_opts.min_blob_size),
       blob_file_compression(immutable_opts.blob_file_compression),
+      blob_file_compression_options(
+          immutable_opts.blob_file_compression_options),
+      blob_file_block_size(immutable_opts.blob_file_block_size),
       blob_file_target_size(immutable_opts.blob_file_target_size),
+      separate_blob_on_write(immutable_opts.separate_blob_on_write),
+      blob_buffer_pool(immutable_opts.blob_buffer_pool),
       blob_cache(immutable_opts.blob_cache),
+      blob_cache_admission_filter(immutable_opts.blob_cache_admission_filter),
+      blob_persistent_cache(immutable_opts.blob_persistent_cache),
+      max_blob_readahead_size(immutable_opts.max_blob_readahead_size),
       max_gc_batch_size(immutable_opts.max_gc_batch_size),
       min_gc_batch_size(immutable_opts.min_gc_batch_size),
       blob_file_discardable_ratio(immutable_opts.blob_file_discardable_ratio),
@@ -54,14 +71,35 @@ void TitanCFOptions::Dump(Logger* logger) const {
   }
   ROCKS_LOG_HEADER(logger, "TitanCFOptions.blob_file_compression        : %s",
                    compression_str.c_str());
+  ROCKS_LOG_HEADER(
+      logger,
+      "TitanCFOptions.blob_file_compression_options: level=%d, "
+      "max_dict_bytes=%" PRIu32 ", zstd_max_train_bytes=%" PRIu32,
+      blob_file_compression_options.level,
+      blob_file_compression_options.max_dict_bytes,
+      blob_file_compression_options.zstd_max_train_bytes);
+  ROCKS_LOG_HEADER(logger,
+                   "TitanCFOptions.blob_file_block_size         : %" PRIu64,
+                   blob_file_block_size);
   ROCKS_LOG_HEADER(logger,
                    "TitanCFOptions.blob_file_target_size        : %" PRIu64,
                    blob_file_target_size);
+  ROCKS_LOG_HEADER(logger, "TitanCFOptions.separate_blob_on_write       : %d",
+                   static_cast<int>(separate_blob_on_write));
+  ROCKS_LOG_HEADER(logger, "TitanCFOptions.blob_buffer_pool             : %p",
+                   blob_buffer_pool.get());
   ROCKS_LOG_HEADER(logger, "TitanCFOptions.blob_cache                   : %p",
                    blob_cache.get());
   if (blob_cache != nullptr) {
     ROCKS_LOG_HEADER(logger, "%s", blob_cache->GetPrintableOptions().c_str());
   }
+  ROCKS_LOG_HEADER(logger, "TitanCFOptions.blob_cache_admission_filter  : %p",
+                   blob_cache_admission_filter.get());
+  ROCKS_LOG_HEADER(logger, "TitanCFOptions.blob_persistent_cache        : %p",
+                   blob_persistent_cache.get());
+  ROCKS_LOG_HEADER(logger,
+                   "TitanCFOptions.max_blob_readahead_size      : %" PRIu64,
+                   max_blob_readahead_size);
   ROCKS_LOG_HEADER(logger,
                    "TitanCFOptions.max_gc_batch_size            : %" PRIu64,
                    max_gc_batch_size);
@@ -6,6 +6,8 @@
 
 #include <inttypes.h>
 
+#include "util/mutexlock.h"
+
 namespace rocksdb {
 namespace titandb {
 
@@ -40,61 +42,259 @@ void TitanTableBuilder::Add(const Slice& key, const Slice& value) {
       ikey.type = kTypeValue;
       std::string index_key;
       AppendInternalKey(&index_key, ikey);
-      base_builder_->Add(index_key, record.value);
+      AddBase(index_key, record.value);
     } else {
       // Get blob value can fail if corresponding blob file has been GC-ed
       // deleted. In this case we write the blob index as is to compaction
       // output.
       // TODO: return error if it is indeed an error.
-      base_builder_->Add(key, value);
+      AddBase(key, value);
     }
   } else if (ikey.type == kTypeValue &&
              value.size() >= cf_options_.min_blob_size &&
              cf_options_.blob_run_mode == TitanBlobRunMode::kNormal) {
     // we write to blob file and insert index
+    ikey.type = kTypeBlobIndex;
+    std::string index_key;
+    AppendInternalKey(&index_key, ikey);
+    if (blob_write_pool_ != nullptr || blob_compression_pool_ != nullptr ||
+        sample_blobs_ || pack_blobs_) {
+      SubmitBlob(index_key, value);
+      return;
+    }
     std::string index_value;
     AddBlob(ikey.user_key, value, &index_value);
     if (ok()) {
-      ikey.type = kTypeBlobIndex;
-      std::string index_key;
-      AppendInternalKey(&index_key, ikey);
       base_builder_->Add(index_key, index_value);
     }
   } else {
+    AddBase(key, value);
+  }
+}
+
+void TitanTableBuilder::AddBase(const Slice& key, const Slice& value) {
+  AddReadyEntries();
+  if (pending_.empty()) {
     base_builder_->Add(key, value);
+    return;
   }
+  pending_.emplace_back();
+  auto& entry = pending_.back();
+  entry.key = key.ToString();
+  entry.value = value.ToString();
+  entry.size = key.size() + value.size();
+  pending_size_ += entry.size;
 }
 
 void TitanTableBuilder::AddBlob(const Slice& key, const Slice& value,
                                 std::string* index_value) {
   if (!ok()) return;
-  StopWatch write_sw(db_options_.env, statistics(stats_),
-                     BLOB_DB_BLOB_FILE_WRITE_MICROS);
+  if (!blob_builder_) {
+    NewBlobFile();
+    if (!ok()) return;
+  }
+  std::vector<BlobRecord> records(1);
+  records[0].key = key;
+  records[0].value = value;
+  std::vector<std::string> index_values;
+  status_ = WriteBlobs(records, &index_values);
+  if (status_.ok()) {
+    index_value->swap(index_values[0]);
+  }
+}
 
+void TitanTableBuilder::SubmitBlob(const Slice& key, const Slice& value) {
   if (!blob_builder_) {
-    status_ = blob_manager_->NewFile(&blob_handle_);
+    NewBlobFile();
     if (!ok()) return;
-    ROCKS_LOG_INFO(db_options_.info_log,
-                   "Titan table builder created new blob file %" PRIu64 ".",
-                   blob_handle_->GetNumber());
-    blob_builder_.reset(
-        new BlobFileBuilder(db_options_, cf_options_, blob_handle_->GetFile()));
   }
+  pending_.emplace_back();
+  auto& entry = pending_.back();
+  entry.key = key.ToString();
+  entry.value = value.ToString();
+  entry.is_blob = true;
+  entry.blob_seq = num_blobs_submitted_++;
+  entry.size = key.size() + kEstimatedBlobIndexSize;
+  pending_size_ += entry.size;
+  bool write_now = false;
+  {
+    MutexLock l(&blob_mutex_);
+    blob_queue_.push_back(&entry);
+    queued_blob_size_ += value.size();
+    pending_blob_size_ += value.size();
+    bool dict_built = false;
+    if (sample_blobs_) {
+      if (pending_blob_size_ < MaxSampleSize()) {
+        return;
+      }
+      BuildCompressionDict();
+      dict_built = true;
+    }
+    if (blob_write_pool_ == nullptr) {
+      // The held records are written at once, so that later records can be
+      // written inline if they are not queued otherwise.
+      write_now = dict_built || pending_blob_size_ >= kMaxBlobBatchSize;
+    } else {
+      ScheduleBlobWrites();
+      while (pending_blob_size_ > kMaxPendingBlobSize && blob_status_.ok()) {
+        blob_cv_.Wait();
+      }
+    }
+  }
+  if (write_now) {
+    WriteQueuedBlobs();
+  }
+  AddReadyEntries();
+}
+
+bool TitanTableBuilder::UseCompressionDict(const TitanCFOptions& cf_options) {
+  return (cf_options.blob_file_compression == kZSTD ||
+          cf_options.blob_file_compression == kZSTDNotFinalCompression) &&
+         cf_options.blob_file_compression_options.max_dict_bytes > 0 &&
+         BlobCompressionDict::Supported();
+}
 
-  RecordTick(stats_, BLOB_DB_NUM_KEYS_WRITTEN);
-  MeasureTime(stats_, BLOB_DB_KEY_SIZE, key.size());
-  MeasureTime(stats_, BLOB_DB_VALUE_SIZE, value.size());
-  AddStats(stats_, cf_id_, TitanInternalStats::LIVE_BLOB_SIZE, value.size());
+uint64_t TitanTableBuilder::MaxSampleSize() const {
+  const auto& options = cf_options_.blob_file_compression_options;
+  uint64_t size = options.zstd_max_train_bytes > 0
+                      ? options.zstd_max_train_bytes
+                      : options.max_dict_bytes;
+  // Table building waits for the blob writes beyond this size anyway.
+  return size < kMaxPendingBlobSize ? size : kMaxPendingBlobSize;
+}
+
+void TitanTableBuilder::BuildCompressionDict() {
+  blob_mutex_.AssertHeld();
+  sample_blobs_ = false;
+  if (blob_queue_.empty()) return;
+
+  const auto& options = cf_options_.blob_file_compression_options;
+  std::string samples;
+  std::vector<size_t> sample_lens;
+  for (auto entry : blob_queue_) {
+    samples.append(entry->value);
+    sample_lens.push_back(entry->value.size());
+  }
+  std::string dict;
+  if (options.zstd_max_train_bytes > 0) {
+    dict = TrainCompressionDict(samples, sample_lens, options.max_dict_bytes);
+  }
+  if (dict.empty()) {
+    // Uses the samples as the dictionary if training is disabled or fails.
+    dict = samples.substr(0, options.max_dict_bytes);
+  }
+  // The blob builder is not used by others until the records are written.
+  blob_builder_->SetCompressionDict(dict);
+}
 
-  BlobIndex index;
-  BlobRecord record;
-  record.key = key;
-  record.value = value;
-  index.file_number = blob_handle_->GetNumber();
-  blob_builder_->Add(record, &index.blob_handle);
-  RecordTick(stats_, BLOB_DB_BLOB_FILE_BYTES_WRITTEN, index.blob_handle.size);
-  if (ok()) {
-    index.EncodeTo(index_value);
+bool TitanTableBuilder::ShouldWriteBatch() const {
+  blob_mutex_.AssertHeld();
+  if (blob_queue_.empty()) {
+    return false;
+  }
+  return !pack_blobs_ || blobs_finished_ ||
+         queued_blob_size_ >= kMaxBlobBatchSize;
+}
+
+void TitanTableBuilder::ScheduleBlobWrites() {
+  blob_mutex_.AssertHeld();
+  if (!blob_write_scheduled_ && ShouldWriteBatch()) {
+    blob_write_scheduled_ = true;
+    blob_write_pool_->SubmitJob([this]() { WriteQueuedBlobs(); });
+  }
+}
+
+void TitanTableBuilder::NewBlobFile() {
+  status_ = blob_manager_->NewFile(&blob_handle_);
+  if (!ok()) return;
+  ROCKS_LOG_INFO(db_options_.info_log,
+                 "Titan table builder created new blob file %" PRIu64 ".",
+                 blob_handle_->GetNumber());
+  blob_builder_.reset(new BlobFileBuilder(db_options_, cf_options_,
+                                          blob_handle_->GetFile(),
+                                          blob_compression_pool_, stats_));
+}
+
+Status TitanTableBuilder::WriteBlobs(const std::vector<BlobRecord>& records,
+                                     std::vector<std::string>* index_values) {
+  std::vector<BlobHandle> handles;
+  blob_builder_->AddBatch(records, &handles);
+  Status s = blob_builder_->status();
+  if (!s.ok()) return s;
+
+  index_values->resize(records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    const BlobRecord& record = records[i];
+    RecordTick(stats_, BLOB_DB_NUM_KEYS_WRITTEN);
+    MeasureTime(stats_, BLOB_DB_KEY_SIZE, record.key.size());
+    MeasureTime(stats_, BLOB_DB_VALUE_SIZE, record.value.size());
+    AddStats(stats_, cf_id_, TitanInternalStats::LIVE_BLOB_SIZE,
+             record.value.size());
+    RecordTick(stats_, BLOB_DB_BLOB_FILE_BYTES_WRITTEN,
+               handles[i].record_size());
+
+    BlobIndex index;
+    index.file_number = blob_handle_->GetNumber();
+    index.blob_handle = handles[i];
+    index.EncodeTo(&(*index_values)[i]);
+  }
+  return s;
+}
+
+void TitanTableBuilder::WriteQueuedBlobs() {
+  MutexLock l(&blob_mutex_);
+  while (ShouldWriteBatch()) {
+    std::vector<PendingEntry*> batch;
+    uint64_t batch_size = 0;
+    while (!blob_queue_.empty() && batch_size < kMaxBlobBatchSize) {
+      batch.push_back(blob_queue_.front());
+      batch_size += blob_queue_.front()->value.size();
+      blob_queue_.pop_front();
+    }
+    queued_blob_size_ -= batch_size;
+    if (blob_status_.ok()) {
+      blob_mutex_.Unlock();
+      std::vector<BlobRecord> records(batch.size());
+      for (size_t i = 0; i < batch.size(); i++) {
+        records[i].key = ExtractUserKey(batch[i]->key);
+        records[i].value = batch[i]->value;
+      }
+      std::vector<std::string> index_values;
+      Status s = WriteBlobs(records, &index_values);
+      for (size_t i = 0; i < index_values.size(); i++) {
+        batch[i]->value.swap(index_values[i]);
+      }
+      blob_mutex_.Lock();
+      blob_status_ = s;
+    }
+    pending_blob_size_ -= batch_size;
+    // Entries are published to the table building thread even on error,
+    // which checks the status before adding them.
+    num_blobs_written_.fetch_add(batch.size(), std::memory_order_release);
+    blob_cv_.SignalAll();
+  }
+  blob_write_scheduled_ = false;
+  blob_cv_.SignalAll();
+}
+
+void TitanTableBuilder::AddReadyEntries() {
+  while (!pending_.empty() && ok()) {
+    auto& entry = pending_.front();
+    if (entry.is_blob &&
+        entry.blob_seq >=
+            num_blobs_written_.load(std::memory_order_acquire)) {
+      break;
+    }
+    base_builder_->Add(entry.key, entry.value);
+    pending_size_ -= entry.size;
+    pending_.pop_front();
+  }
+}
+
+void TitanTableBuilder::WaitForBlobWrites() {
+  MutexLock l(&blob_mutex_);
+  while (blob_write_scheduled_) {
+    blob_cv_.Wait();
   }
 }
 
@@ -104,12 +304,30 @@ Status TitanTableBuilder::status() const {
     s = base_builder_->status();
   }
   if (s.ok() && blob_builder_) {
-    s = blob_builder_->status();
+    // The blob builder is owned by the blob write job while it is
+    // scheduled.
+    MutexLock l(&blob_mutex_);
+    s = blob_write_scheduled_ ? blob_status_ : blob_builder_->status();
   }
   return s;
 }
 
 Status TitanTableBuilder::Finish() {
+  {
+    MutexLock l(&blob_mutex_);
+    if (sample_blobs_) {
+      BuildCompressionDict();
+    }
+    blobs_finished_ = true;
+    if (blob_write_pool_ != nullptr) {
+      ScheduleBlobWrites();
+    }
+  }
+  if (blob_write_pool_ == nullptr) {
+    WriteQueuedBlobs();
+  }
+  WaitForBlobWrites();
+  AddReadyEntries();
   base_builder_->Finish();
   if (blob_builder_) {
     blob_builder_->Finish();
@@ -142,6 +360,14 @@ Status TitanTableBuilder::Finish() {
 }
 
 void TitanTableBuilder::Abandon() {
+  WaitForBlobWrites();
+  {
+    MutexLock l(&blob_mutex_);
+    blob_queue_.clear();
+    queued_blob_size_ = 0;
+  }
+  pending_.clear();
+  pending_size_ = 0;
   base_builder_->Abandon();
   if (blob_builder_) {
     ROCKS_LOG_INFO(db_options_.info_log,
@@ -154,11 +380,13 @@ void TitanTableBuilder::Abandon() {
 }
 
 uint64_t TitanTableBuilder::NumEntries() const {
-  return base_builder_->NumEntries();
+  return base_builder_->NumEntries() + pending_.size();
 }
 
 uint64_t TitanTableBuilder::FileSize() const {
-  return base_builder_->FileSize();
+  // Entries waiting for their blob records are counted, so that compaction
+  // cuts output files in time.
+  return base_builder_->FileSize() + pending_size_;
 }
 
 bool TitanTableBuilder::NeedCompact() const {
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <vector>
+
 #include "blob_file_builder.h"
 #include "blob_file_manager.h"
+#include "port/port.h"
+#include "rocksdb/threadpool.h"
 #include "table/table_builder.h"
 #include "titan/options.h"
 #include "titan_stats.h"
@@ -16,14 +22,21 @@ class TitanTableBuilder : public TableBuilder {
                     const TitanCFOptions& cf_options,
                     std::unique_ptr<TableBuilder> base_builder,
                     std::shared_ptr<BlobFileManager> blob_manager,
-                    std::weak_ptr<BlobStorage> blob_storage, TitanStats* stats)
+                    std::weak_ptr<BlobStorage> blob_storage, TitanStats* stats,
+                    ThreadPool* blob_write_pool,
+                    ThreadPool* blob_compression_pool)
       : cf_id_(cf_id),
         db_options_(db_options),
         cf_options_(cf_options),
         base_builder_(std::move(base_builder)),
         blob_manager_(blob_manager),
         blob_storage_(blob_storage),
-        stats_(stats) {}
+        stats_(stats),
+        blob_write_pool_(blob_write_pool),
+        blob_compression_pool_(blob_compression_pool),
+        sample_blobs_(UseCompressionDict(cf_options)),
+        pack_blobs_(cf_options.blob_file_block_size > 0),
+        blob_cv_(&blob_mutex_) {}
 
   void Add(const Slice& key, const Slice& value) override;
 
@@ -42,10 +55,83 @@ class TitanTableBuilder : public TableBuilder {
   TableProperties GetTableProperties() const override;
 
  private:
+  // An entry of the base table waiting for the blob records before it,
+  // see blob_write_pool_, blob_compression_pool_, sample_blobs_ and
+  // pack_blobs_. The value of a blob entry is replaced with the blob index
+  // once its record is written.
+  struct PendingEntry {
+    std::string key;
+    std::string value;
+    bool is_blob{false};
+    uint64_t blob_seq{0};
+    // Estimated size of the entry in the base table.
+    uint64_t size{0};
+  };
+
+  // Rough size of an encoded blob index, which replaces the value of a
+  // pending blob entry.
+  static const uint64_t kEstimatedBlobIndexSize = 16;
+
+  // Max size of blob values handed to the blob write threads but not
+  // written yet. Table building waits for the blob writes beyond it.
+  static const uint64_t kMaxPendingBlobSize = 16 << 20;
+
+  // Max size of blob values written in a batch, which are compressed in
+  // parallel by blob_compression_pool_.
+  static const uint64_t kMaxBlobBatchSize = 1 << 20;
+
   bool ok() const { return status().ok(); }
 
+  // Returns true if blob files are compressed with zstd dictionaries, see
+  // TitanCFOptions::blob_file_compression_options.
+  static bool UseCompressionDict(const TitanCFOptions& cf_options);
+
+  // Returns the size of blob values to build the dictionary from.
+  uint64_t MaxSampleSize() const;
+
+  // Adds the entry to the base table, after the pending entries if any.
+  void AddBase(const Slice& key, const Slice& value);
+
   void AddBlob(const Slice& key, const Slice& value, std::string* index_value);
 
+  // Queues the blob value of the entry to be written in a batch, by the
+  // blob write threads if any.
+  void SubmitBlob(const Slice& key, const Slice& value);
+
+  void NewBlobFile();
+
+  // Appends the records to the blob file and encodes their indexes to
+  // "*index_values".
+  Status WriteBlobs(const std::vector<BlobRecord>& records,
+                    std::vector<std::string>* index_values);
+
+  // Writes the queued blob records in order, in batches. Runs in a blob
+  // write thread, or in this thread if blob_write_pool_ is null.
+  void WriteQueuedBlobs();
+
+  // Builds the compression dictionary of the blob file from the queued
+  // blob values, and lets the queued records be written.
+  // REQUIRES: blob_mutex_ held
+  void BuildCompressionDict();
+
+  // Returns true if the queued blob records should be written in a
+  // batch now. With pack_blobs_, batches are full unless the table is
+  // finished, so that records are packed into blocks the same with or
+  // without blob write threads.
+  // REQUIRES: blob_mutex_ held
+  bool ShouldWriteBatch() const;
+
+  // Schedules the blob write job if there is none and a batch is ready.
+  // REQUIRES: blob_mutex_ held, blob_write_pool_ is not null
+  void ScheduleBlobWrites();
+
+  // Adds the pending entries whose blob records are written to the base
+  // table.
+  void AddReadyEntries();
+
+  // Waits for the submitted blob records to be written.
+  void WaitForBlobWrites();
+
   Status status_;
   uint32_t cf_id_;
   TitanDBOptions db_options_;
@@ -57,6 +143,43 @@ class TitanTableBuilder : public TableBuilder {
   std::weak_ptr<BlobStorage> blob_storage_;
 
   TitanStats* stats_;
+
+  // If not null, blob records are written by these threads, while the
+  // entries of the base table following them wait in pending_ until their
+  // records are written. Records are appended in the order of the entries,
+  // so the blob file is the same as written in this thread.
+  ThreadPool* blob_write_pool_;
+  // If not null, blob records are written in batches, with the records of
+  // a batch compressed by these threads in parallel.
+  ThreadPool* blob_compression_pool_;
+  // If true, blob records are queued but not written until the values
+  // queued are enough to build the compression dictionary from, or the
+  // table is finished. Owned by the table building thread.
+  bool sample_blobs_;
+  // If true, blob records are always written in batches, whose small
+  // records are packed into blob blocks.
+  const bool pack_blobs_;
+  // Owned by the table building thread. Values of blob entries are
+  // replaced by the blob write job, see num_blobs_written_.
+  std::deque<PendingEntry> pending_;
+  // Total estimated size of pending_ entries, which counts to FileSize().
+  uint64_t pending_size_{0};
+  uint64_t num_blobs_submitted_{0};
+  std::atomic<uint64_t> num_blobs_written_{0};
+
+  mutable port::Mutex blob_mutex_;
+  port::CondVar blob_cv_;
+  // The following fields are guarded by blob_mutex_. blob_builder_ is
+  // only accessed by the blob write job while it is scheduled.
+  std::deque<PendingEntry*> blob_queue_;
+  // Size of blob values in blob_queue_.
+  uint64_t queued_blob_size_{0};
+  // Size of blob values queued or being written.
+  uint64_t pending_blob_size_{0};
+  // Set when no more blob records will be queued.
+  bool blobs_finished_{false};
+  bool blob_write_scheduled_{false};
+  Status blob_status_;
 };
 
 }  // namespace titandb
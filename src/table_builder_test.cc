@@ -82,9 +82,7 @@ class TableBuilderTest : public testing::Test {
     cf_options_.min_blob_size = kMinBlobSize;
     vset_.reset(new VersionSet(db_options_, nullptr));
     blob_manager_.reset(new FileManager(db_options_));
-    table_factory_.reset(new TitanTableFactory(db_options_, cf_options_,
-                                               blob_manager_, &mutex_,
-                                               vset_.get(), nullptr));
+    ResetTableFactory(nullptr, nullptr);
   }
 
   ~TableBuilderTest() {
@@ -154,6 +152,62 @@ class TableBuilderTest : public testing::Test {
     result->reset(table_factory_->NewTableBuilder(options, 0, file));
   }
 
+  void ResetTableFactory(ThreadPool* blob_write_pool,
+                         ThreadPool* blob_compression_pool) {
+    table_factory_.reset(new TitanTableFactory(
+        db_options_, cf_options_, blob_manager_, &mutex_, vset_.get(), nullptr,
+        blob_write_pool, blob_compression_pool));
+  }
+
+  // Builds a table of values in various sizes, and reads the base table
+  // and the blob file to "*base_data" and "*blob_data".
+  void BuildTable(std::string* base_data, std::string* blob_data) {
+    std::unique_ptr<WritableFileWriter> base_file;
+    NewBaseFileWriter(&base_file);
+    std::unique_ptr<TableBuilder> table_builder;
+    NewTableBuilder(base_file.get(), &table_builder);
+    const int n = 1000;
+    for (int i = 0; i < n; i++) {
+      char key[16];
+      snprintf(key, sizeof(key), "%04d", i);
+      InternalKey ikey(key, 1, kTypeValue);
+      table_builder->Add(ikey.Encode(),
+                         std::string(kMinBlobSize / 2 * (i % 7), 'a' + i % 26));
+    }
+    ASSERT_OK(table_builder->Finish());
+    ASSERT_EQ(n, table_builder->NumEntries());
+    ASSERT_OK(base_file->Sync(true));
+    ASSERT_OK(base_file->Close());
+    ASSERT_OK(ReadFileToString(env_, base_name_, base_data));
+    ASSERT_OK(ReadFileToString(env_, blob_name_, blob_data));
+  }
+
+  // Builds the table again with blob write threads, blob compression
+  // threads and both, and checks that the base table and the blob file
+  // are laid out the same as "base_data" and "blob_data" each time.
+  void CheckParallelBuild(const std::string& base_data,
+                          const std::string& blob_data) {
+    std::unique_ptr<ThreadPool> blob_write_pool(NewThreadPool(2));
+    std::unique_ptr<ThreadPool> blob_compression_pool(NewThreadPool(4));
+    const std::vector<std::pair<ThreadPool*, ThreadPool*>> pools = {
+        {blob_write_pool.get(), nullptr},
+        {nullptr, blob_compression_pool.get()},
+        {blob_write_pool.get(), blob_compression_pool.get()}};
+    std::vector<std::string> base_datas(pools.size());
+    std::vector<std::string> blob_datas(pools.size());
+    for (size_t i = 0; i < pools.size(); i++) {
+      ResetTableFactory(pools[i].first, pools[i].second);
+      BuildTable(&base_datas[i], &blob_datas[i]);
+    }
+    ResetTableFactory(nullptr, nullptr);
+    blob_write_pool->JoinAllThreads();
+    blob_compression_pool->JoinAllThreads();
+    for (size_t i = 0; i < pools.size(); i++) {
+      ASSERT_EQ(base_data, base_datas[i]);
+      ASSERT_EQ(blob_data, blob_datas[i]);
+    }
+  }
+
   port::Mutex mutex_;
 
   Env* env_{Env::Default()};
@@ -312,6 +366,161 @@ TEST_F(TableBuilderTest, NumEntries) {
   ASSERT_OK(table_builder->Finish());
 }
 
+TEST_F(TableBuilderTest, PendingEntries) {
+  // Blob records are held back to be packed into blocks, along with the
+  // entries following them.
+  cf_options_.blob_file_block_size = 4 << 10;
+  ResetTableFactory(nullptr, nullptr);
+  std::unique_ptr<WritableFileWriter> base_file;
+  NewBaseFileWriter(&base_file);
+  std::unique_ptr<TableBuilder> table_builder;
+  NewTableBuilder(base_file.get(), &table_builder);
+
+  // Pending entries are counted in the number of entries and the file
+  // size, which compaction cuts output files by.
+  const int n = 100;
+  uint64_t last_size = 0;
+  for (char i = 0; i < n; i++) {
+    std::string key(1, i);
+    InternalKey ikey(key, 1, kTypeValue);
+    table_builder->Add(ikey.Encode(), std::string(kMinBlobSize, i));
+    ASSERT_EQ(i + 1, table_builder->NumEntries());
+    ASSERT_GT(table_builder->FileSize(), last_size);
+    last_size = table_builder->FileSize();
+  }
+  ASSERT_OK(table_builder->Finish());
+  ASSERT_EQ(n, table_builder->NumEntries());
+}
+
+TEST_F(TableBuilderTest, PipelinedBlobWrite) {
+  std::string base_data;
+  std::string blob_data;
+  BuildTable(&base_data, &blob_data);
+
+  // Blob records written by other threads are laid out the same.
+  CheckParallelBuild(base_data, blob_data);
+}
+
+TEST_F(TableBuilderTest, ParallelBlobCompression) {
+  cf_options_.blob_file_compression = kLZ4Compression;
+  ResetTableFactory(nullptr, nullptr);
+  std::string base_data;
+  std::string blob_data;
+  BuildTable(&base_data, &blob_data);
+
+  // Blob records compressed in parallel are laid out the same, with or
+  // without blob write threads.
+  CheckParallelBuild(base_data, blob_data);
+}
+
+TEST_F(TableBuilderTest, BlobCompressionDict) {
+  if (!BlobCompressionDict::Supported()) {
+    return;
+  }
+  cf_options_.blob_file_compression = kZSTD;
+  cf_options_.blob_file_compression_options.max_dict_bytes = 4 << 10;
+  ResetTableFactory(nullptr, nullptr);
+  std::string base_data;
+  std::string blob_data;
+  BuildTable(&base_data, &blob_data);
+
+  // The dictionary is stored in the meta blocks of the blob file.
+  BlobFileFooter footer;
+  Slice encoded_footer(
+      blob_data.data() + blob_data.size() - BlobFileFooter::kEncodedLength,
+      BlobFileFooter::kEncodedLength);
+  ASSERT_OK(DecodeInto(encoded_footer, &footer));
+  ASSERT_GT(footer.meta_index_handle.size(), 0u);
+
+  std::unique_ptr<TableReader> base_reader;
+  NewTableReader(&base_reader);
+  std::unique_ptr<BlobFileReader> blob_reader;
+  NewBlobFileReader(&blob_reader);
+  ReadOptions ro;
+  std::unique_ptr<InternalIterator> iter(base_reader->NewIterator(ro, nullptr));
+  int num_blobs = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    if (ikey.type != kTypeBlobIndex) {
+      continue;
+    }
+    int i = atoi(ikey.user_key.ToString().c_str());
+    BlobIndex index;
+    ASSERT_OK(DecodeInto(iter->value(), &index));
+    BlobRecord record;
+    PinnableSlice buffer;
+    ASSERT_OK(blob_reader->Get(ro, index.blob_handle, &record, &buffer));
+    ASSERT_EQ(std::string(kMinBlobSize / 2 * (i % 7), 'a' + i % 26),
+              record.value);
+    num_blobs++;
+  }
+  ASSERT_GT(num_blobs, 0);
+
+  // Records held back for the dictionary are laid out the same with
+  // background threads.
+  CheckParallelBuild(base_data, blob_data);
+}
+
+TEST_F(TableBuilderTest, BlobBlock) {
+  cf_options_.blob_file_compression = kLZ4Compression;
+  cf_options_.blob_file_block_size = 4 << 10;
+  ResetTableFactory(nullptr, nullptr);
+  std::string base_data;
+  std::string blob_data;
+  BuildTable(&base_data, &blob_data);
+
+  std::unique_ptr<TableReader> base_reader;
+  NewTableReader(&base_reader);
+  std::unique_ptr<BlobFileReader> blob_reader;
+  NewBlobFileReader(&blob_reader);
+  ReadOptions ro;
+  std::unique_ptr<InternalIterator> iter(base_reader->NewIterator(ro, nullptr));
+  std::vector<int> keys;
+  std::vector<BlobIndex> indexes;
+  size_t num_packed = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+    if (ikey.type != kTypeBlobIndex) {
+      continue;
+    }
+    keys.push_back(atoi(ikey.user_key.ToString().c_str()));
+    indexes.emplace_back();
+    ASSERT_OK(DecodeInto(iter->value(), &indexes.back()));
+    if (indexes.back().blob_handle.packed()) {
+      num_packed++;
+    }
+  }
+  // Small records are packed into blocks.
+  ASSERT_GT(num_packed, keys.size() / 2);
+
+  std::vector<BlobRecord> records(keys.size());
+  std::vector<PinnableSlice> buffers(keys.size());
+  std::vector<Status> statuses(keys.size());
+  std::vector<BlobReadRequest> requests(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    BlobRecord record;
+    PinnableSlice buffer;
+    ASSERT_OK(blob_reader->Get(ro, indexes[i].blob_handle, &record, &buffer));
+    ASSERT_EQ(std::string(kMinBlobSize / 2 * (keys[i] % 7), 'a' + keys[i] % 26),
+              record.value);
+    requests[i].handle = &indexes[i].blob_handle;
+    requests[i].record = &records[i];
+    requests[i].buffer = &buffers[i];
+    requests[i].status = &statuses[i];
+  }
+  blob_reader->MultiGet(ro, &requests);
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_OK(statuses[i]);
+    ASSERT_EQ(std::string(kMinBlobSize / 2 * (keys[i] % 7), 'a' + keys[i] % 26),
+              records[i].value);
+  }
+
+  // Records are packed into the same blocks with background threads.
+  CheckParallelBuild(base_data, blob_data);
+}
+
 }  // namespace titandb
 }  // namespace rocksdb
 
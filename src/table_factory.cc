@@ -29,7 +29,8 @@ TableBuilder* TitanTableFactory::NewTableBuilder(
   }
   return new TitanTableBuilder(column_family_id, db_options_, cf_options,
                                std::move(base_builder), blob_manager_,
-                               blob_storage, stats_);
+                               blob_storage, stats_, blob_write_pool_,
+                               blob_compression_pool_);
 }
 
 std::string TitanTableFactory::GetPrintableTableOptions() const {
@@ -4,6 +4,7 @@
 
 #include "blob_file_manager.h"
 #include "rocksdb/table.h"
+#include "rocksdb/threadpool.h"
 #include "titan/options.h"
 #include "titan_stats.h"
 #include "version_set.h"
@@ -16,7 +17,9 @@ class TitanTableFactory : public TableFactory {
   TitanTableFactory(const TitanDBOptions& db_options,
                     const TitanCFOptions& cf_options,
                     std::shared_ptr<BlobFileManager> blob_manager,
-                    port::Mutex* db_mutex, VersionSet* vset, TitanStats* stats)
+                    port::Mutex* db_mutex, VersionSet* vset, TitanStats* stats,
+                    ThreadPool* blob_write_pool,
+                    ThreadPool* blob_compression_pool)
       : db_options_(db_options),
         cf_options_(cf_options),
         blob_run_mode_(cf_options.blob_run_mode),
@@ -24,7 +27,9 @@ class TitanTableFactory : public TableFactory {
         blob_manager_(blob_manager),
         db_mutex_(db_mutex),
         vset_(vset),
-        stats_(stats) {}
+        stats_(stats),
+        blob_write_pool_(blob_write_pool),
+        blob_compression_pool_(blob_compression_pool) {}
 
   const char* Name() const override { return "TitanTable"; }
 
@@ -69,6 +74,8 @@ class TitanTableFactory : public TableFactory {
   port::Mutex* db_mutex_;
   VersionSet* vset_;
   TitanStats* stats_;
+  ThreadPool* blob_write_pool_;
+  ThreadPool* blob_compression_pool_;
 };
 
 }  // namespace titandb
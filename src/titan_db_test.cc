@@ -6,6 +6,8 @@
 #include "blob_file_reader.h"
 #include "db_impl.h"
 #include "db_iter.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/slice_transform.h"
 #include "rocksdb/utilities/debug.h"
 #include "titan/db.h"
 #include "titan_fault_injection_test_env.h"
@@ -592,6 +594,785 @@ TEST_F(TitanDBTest, DBIterSeek) {
   }
 }
 
+TEST_F(TitanDBTest, BatchedMultiGet) {
+  const uint64_t kNumKeys = 100;
+  for (auto cache : {std::shared_ptr<Cache>(), NewLRUCache(1 << 20)}) {
+    options_.blob_cache = cache;
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    Open();
+    std::map<std::string, std::string> data;
+    // Spread the values over several blob files.
+    for (uint64_t k = 1; k <= kNumKeys; k++) {
+      Put(k, &data);
+      if (k % 25 == 0) {
+        Flush();
+      }
+    }
+
+    // Requests keys in reverse order, with some missing keys and
+    // duplicated keys.
+    std::vector<std::string> keys;
+    for (uint64_t k = kNumKeys + 10; k >= 1; k--) {
+      keys.emplace_back(GenKey(k));
+    }
+    keys.emplace_back(GenKey(1));
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    std::vector<ColumnFamilyHandle*> handles(keys.size(),
+                                             db_->DefaultColumnFamily());
+    std::vector<Status> statuses(keys.size());
+    std::unique_ptr<PinnableSlice[]> values(new PinnableSlice[keys.size()]);
+    db_->MultiGet(ReadOptions(), keys.size(), handles.data(),
+                  key_slices.data(), values.get(), statuses.data());
+    for (size_t i = 0; i < keys.size(); i++) {
+      auto it = data.find(keys[i]);
+      if (it == data.end()) {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      } else {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(values[i], it->second);
+      }
+    }
+    VerifyDB(data);
+    Close();
+  }
+}
+
+TEST_F(TitanDBTest, GetPinnedValue) {
+  for (auto cache : {std::shared_ptr<Cache>(), NewLRUCache(1 << 20)}) {
+    options_.blob_cache = cache;
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    Open();
+    std::map<std::string, std::string> data;
+    Put(1, &data);
+    Flush();
+    // The blob value is handed over to the caller without copying, both
+    // for the first read and the cache hit.
+    for (int i = 0; i < 2; i++) {
+      PinnableSlice value;
+      ASSERT_OK(db_->Get(ReadOptions(), db_->DefaultColumnFamily(),
+                         GenKey(1), &value));
+      ASSERT_TRUE(value.IsPinned());
+      ASSERT_EQ(value, data[GenKey(1)]);
+    }
+    Close();
+  }
+}
+
+TEST_F(TitanDBTest, BlobBufferPool) {
+  options_.disable_background_gc = true;
+  options_.blob_buffer_pool = NewBlobBufferPool(1 << 20);
+  Open();
+  std::map<std::string, std::string> data;
+  Put(1, &data);
+  Flush();
+  uint64_t hit = 0, miss = 0;
+  for (int i = 0; i < 2; i++) {
+    PinnableSlice value;
+    ASSERT_OK(db_->Get(ReadOptions(), db_->DefaultColumnFamily(), GenKey(1),
+                       &value));
+    ASSERT_EQ(value, data[GenKey(1)]);
+  }
+  // The read buffer of the first read is reused by the second one.
+  ASSERT_TRUE(
+      db_->GetIntProperty(TitanDB::Properties::kBlobBufferPoolHit, &hit));
+  ASSERT_TRUE(
+      db_->GetIntProperty(TitanDB::Properties::kBlobBufferPoolMiss, &miss));
+  ASSERT_EQ(1, hit);
+  ASSERT_EQ(1, miss);
+  VerifyDB(data);
+  Close();
+}
+
+TEST_F(TitanDBTest, BlobBufferPoolCacheCharge) {
+  options_.disable_background_gc = true;
+  options_.blob_buffer_pool = NewBlobBufferPool(1 << 20);
+  options_.blob_cache = NewLRUCache(1 << 20);
+  Open();
+  std::map<std::string, std::string> data;
+  // The value is slightly larger than 4KB, so its buffer takes 8KB.
+  Put(1, &data);
+  ASSERT_GT(data[GenKey(1)].size(), 4096);
+  Flush();
+  ASSERT_EQ(0, options_.blob_cache->GetUsage());
+  std::string value;
+  ASSERT_OK(db_->Get(ReadOptions(), GenKey(1), &value));
+  ASSERT_EQ(data[GenKey(1)], value);
+  // The cache is charged with the memory the buffer takes.
+  ASSERT_GE(options_.blob_cache->GetUsage(), 8192);
+  Close();
+}
+
+TEST_F(TitanDBTest, AsyncGet) {
+  options_.disable_background_gc = true;
+  for (int threads : {0, 4}) {
+    options_.async_read_threads = threads;
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    Open();
+    std::map<std::string, std::string> data;
+    const uint64_t kNumKeys = 100;
+    for (uint64_t k = 1; k <= kNumKeys; k++) {
+      Put(k, &data);
+    }
+    Flush();
+
+    port::Mutex mutex;
+    port::CondVar cv(&mutex);
+    uint64_t num_done = 0;
+    // Covers missing keys as well.
+    const uint64_t kNumReads = kNumKeys + 10;
+    std::unique_ptr<PinnableSlice[]> values(new PinnableSlice[kNumReads]);
+    std::unique_ptr<Status[]> statuses(new Status[kNumReads]);
+    for (uint64_t i = 0; i < kNumReads; i++) {
+      db_->AsyncGet(ReadOptions(), db_->DefaultColumnFamily(), GenKey(i + 1),
+                    &values[i], [&, i](const Status& s) {
+                      MutexLock l(&mutex);
+                      statuses[i] = s;
+                      num_done++;
+                      cv.SignalAll();
+                    });
+    }
+    {
+      MutexLock l(&mutex);
+      while (num_done < kNumReads) {
+        cv.Wait();
+      }
+    }
+    for (uint64_t i = 0; i < kNumReads; i++) {
+      if (i < kNumKeys) {
+        ASSERT_OK(statuses[i]);
+        ASSERT_EQ(data[GenKey(i + 1)], values[i]);
+      } else {
+        ASSERT_TRUE(statuses[i].IsNotFound());
+      }
+    }
+    Close();
+  }
+}
+
+TEST_F(TitanDBTest, IteratorBlobPrefetch) {
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  // Interleaves keys of several blob files.
+  for (uint64_t i = 0; i < 4; i++) {
+    for (uint64_t k = i; k < 200; k += 4) {
+      Put(k, &data);
+    }
+    Flush();
+  }
+  std::atomic<uint64_t> num_read_ahead{0};
+  std::atomic<uint64_t> num_reused{0};
+  SyncPoint::GetInstance()->SetCallBack(
+      "TitanDBIterator::ReadAhead", [&](void*) { num_read_ahead++; });
+  SyncPoint::GetInstance()->SetCallBack("TitanDBIterator::ReuseValue",
+                                        [&](void*) { num_reused++; });
+  SyncPoint::GetInstance()->EnableProcessing();
+
+  TitanReadOptions ropts;
+  ropts.blob_prefetch_depth = 8;
+  std::unique_ptr<Iterator> iter(db_->NewIterator(ropts));
+  auto expected = data.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(expected->first, iter->key());
+    ASSERT_EQ(expected->second, iter->value());
+    expected++;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_TRUE(expected == data.end());
+  // Every blob value (odd keys) is read ahead once, through one prefetcher
+  // per blob file.
+  uint64_t num_blobs = data.size() / 2;
+  ASSERT_EQ(num_blobs, num_read_ahead.load());
+  ASSERT_EQ(0, num_reused.load());
+  uint64_t created = 0;
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherCreated, &created));
+  ASSERT_EQ(4, created);
+
+  // Moves back and forth.
+  expected = data.find(GenKey(101));
+  iter->Seek(GenKey(101));
+  ASSERT_EQ(expected->second, iter->value());
+  for (int i = 0; i < 3; i++) {
+    iter->Prev();
+    expected--;
+    ASSERT_EQ(expected->first, iter->key());
+    ASSERT_EQ(expected->second, iter->value());
+  }
+  for (int i = 0; i < 20; i++) {
+    iter->Next();
+    expected++;
+    ASSERT_EQ(expected->first, iter->key());
+    ASSERT_EQ(expected->second, iter->value());
+  }
+  // The values read ahead of key 101 before moving backward are reused
+  // when moving forward again.
+  ASSERT_EQ(8, num_reused.load());
+  iter.reset();
+
+  SyncPoint::GetInstance()->DisableProcessing();
+  SyncPoint::GetInstance()->ClearAllCallBacks();
+  Close();
+}
+
+TEST_F(TitanDBTest, IteratorMaxBlobFilePrefetchers) {
+  options_.disable_background_gc = true;
+  options_.statistics = CreateDBStatistics();
+  Open();
+  std::map<std::string, std::string> data;
+  // Blob values of consecutive keys are spread over four blob files in
+  // turn.
+  for (uint64_t i = 0; i < 4; i++) {
+    for (uint64_t k = 0; k < 200; k++) {
+      if ((k / 2) % 4 == i) {
+        Put(k, &data);
+      }
+    }
+    Flush();
+  }
+  auto scan = [&](size_t max_blob_file_prefetchers) {
+    TitanReadOptions ropts;
+    ropts.max_blob_file_prefetchers = max_blob_file_prefetchers;
+    std::unique_ptr<Iterator> iter(db_->NewIterator(ropts));
+    auto expected = data.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(expected->first, iter->key());
+      ASSERT_EQ(expected->second, iter->value());
+      expected++;
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_TRUE(expected == data.end());
+  };
+  uint64_t created = 0;
+  uint64_t evicted = 0;
+  scan(4);
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherCreated, &created));
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherEvicted, &evicted));
+  ASSERT_EQ(4, created);
+  ASSERT_EQ(0, evicted);
+
+  // The files are read in turn, so every blob value is read with a new
+  // prefetcher when only two of them are kept.
+  scan(2);
+  uint64_t num_blobs = data.size() / 2;
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherCreated, &created));
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherEvicted, &evicted));
+  ASSERT_EQ(4 + num_blobs, created);
+  ASSERT_EQ(num_blobs - 2, evicted);
+  Close();
+}
+
+TEST_F(TitanDBTest, ScanBatch) {
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  // Interleaves keys of several blob files.
+  for (uint64_t i = 0; i < 4; i++) {
+    for (uint64_t k = i; k < 200; k += 4) {
+      Put(k, &data);
+    }
+    Flush();
+  }
+
+  std::map<std::string, std::string> result;
+  size_t num_batches = 0;
+  auto collect = [&](const std::vector<Slice>& keys,
+                     const std::vector<Slice>& values) {
+    EXPECT_EQ(keys.size(), values.size());
+    EXPECT_LE(keys.size(), 7u);
+    for (size_t i = 0; i < keys.size(); i++) {
+      // Keys are delivered in order.
+      if (!result.empty()) {
+        EXPECT_LT(result.rbegin()->first, keys[i].ToString());
+      }
+      result.emplace(keys[i].ToString(), values[i].ToString());
+    }
+    num_batches++;
+    return Status::OK();
+  };
+  ASSERT_OK(db_->ScanBatch(TitanReadOptions(), RangePtr(), 7, collect));
+  ASSERT_TRUE(data == result);
+  ASSERT_EQ((data.size() + 6) / 7, num_batches);
+
+  result.clear();
+  std::string start = GenKey(50);
+  std::string limit = GenKey(150);
+  Slice start_slice(start);
+  Slice limit_slice(limit);
+  ASSERT_OK(db_->ScanBatch(TitanReadOptions(),
+                           RangePtr(&start_slice, &limit_slice), 7, collect));
+  ASSERT_TRUE(std::map<std::string, std::string>(data.find(start),
+                                                 data.find(limit)) == result);
+
+  // The scan stops at the first failure of the callback.
+  num_batches = 0;
+  Status s = db_->ScanBatch(
+      TitanReadOptions(), RangePtr(), 7,
+      [&](const std::vector<Slice>&, const std::vector<Slice>&) {
+        num_batches++;
+        return Status::Aborted();
+      });
+  ASSERT_TRUE(s.IsAborted());
+  ASSERT_EQ(1, num_batches);
+
+  ASSERT_TRUE(db_->ScanBatch(TitanReadOptions(), RangePtr(), 0, collect)
+                  .IsInvalidArgument());
+  Close();
+}
+
+TEST_F(TitanDBTest, ParallelScan) {
+  options_.disable_background_gc = true;
+  options_.disable_auto_compactions = true;
+  Open();
+  std::map<std::string, std::string> data;
+  // Each flush writes an SST file of a disjoint key range.
+  for (uint64_t i = 0; i < 8; i++) {
+    for (uint64_t k = i * 50; k < (i + 1) * 50; k++) {
+      Put(k, &data);
+    }
+    Flush();
+  }
+
+  port::Mutex mutex;
+  std::map<size_t, std::map<std::string, std::string>> partitions;
+  TitanDB::ParallelScanResult result;
+  ASSERT_OK(db_->ParallelScan(
+      TitanReadOptions(), db_->DefaultColumnFamily(), 4,
+      [&](size_t partition, const Slice& key, const Slice& value) {
+        MutexLock l(&mutex);
+        auto& entries = partitions[partition];
+        // Entries of a range are delivered in order.
+        if (!entries.empty()) {
+          EXPECT_LT(entries.rbegin()->first, key.ToString());
+        }
+        entries.emplace(key.ToString(), value.ToString());
+        return Status::OK();
+      },
+      &result));
+  ASSERT_EQ(8, result.num_partitions);
+  ASSERT_EQ(data.size(), result.num_keys);
+  // Ranges are numbered in key order and cover all the keys.
+  std::map<std::string, std::string> scanned;
+  for (auto& partition : partitions) {
+    ASSERT_LT(partition.first, result.num_partitions);
+    if (!scanned.empty()) {
+      ASSERT_LT(scanned.rbegin()->first, partition.second.begin()->first);
+    }
+    scanned.insert(partition.second.begin(), partition.second.end());
+  }
+  ASSERT_TRUE(data == scanned);
+
+  // The scan stops at the first failure of the callback.
+  Status s = db_->ParallelScan(
+      TitanReadOptions(), db_->DefaultColumnFamily(), 4,
+      [](size_t, const Slice&, const Slice&) { return Status::Aborted(); },
+      &result);
+  ASSERT_TRUE(s.IsAborted());
+  ASSERT_EQ(0, result.num_keys);
+  Close();
+}
+
+TEST_F(TitanDBTest, ExportInBlobFileOrder) {
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (uint64_t i = 0; i < 4; i++) {
+    for (uint64_t k = i; k < 200; k += 4) {
+      Put(k, &data);
+    }
+    Flush();
+  }
+  // Leaves stale records of overwritten and deleted keys in blob files.
+  for (uint64_t k = 0; k < 200; k += 3) {
+    Put(k, &data);
+  }
+  for (uint64_t k = 0; k < 200; k += 5) {
+    ASSERT_OK(db_->Delete(WriteOptions(), GenKey(k)));
+    data.erase(GenKey(k));
+  }
+  Flush();
+
+  for (uint64_t readahead_size : {0, 8 << 10}) {
+    TitanReadOptions ropts;
+    ropts.readahead_size = readahead_size;
+    std::map<std::string, std::string> result;
+    std::map<uint64_t, std::string> last_keys;
+    size_t num_entries = 0;
+    ASSERT_OK(db_->ExportInBlobFileOrder(
+        ropts, db_->DefaultColumnFamily(),
+        [&](uint64_t blob_file_number, const Slice& key, const Slice& value) {
+          // Entries of a blob file come in key order.
+          auto& last_key = last_keys[blob_file_number];
+          EXPECT_LT(last_key, key.ToString());
+          last_key = key.ToString();
+          result.emplace(key.ToString(), value.ToString());
+          num_entries++;
+          return Status::OK();
+        }));
+    ASSERT_EQ(data.size(), num_entries);
+    ASSERT_TRUE(data == result);
+  }
+  Close();
+}
+
+TEST_F(TitanDBTest, ExportInBlobFileOrderSeparateBlobOnWrite) {
+  options_.disable_background_gc = true;
+  options_.separate_blob_on_write = true;
+  Open();
+  std::map<std::string, std::string> data;
+  // Values are appended to the value log in descending key order, and
+  // some of them are overwritten.
+  for (uint64_t k = 200; k > 0; k--) {
+    Put(k, &data);
+  }
+  for (uint64_t k = 1; k <= 200; k += 3) {
+    Put(k, &data);
+  }
+  Flush();
+
+  auto export_and_check = [&]() {
+    std::map<std::string, std::string> result;
+    std::map<uint64_t, std::string> last_keys;
+    size_t num_entries = 0;
+    ASSERT_OK(db_->ExportInBlobFileOrder(
+        TitanReadOptions(), db_->DefaultColumnFamily(),
+        [&](uint64_t blob_file_number, const Slice& key, const Slice& value) {
+          // Entries of a blob file come in key order.
+          auto& last_key = last_keys[blob_file_number];
+          EXPECT_LT(last_key, key.ToString());
+          last_key = key.ToString();
+          result.emplace(key.ToString(), value.ToString());
+          num_entries++;
+          return Status::OK();
+        }));
+    ASSERT_EQ(data.size(), num_entries);
+    ASSERT_TRUE(data == result);
+  };
+  // The export seals the value log.
+  export_and_check();
+  // The sealed blob file is known to be unsorted after reopening.
+  Reopen();
+  export_and_check();
+  Close();
+}
+
+TEST_F(TitanDBTest, IteratorRefresh) {
+  options_.disable_background_gc = true;
+  options_.statistics = CreateDBStatistics();
+  Open();
+  std::map<std::string, std::string> data;
+  // Writes two blob files.
+  for (uint64_t i = 0; i < 2; i++) {
+    for (uint64_t k = 0; k < 100; k++) {
+      if ((k / 2) % 2 == i) {
+        Put(k, &data);
+      }
+    }
+    Flush();
+  }
+  auto verify = [&](Iterator* iter) {
+    auto expected = data.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      ASSERT_EQ(expected->first, iter->key());
+      ASSERT_EQ(expected->second, iter->value());
+      expected++;
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_TRUE(expected == data.end());
+  };
+  std::unique_ptr<Iterator> iter(db_->NewIterator(TitanReadOptions()));
+  verify(iter.get());
+  uint64_t created = 0;
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherCreated, &created));
+  ASSERT_EQ(2, created);
+
+  for (uint64_t k = 100; k < 150; k++) {
+    Put(k, &data);
+  }
+  Flush();
+  ASSERT_OK(iter->Refresh());
+  verify(iter.get());
+  // Only the new blob file needs a new prefetcher.
+  ASSERT_TRUE(db_->GetIntProperty(
+      TitanDB::Properties::kNumIterPrefetcherCreated, &created));
+  ASSERT_EQ(3, created);
+  iter.reset();
+
+  // An iterator created with a snapshot of the caller keeps reading it.
+  ManagedSnapshot snapshot(db_);
+  TitanReadOptions ropts;
+  ropts.snapshot = snapshot.snapshot();
+  iter.reset(db_->NewIterator(ropts));
+  auto snapshot_data = data;
+  Put(200, &data);
+  Flush();
+  ASSERT_TRUE(iter->Refresh().IsNotSupported());
+  std::swap(data, snapshot_data);
+  verify(iter.get());
+  std::swap(data, snapshot_data);
+
+  // A refreshed iterator reads blob values with its new snapshot, after
+  // the one it was created with is released.
+  iter.reset(db_->NewIterator(TitanReadOptions()));
+  Put(201, &data);
+  Flush();
+  ASSERT_OK(iter->Refresh());
+  verify(iter.get());
+  iter.reset();
+  Close();
+}
+
+TEST_F(TitanDBTest, PrefixSeek) {
+  BlockBasedTableOptions table_options;
+  table_options.filter_policy.reset(NewBloomFilterPolicy(10, false));
+  table_options.whole_key_filtering = false;
+  options_.table_factory.reset(NewBlockBasedTableFactory(table_options));
+  options_.prefix_extractor.reset(NewFixedPrefixTransform(4));
+  options_.statistics = CreateDBStatistics();
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (auto prefix : {"aaaa", "bbbb", "dddd"}) {
+    for (int i = 0; i < 10; i++) {
+      auto key = prefix + ToString(i);
+      data[key] = std::string(options_.min_blob_size + i, 'v');
+      ASSERT_OK(db_->Put(WriteOptions(), key, data[key]));
+    }
+  }
+  Flush();
+
+  TitanReadOptions ropts;
+  ropts.prefix_same_as_start = true;
+  std::unique_ptr<Iterator> iter(db_->NewIterator(ropts));
+  int count = 0;
+  for (iter->Seek("bbbb"); iter->Valid(); iter->Next()) {
+    ASSERT_TRUE(iter->key().starts_with("bbbb"));
+    ASSERT_EQ(data[iter->key().ToString()], iter->value());
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  ASSERT_EQ(10, count);
+
+  // The prefix bloom filter skips the missing prefix.
+  auto useful = options_.statistics->getTickerCount(BLOOM_FILTER_PREFIX_USEFUL);
+  iter->Seek("cccc");
+  ASSERT_FALSE(iter->Valid());
+  ASSERT_GT(options_.statistics->getTickerCount(BLOOM_FILTER_PREFIX_USEFUL),
+            useful);
+
+  // Total order seek is used by default.
+  iter.reset(db_->NewIterator(ReadOptions()));
+  iter->Seek("cccc");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ("dddd0", iter->key());
+  iter.reset();
+
+  std::vector<std::string> values;
+  auto statuses = db_->MultiGet(ReadOptions(), {"aaaa1", "cccc1", "dddd9"},
+                                &values);
+  ASSERT_OK(statuses[0]);
+  ASSERT_EQ(data["aaaa1"], values[0]);
+  ASSERT_TRUE(statuses[1].IsNotFound());
+  ASSERT_OK(statuses[2]);
+  ASSERT_EQ(data["dddd9"], values[2]);
+  Close();
+}
+
+TEST_F(TitanDBTest, FillCache) {
+  auto cache = NewLRUCache(1 << 20);
+  options_.blob_cache = cache;
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (uint64_t k = 1; k <= 10; k++) {
+    Put(k, &data);
+  }
+  Flush();
+  ReadOptions ropts;
+  ropts.fill_cache = false;
+  VerifyDB(data, ropts);
+  ASSERT_EQ(0, cache->GetUsage());
+  VerifyDB(data);
+  ASSERT_GT(cache->GetUsage(), 0);
+  Close();
+}
+
+TEST_F(TitanDBTest, BlobCacheAdmissionFilter) {
+  // The cache fits only a few records.
+  uint64_t record_size = options_.min_blob_size + 1024;
+  auto cache = NewLRUCache(4 * record_size, 0 /* num_shard_bits */);
+  options_.blob_cache = cache;
+  options_.blob_cache_admission_filter = NewBlobCacheAdmissionFilter(1024);
+  options_.statistics = CreateDBStatistics();
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (uint64_t k = 1; k <= 200; k++) {
+    Put(k, &data);
+  }
+  Flush();
+  auto get = [&](uint64_t k) {
+    PinnableSlice value;
+    ASSERT_OK(db_->Get(ReadOptions(), db_->DefaultColumnFamily(), GenKey(k),
+                       &value));
+    ASSERT_EQ(value, data[GenKey(k)]);
+  };
+  // Records with odd keys are stored in blob files.
+  for (uint64_t k = 1; k <= 7; k += 2) {
+    get(k);
+    get(k);
+  }
+  // Cold records read once don't evict the hot ones.
+  for (uint64_t k = 9; k <= 200; k += 2) {
+    get(k);
+  }
+  // Blocks of the base DB are all cached by now, so a miss can only come
+  // from the blob cache.
+  auto miss = options_.statistics->getTickerCount(BLOCK_CACHE_DATA_MISS);
+  get(1);
+  ASSERT_EQ(miss, options_.statistics->getTickerCount(BLOCK_CACHE_DATA_MISS));
+  Close();
+}
+
+TEST_F(TitanDBTest, BlobPersistentCache) {
+  {
+    // Skips the test if the file system doesn't provide unique ids of
+    // files, which are required to cache records persistently.
+    ASSERT_OK(env_->CreateDirIfMissing(dbname_));
+    std::string fname = dbname_ + "/unique_id_test";
+    ASSERT_OK(WriteStringToFile(env_, "unique_id_test", fname));
+    std::unique_ptr<RandomAccessFile> file;
+    ASSERT_OK(env_->NewRandomAccessFile(fname, &file, EnvOptions()));
+    char id[kMaxVarint64Length * 3 + 1];
+    size_t id_size = file->GetUniqueId(id, sizeof(id));
+    file.reset();
+    ASSERT_OK(env_->DeleteFile(fname));
+    if (id_size == 0) {
+      fprintf(stderr, "File unique id is not supported, skip the test.\n");
+      return;
+    }
+  }
+  options_.disable_background_gc = true;
+  BlobPersistentCacheOptions cache_options;
+  cache_options.path = dbname_ + "/blob_persistent_cache";
+  cache_options.admission_control = false;
+  for (auto cache : {std::shared_ptr<Cache>(), NewLRUCache(1 << 20)}) {
+    options_.blob_cache = cache;
+    DeleteDir(env_, cache_options.path);
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    ASSERT_OK(NewBlobPersistentCache(cache_options,
+                                     &options_.blob_persistent_cache));
+    Open();
+    std::map<std::string, std::string> data;
+    for (uint64_t k = 1; k <= 10; k++) {
+      Put(k, &data);
+    }
+    Flush();
+    VerifyDB(data);
+    if (cache) {
+      // Records are written to the persistent cache when evicted from the
+      // blob cache.
+      options_.blob_persistent_cache->WaitForWrites();
+      ASSERT_EQ(0, options_.blob_persistent_cache->GetUsage());
+      cache->EraseUnRefEntries();
+    }
+    options_.blob_persistent_cache->WaitForWrites();
+    ASSERT_GT(options_.blob_persistent_cache->GetUsage(), 0);
+    VerifyDB(data);
+    Close();
+  }
+}
+
+TEST_F(TitanDBTest, MmapReads) {
+  options_.allow_mmap_reads = true;
+  options_.disable_background_gc = true;
+  options_.merge_small_file_threshold = 1U << 30;
+  for (auto cache : {std::shared_ptr<Cache>(), NewLRUCache(1 << 20)}) {
+    options_.blob_cache = cache;
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    Open();
+    std::map<std::string, std::string> data;
+    Put(1, &data);
+    Put(2, &data);
+    Flush();
+    PinnableSlice value;
+    ASSERT_OK(db_->Get(ReadOptions(), db_->DefaultColumnFamily(), GenKey(1),
+                       &value));
+    ASSERT_TRUE(value.IsPinned());
+    ASSERT_EQ(value, data[GenKey(1)]);
+    VerifyDB(data);
+
+    // GC the blob file and purge it. The pinned value is still valid after
+    // the file is evicted from the file cache and deleted.
+    ASSERT_OK(db_->Delete(WriteOptions(), GenKey(2)));
+    data.erase(GenKey(2));
+    Flush();
+    ASSERT_OK(db_impl_->TEST_StartGC(db_->DefaultColumnFamily()->GetID()));
+    ASSERT_OK(db_impl_->TEST_PurgeObsoleteFiles());
+    ASSERT_EQ(1, GetBlobStorage().lock()->NumBlobFiles());
+    ASSERT_EQ(value, data[GenKey(1)]);
+    value.Reset();
+    VerifyDB(data);
+    Close();
+  }
+}
+
+TEST_F(TitanDBTest, DirectIO) {
+  {
+    // Skips the test if the file system doesn't support direct I/O.
+    ASSERT_OK(env_->CreateDirIfMissing(dbname_));
+    std::string fname = dbname_ + "/direct_io_test";
+    EnvOptions env_options;
+    env_options.use_direct_writes = true;
+    std::unique_ptr<WritableFile> file;
+    Status s = env_->NewWritableFile(fname, &file, env_options);
+    if (!s.ok()) {
+      fprintf(stderr, "Direct I/O is not supported, skip the test.\n");
+      return;
+    }
+    file.reset();
+    ASSERT_OK(env_->DeleteFile(fname));
+  }
+  options_.use_direct_reads = true;
+  options_.use_direct_io_for_flush_and_compaction = true;
+  for (auto cache : {std::shared_ptr<Cache>(), NewLRUCache(1 << 20)}) {
+    options_.blob_cache = cache;
+    DeleteDir(env_, options_.dirname);
+    DeleteDir(env_, dbname_);
+    Open();
+    std::map<std::string, std::string> data;
+    for (uint64_t k = 1; k <= 100; k++) {
+      Put(k, &data);
+    }
+    Flush();
+    VerifyDB(data);
+    Reopen();
+    VerifyDB(data);
+
+    // GC reads the blob files with direct I/O too.
+    for (uint64_t k = 1; k <= 60; k++) {
+      ASSERT_OK(db_->Delete(WriteOptions(), GenKey(k)));
+      data.erase(GenKey(k));
+    }
+    Flush();
+    CompactAll();
+    ASSERT_OK(db_impl_->TEST_StartGC(db_->DefaultColumnFamily()->GetID()));
+    ASSERT_OK(db_impl_->TEST_PurgeObsoleteFiles());
+    VerifyDB(data);
+    Close();
+  }
+}
+
 TEST_F(TitanDBTest, Snapshot) {
   Open();
   std::map<std::string, std::string> data;
@@ -608,6 +1389,39 @@ TEST_F(TitanDBTest, Snapshot) {
   db_->ReleaseSnapshot(snapshot);
 }
 
+TEST_F(TitanDBTest, GetWithoutSnapshotPinsBlobFile) {
+  options_.disable_background_gc = true;
+  options_.merge_small_file_threshold = 1U << 30;
+  options_.min_blob_size = 0;
+  Open();
+  ASSERT_OK(db_->Put(WriteOptions(), "foo", "v1"));
+  ASSERT_OK(db_->Put(WriteOptions(), "bar", "v1"));
+  ASSERT_OK(db_->Flush(FlushOptions()));
+  auto storage = GetBlobStorage().lock();
+  ASSERT_EQ(1, storage->NumBlobFiles());
+  uint64_t file_number = storage->TEST_GetAllFiles().begin()->first;
+
+  // Pin the file as a read without snapshot does.
+  auto file = storage->PinFile(file_number);
+  ASSERT_TRUE(file != nullptr);
+
+  ASSERT_OK(db_->Delete(WriteOptions(), "foo"));
+  ASSERT_OK(db_->Flush(FlushOptions()));
+  uint32_t default_cf_id = db_->DefaultColumnFamily()->GetID();
+  ASSERT_OK(db_impl_->TEST_StartGC(default_cf_id));
+  ASSERT_EQ(2, storage->NumBlobFiles());
+  // The obsolete file is kept while it is pinned.
+  ASSERT_OK(db_impl_->TEST_PurgeObsoleteFiles());
+  ASSERT_EQ(2, storage->NumBlobFiles());
+  file->Unpin();
+  ASSERT_OK(db_impl_->TEST_PurgeObsoleteFiles());
+  ASSERT_EQ(1, storage->NumBlobFiles());
+  // A purged file can't be pinned again.
+  ASSERT_FALSE(file->Pin());
+  ASSERT_TRUE(storage->PinFile(file_number) == nullptr);
+  VerifyDB({{"bar", "v1"}});
+}
+
 TEST_F(TitanDBTest, IngestExternalFiles) {
   Open();
   SstFileWriter sst_file_writer(EnvOptions(), options_);
@@ -866,6 +1680,42 @@ TEST_F(TitanDBTest, BlobFileIOError) {
   db_ = nullptr;
 }
 
+TEST_F(TitanDBTest, LazyBlobValue) {
+  options_.disable_background_gc = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (uint64_t k = 1; k <= 100; k++) {
+    Put(k, &data);
+  }
+  Flush();
+
+  std::atomic<int> num_reads{0};
+  SyncPoint::GetInstance()->SetCallBack(
+      "BlobFileReader::Get", [&](void*) { num_reads++; });
+  SyncPoint::GetInstance()->EnableProcessing();
+  TitanReadOptions ropts;
+  ropts.lazy_blob_value = true;
+  std::unique_ptr<Iterator> iter(db_->NewIterator(ropts));
+  int num_values = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    // Takes the values of the first few keys only.
+    if (iter->key().ToString() < GenKey(10)) {
+      ASSERT_EQ(data[iter->key().ToString()], iter->value());
+      // Reads once for the same entry.
+      ASSERT_EQ(data[iter->key().ToString()], iter->value());
+      num_values++;
+    }
+  }
+  ASSERT_OK(iter->status());
+  SyncPoint::GetInstance()->DisableProcessing();
+  SyncPoint::GetInstance()->ClearAllCallBacks();
+  ASSERT_EQ(9, num_values);
+  // Only values of odd keys are stored in blob files.
+  ASSERT_EQ(5, num_reads.load());
+  iter.reset();
+  Close();
+}
+
 TEST_F(TitanDBTest, FlushWriteIOErrorHandling) {
   std::unique_ptr<TitanFaultInjectionTestEnv> mock_env(
       new TitanFaultInjectionTestEnv(env_));
@@ -1105,6 +1955,158 @@ TEST_F(TitanDBTest, BlobRunModeBasic) {
   version.clear();
 }
 
+TEST_F(TitanDBTest, SeparateBlobOnWrite) {
+  options_.separate_blob_on_write = true;
+  Open();
+  auto list_value_logs = [&]() {
+    std::vector<std::string> filenames;
+    std::vector<std::string> value_logs;
+    env_->GetChildren(options_.dirname, &filenames);
+    uint32_t cf_id = 0;
+    uint64_t number = 0;
+    for (auto& fname : filenames) {
+      if (ParseValueLogFileName(fname, &cf_id, &number)) {
+        value_logs.push_back(options_.dirname + "/" + fname);
+      }
+    }
+    return value_logs;
+  };
+
+  const uint64_t kNumKeys = 100;
+  std::map<std::string, std::string> data;
+  for (uint64_t k = 1; k <= kNumKeys; k++) {
+    Put(k, &data);
+  }
+  WriteBatch batch;
+  for (uint64_t k = kNumKeys + 1; k <= kNumKeys * 2; k++) {
+    ASSERT_OK(batch.Put(GenKey(k), GenValue(k)));
+    data.emplace(GenKey(k), GenValue(k));
+  }
+  ASSERT_OK(db_->Write(WriteOptions(), &batch));
+
+  // Large values are separated before flush, and read from the value log.
+  std::vector<KeyVersion> versions;
+  GetAllKeyVersions(db_, GenKey(1), GenKey(kNumKeys * 2), kNumKeys * 2,
+                    &versions);
+  ASSERT_EQ(kNumKeys * 2, versions.size());
+  for (auto& v : versions) {
+    if (data[v.user_key].size() >= options_.min_blob_size) {
+      ASSERT_EQ(v.type, static_cast<int>(ValueType::kTypeBlobIndex));
+    } else {
+      ASSERT_EQ(v.type, static_cast<int>(ValueType::kTypeValue));
+    }
+  }
+  VerifyDB(data);
+  ASSERT_EQ(1, list_value_logs().size());
+  ASSERT_EQ(0, GetBlobStorage().lock()->NumBlobFiles());
+
+  // Flush doesn't write blob files for separated values.
+  Flush();
+  VerifyDB(data);
+  ASSERT_EQ(0, GetBlobStorage().lock()->NumBlobFiles());
+
+  // The value log is sealed on close.
+  Reopen();
+  VerifyDB(data);
+  ASSERT_EQ(0, list_value_logs().size());
+  ASSERT_EQ(1, GetBlobStorage().lock()->NumBlobFiles());
+
+  // An unsealed value log is sealed with its valid records on recovery.
+  for (uint64_t k = kNumKeys * 2 + 1; k <= kNumKeys * 3; k++) {
+    Put(k, &data);
+  }
+  // Drops the value log without sealing it, as if the DB crashed.
+  db_impl_->TEST_AbandonValueLogs();
+  Close();
+  auto value_logs = list_value_logs();
+  ASSERT_EQ(1, value_logs.size());
+  std::string content;
+  ASSERT_OK(ReadFileToString(env_, value_logs[0], &content));
+  content.append("garbage");
+  ASSERT_OK(WriteStringToFile(env_, content, value_logs[0]));
+  Open();
+  VerifyDB(data);
+  ASSERT_EQ(0, list_value_logs().size());
+  ASSERT_EQ(2, GetBlobStorage().lock()->NumBlobFiles());
+}
+
+TEST_F(TitanDBTest, SeparateBlobOnWriteSyncOnFlush) {
+  std::unique_ptr<TitanFaultInjectionTestEnv> mock_env(
+      new TitanFaultInjectionTestEnv(env_));
+  options_.env = mock_env.get();
+  options_.separate_blob_on_write = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (uint64_t k = 1; k <= 100; k++) {
+    Put(k, &data);
+  }
+  // Records of the value log are written without sync, but are synced
+  // before the flushed SST pointing to them replaces the WAL.
+  Flush();
+  // Drops the value log without sealing it, as if the DB crashed.
+  db_impl_->TEST_AbandonValueLogs();
+  Close();
+  ASSERT_OK(mock_env->DropUnsyncedFileData());
+  Open();
+  VerifyDB(data);
+
+  options_.env = env_;
+  // env must be destructed AFTER db is closed to avoid
+  // `pure abstract method called` complaint.
+  Close();
+}
+
+TEST_F(TitanDBTest, SeparateBlobOnWriteDiscardableSize) {
+  options_.disable_background_gc = true;
+  options_.separate_blob_on_write = true;
+  Open();
+  std::map<std::string, std::string> data;
+  for (int i = 0; i < 2; i++) {
+    for (uint64_t k = 1; k <= 100; k++) {
+      Put(k, &data);
+    }
+    Flush();
+  }
+  // Compaction drops the records written first while the value log is
+  // still being written.
+  CompactAll();
+  ASSERT_OK(db_impl_->GetValueLog(db_->DefaultColumnFamily()->GetID())
+                ->Seal());
+  auto storage = GetBlobStorage().lock();
+  ASSERT_EQ(1, storage->NumBlobFiles());
+  auto files = storage->TEST_GetAllFiles();
+  auto& file = files.begin()->second;
+  ASSERT_GT(file.discardable_size(), 0);
+  ASSERT_LT(file.discardable_size(), static_cast<int64_t>(file.file_size()));
+  VerifyDB(data);
+  Close();
+}
+
+TEST_F(TitanDBTest, SeparateBlobOnWriteOverwriteBeforeFlush) {
+  options_.disable_background_gc = true;
+  options_.separate_blob_on_write = true;
+  Open();
+  std::map<std::string, std::string> data;
+  // Records written first are overwritten in the memtable, so they are
+  // never referenced by SSTs.
+  for (int i = 0; i < 2; i++) {
+    for (uint64_t k = 1; k <= 100; k++) {
+      Put(k, &data);
+    }
+  }
+  Flush();
+  ASSERT_OK(db_impl_->GetValueLog(db_->DefaultColumnFamily()->GetID())
+                ->Seal());
+  auto storage = GetBlobStorage().lock();
+  ASSERT_EQ(1, storage->NumBlobFiles());
+  auto files = storage->TEST_GetAllFiles();
+  auto& file = files.begin()->second;
+  ASSERT_GT(file.discardable_size(), 0);
+  ASSERT_LT(file.discardable_size(), static_cast<int64_t>(file.file_size()));
+  VerifyDB(data);
+  Close();
+}
+
 TEST_F(TitanDBTest, FallbackModeEncounterMissingBlobFile) {
   options_.disable_background_gc = true;
   options_.merge_small_file_threshold = 1U << 30;
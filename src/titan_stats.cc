@@ -14,6 +14,12 @@ static const std::string num_live_blob_file = "num-live-blob-file";
 static const std::string num_obsolete_blob_file = "num-obsolete-blob-file";
 static const std::string live_blob_file_size = "live-blob-file-size";
 static const std::string obsolete_blob_file_size = "obsolete-blob-file-size";
+static const std::string num_iter_prefetcher_created =
+    "num-iter-prefetcher-created";
+static const std::string num_iter_prefetcher_evicted =
+    "num-iter-prefetcher-evicted";
+static const std::string blob_buffer_pool_hit = "blob-buffer-pool-hit";
+static const std::string blob_buffer_pool_miss = "blob-buffer-pool-miss";
 
 const std::string TitanDB::Properties::kLiveBlobSize =
     titandb_prefix + live_blob_size;
@@ -25,6 +31,14 @@ const std::string TitanDB::Properties::kLiveBlobFileSize =
     titandb_prefix + live_blob_file_size;
 const std::string TitanDB::Properties::kObsoleteBlobFileSize =
     titandb_prefix + obsolete_blob_file_size;
+const std::string TitanDB::Properties::kNumIterPrefetcherCreated =
+    titandb_prefix + num_iter_prefetcher_created;
+const std::string TitanDB::Properties::kNumIterPrefetcherEvicted =
+    titandb_prefix + num_iter_prefetcher_evicted;
+const std::string TitanDB::Properties::kBlobBufferPoolHit =
+    titandb_prefix + blob_buffer_pool_hit;
+const std::string TitanDB::Properties::kBlobBufferPoolMiss =
+    titandb_prefix + blob_buffer_pool_miss;
 
 const std::unordered_map<std::string, TitanInternalStats::StatsType>
     TitanInternalStats::stats_type_string_map = {
@@ -38,6 +52,10 @@ const std::unordered_map<std::string, TitanInternalStats::StatsType>
          TitanInternalStats::LIVE_BLOB_FILE_SIZE},
         {TitanDB::Properties::kObsoleteBlobFileSize,
          TitanInternalStats::OBSOLETE_BLOB_FILE_SIZE},
+        {TitanDB::Properties::kNumIterPrefetcherCreated,
+         TitanInternalStats::NUM_ITER_PREFETCHER_CREATED},
+        {TitanDB::Properties::kNumIterPrefetcherEvicted,
+         TitanInternalStats::NUM_ITER_PREFETCHER_EVICTED},
 };
 
 }  // namespace titandb
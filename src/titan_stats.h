@@ -22,6 +22,8 @@ class TitanInternalStats {
     NUM_OBSOLETE_BLOB_FILE,
     LIVE_BLOB_FILE_SIZE,
     OBSOLETE_BLOB_FILE_SIZE,
+    NUM_ITER_PREFETCHER_CREATED,
+    NUM_ITER_PREFETCHER_EVICTED,
     INTERNAL_STATS_ENUM_MAX,
   };
   void Clear() {
@@ -1,5 +1,11 @@
 #include "util.h"
 
+#include <limits>
+
+#include "titan/options.h"
+#include "util/coding.h"
+#include "util/mutexlock.h"
+
 namespace rocksdb {
 namespace titandb {
 
@@ -12,7 +18,8 @@ bool GoodCompressionRatio(size_t compressed_size, size_t raw_size) {
 }
 
 Slice Compress(const CompressionContext& ctx, const Slice& input,
-               std::string* output, CompressionType* type) {
+               std::string* output, CompressionType* type,
+               const BlobCompressionDict* dict) {
   *type = ctx.type();
   if (ctx.type() == kNoCompression) {
     return input;
@@ -64,7 +71,8 @@ Slice Compress(const CompressionContext& ctx, const Slice& input,
       break;
     case kZSTD:
     case kZSTDNotFinalCompression:
-      if (ZSTD_Compress(ctx, input.data(), input.size(), output) &&
+      if ((dict ? dict->Compress(input, output)
+                : ZSTD_Compress(ctx, input.data(), input.size(), output)) &&
           GoodCompressionRatio(output->size(), input.size())) {
         return *output;
       }
@@ -79,7 +87,8 @@ Slice Compress(const CompressionContext& ctx, const Slice& input,
 }
 
 Status Uncompress(const UncompressionContext& ctx, const Slice& input,
-                  OwnedSlice* output) {
+                  OwnedSlice* output, MemoryAllocator* allocator,
+                  const BlobCompressionDict* dict) {
   int size = 0;
   CacheAllocationPtr ubuf;
   assert(ctx.type() != kNoCompression);
@@ -90,7 +99,7 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
       if (!Snappy_GetUncompressedLength(input.data(), input.size(), &usize)) {
         return Status::Corruption("Corrupted compressed blob", "Snappy");
       }
-      ubuf.reset(new char[usize]);
+      ubuf = AllocateBlock(usize, allocator);
       if (!Snappy_Uncompress(input.data(), input.size(), ubuf.get())) {
         return Status::Corruption("Corrupted compressed blob", "Snappy");
       }
@@ -99,7 +108,7 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
     }
     case kZlibCompression:
       ubuf = Zlib_Uncompress(ctx, input.data(), input.size(), &size,
-                             kCompressionFormat);
+                             kCompressionFormat, allocator);
       if (!ubuf.get()) {
         return Status::Corruption("Corrupted compressed blob", "Zlib");
       }
@@ -107,7 +116,7 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
       break;
     case kBZip2Compression:
       ubuf = BZip2_Uncompress(input.data(), input.size(), &size,
-                              kCompressionFormat);
+                              kCompressionFormat, allocator);
       if (!ubuf.get()) {
         return Status::Corruption("Corrupted compressed blob", "Bzip2");
       }
@@ -115,7 +124,7 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
       break;
     case kLZ4Compression:
       ubuf = LZ4_Uncompress(ctx, input.data(), input.size(), &size,
-                            kCompressionFormat);
+                            kCompressionFormat, allocator);
       if (!ubuf.get()) {
         return Status::Corruption("Corrupted compressed blob", "LZ4");
       }
@@ -123,7 +132,7 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
       break;
     case kLZ4HCCompression:
       ubuf = LZ4_Uncompress(ctx, input.data(), input.size(), &size,
-                            kCompressionFormat);
+                            kCompressionFormat, allocator);
       if (!ubuf.get()) {
         return Status::Corruption("Corrupted compressed blob", "LZ4HC");
       }
@@ -138,7 +147,12 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
       break;
     case kZSTD:
     case kZSTDNotFinalCompression:
-      ubuf = ZSTD_Uncompress(ctx, input.data(), input.size(), &size);
+      if (dict) {
+        ubuf = dict->Uncompress(input, &size, allocator);
+      } else {
+        ubuf = ZSTD_Uncompress(ctx, input.data(), input.size(), &size,
+                               allocator);
+      }
       if (!ubuf.get()) {
         return Status::Corruption("Corrupted compressed blob", "ZSTD");
       }
@@ -151,11 +165,213 @@ Status Uncompress(const UncompressionContext& ctx, const Slice& input,
   return Status::OK();
 }
 
+bool BlobCompressionDict::Supported() {
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::shared_ptr<const BlobCompressionDict>
+BlobCompressionDict::NewForCompression(const Slice& raw, int level) {
+  std::shared_ptr<BlobCompressionDict> dict(new BlobCompressionDict(raw));
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  // The same as the default level of ZSTD_Compress().
+  if (level == CompressionOptions::kDefaultCompressionLevel) {
+    level = 3;
+  }
+  dict->cdict_ =
+      ZSTD_createCDict(dict->raw_.data(), dict->raw_.size(), level);
+#else
+  (void)level;
+#endif
+  return dict;
+}
+
+std::shared_ptr<const BlobCompressionDict>
+BlobCompressionDict::NewForUncompression(const Slice& raw) {
+  std::shared_ptr<BlobCompressionDict> dict(new BlobCompressionDict(raw));
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  dict->ddict_ = ZSTD_createDDict(dict->raw_.data(), dict->raw_.size());
+#endif
+  return dict;
+}
+
+BlobCompressionDict::~BlobCompressionDict() {
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  for (auto cctx : cctxs_) {
+    ZSTD_freeCCtx(cctx);
+  }
+  for (auto dctx : dctxs_) {
+    ZSTD_freeDCtx(dctx);
+  }
+  ZSTD_freeCDict(cdict_);
+  ZSTD_freeDDict(ddict_);
+#endif
+}
+
+bool BlobCompressionDict::Compress(const Slice& input,
+                                   std::string* output) const {
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  if (cdict_ == nullptr ||
+      input.size() > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  ZSTD_CCtx* cctx = nullptr;
+  {
+    MutexLock l(&mutex_);
+    if (!cctxs_.empty()) {
+      cctx = cctxs_.back();
+      cctxs_.pop_back();
+    }
+  }
+  if (cctx == nullptr) {
+    cctx = ZSTD_createCCtx();
+  }
+  // Prefixed with the uncompressed size, the same as ZSTD_Compress().
+  PutVarint32(output, static_cast<uint32_t>(input.size()));
+  size_t header_size = output->size();
+  output->resize(header_size + ZSTD_compressBound(input.size()));
+  size_t size = ZSTD_compress_usingCDict(
+      cctx, &(*output)[header_size], output->size() - header_size,
+      input.data(), input.size(), cdict_);
+  {
+    MutexLock l(&mutex_);
+    cctxs_.push_back(cctx);
+  }
+  if (ZSTD_isError(size)) {
+    return false;
+  }
+  output->resize(header_size + size);
+  return true;
+#else
+  (void)input;
+  (void)output;
+  return false;
+#endif
+}
+
+CacheAllocationPtr BlobCompressionDict::Uncompress(
+    const Slice& input, int* size, MemoryAllocator* allocator) const {
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  uint32_t output_size = 0;
+  const char* limit = input.data() + input.size();
+  const char* data = GetVarint32Ptr(input.data(), limit, &output_size);
+  if (ddict_ == nullptr || data == nullptr ||
+      output_size > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
+    return nullptr;
+  }
+  ZSTD_DCtx* dctx = nullptr;
+  {
+    MutexLock l(&mutex_);
+    if (!dctxs_.empty()) {
+      dctx = dctxs_.back();
+      dctxs_.pop_back();
+    }
+  }
+  if (dctx == nullptr) {
+    dctx = ZSTD_createDCtx();
+  }
+  CacheAllocationPtr ubuf = AllocateBlock(output_size, allocator);
+  size_t actual_size =
+      ZSTD_decompress_usingDDict(dctx, ubuf.get(), output_size, data,
+                                 static_cast<size_t>(limit - data), ddict_);
+  {
+    MutexLock l(&mutex_);
+    dctxs_.push_back(dctx);
+  }
+  if (ZSTD_isError(actual_size) || actual_size != output_size) {
+    return nullptr;
+  }
+  *size = static_cast<int>(output_size);
+  return ubuf;
+#else
+  (void)input;
+  (void)size;
+  (void)allocator;
+  return nullptr;
+#endif
+}
+
+std::string TrainCompressionDict(const std::string& samples,
+                                 const std::vector<size_t>& sample_lens,
+                                 size_t max_dict_bytes) {
+  // The dictionary trainer of zstd is available to dynamic linking since
+  // v1.1.3, see ZSTD_TrainDictionary().
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 10103
+  return ZSTD_TrainDictionary(samples, sample_lens, max_dict_bytes);
+#else
+  (void)samples;
+  (void)sample_lens;
+  (void)max_dict_bytes;
+  return std::string();
+#endif
+}
+
 void UnrefCacheHandle(void* arg1, void* arg2) {
   Cache* cache = reinterpret_cast<Cache*>(arg1);
   Cache::Handle* h = reinterpret_cast<Cache::Handle*>(arg2);
   cache->Release(h);
 }
 
+BlobBufferPool::~BlobBufferPool() {
+  for (auto& free_list : free_lists_) {
+    for (auto buffer : free_list.buffers) {
+      delete[] buffer;
+    }
+  }
+}
+
+void* BlobBufferPool::Allocate(size_t size) {
+  uint32_t size_class = SizeClass(size);
+  char* buffer = nullptr;
+  if (size_class < kNumClasses) {
+    auto& free_list = free_lists_[size_class];
+    MutexLock l(&free_list.mutex);
+    if (!free_list.buffers.empty()) {
+      buffer = free_list.buffers.back();
+      free_list.buffers.pop_back();
+    }
+  }
+  if (buffer) {
+    free_size_.fetch_sub(ClassSize(size_class), std::memory_order_relaxed);
+    hit_count_.fetch_add(1, std::memory_order_relaxed);
+    return buffer + kHeaderSize;
+  }
+  miss_count_.fetch_add(1, std::memory_order_relaxed);
+  size_t buffer_size = size_class < kNumClasses ? ClassSize(size_class) : size;
+  buffer = new char[kHeaderSize + buffer_size];
+  EncodeFixed32(buffer, size_class);
+  return buffer + kHeaderSize;
+}
+
+void BlobBufferPool::Deallocate(void* p) {
+  char* buffer = reinterpret_cast<char*>(p) - kHeaderSize;
+  uint32_t size_class = DecodeFixed32(buffer);
+  if (size_class < kNumClasses) {
+    size_t size = ClassSize(size_class);
+    if (free_size_.fetch_add(size, std::memory_order_relaxed) + size <=
+        capacity_) {
+      auto& free_list = free_lists_[size_class];
+      MutexLock l(&free_list.mutex);
+      free_list.buffers.push_back(buffer);
+      return;
+    }
+    free_size_.fetch_sub(size, std::memory_order_relaxed);
+  }
+  delete[] buffer;
+}
+
+size_t BlobBufferPool::UsableSize(void* p, size_t allocation_size) const {
+  char* buffer = reinterpret_cast<char*>(p) - kHeaderSize;
+  uint32_t size_class = DecodeFixed32(buffer);
+  return size_class < kNumClasses ? ClassSize(size_class) : allocation_size;
+}
+
+std::shared_ptr<BlobBufferPool> NewBlobBufferPool(size_t capacity) {
+  return std::make_shared<BlobBufferPool>(capacity);
+}
+
 }  // namespace titandb
 }  // namespace rocksdb
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "port/port.h"
 #include "rocksdb/cache.h"
 #include "util/compression.h"
 
@@ -21,14 +27,32 @@ class OwnedSlice : public Slice {
     buffer_ = std::move(buffer);
   }
 
+  // Returns true if the slice points to its own buffer.
+  bool owned() const { return buffer_ != nullptr; }
+
+  // Returns the size of memory taken by the buffer, which the allocator
+  // may have rounded up from the size of the slice.
+  size_t usable_size() const {
+    auto allocator = this->allocator();
+    if (!buffer_ || !allocator) {
+      return size_;
+    }
+    return allocator->UsableSize(buffer_.get(), size_);
+  }
+
   char* release() {
     data_ = nullptr;
     size_ = 0;
     return buffer_.release();
   }
 
-  static void CleanupFunc(void* buffer, void*) {
-    delete[] reinterpret_cast<char*>(buffer);
+  // Returns the allocator of the buffer, which should be passed to
+  // CleanupFunc() along with the released buffer.
+  MemoryAllocator* allocator() const { return buffer_.get_deleter().allocator; }
+
+  static void CleanupFunc(void* buffer, void* allocator) {
+    CustomDeleter(reinterpret_cast<MemoryAllocator*>(allocator))(
+        reinterpret_cast<char*>(buffer));
   }
 
  private:
@@ -47,25 +71,299 @@ class FixedSlice : public Slice {
   char buffer_[T];
 };
 
+// A zstd dictionary of a blob file. The dictionary is digested once, so
+// that compressing or uncompressing a record doesn't load the raw
+// dictionary again, and the zstd contexts are kept for reuse. It is
+// thread-safe.
+class BlobCompressionDict {
+ public:
+  // Returns true if the zstd library supports digested dictionaries.
+  static bool Supported();
+
+  // Digests the raw dictionary for compression at the level.
+  static std::shared_ptr<const BlobCompressionDict> NewForCompression(
+      const Slice& raw, int level);
+
+  // Digests the raw dictionary for uncompression.
+  static std::shared_ptr<const BlobCompressionDict> NewForUncompression(
+      const Slice& raw);
+
+  ~BlobCompressionDict();
+
+  // No copying allowed
+  BlobCompressionDict(const BlobCompressionDict&) = delete;
+  void operator=(const BlobCompressionDict&) = delete;
+
+  const std::string& raw() const { return raw_; }
+
+  // Compresses the input in the format of ZSTD_Compress(). Returns false
+  // if compression fails.
+  // REQUIRES: created by NewForCompression().
+  bool Compress(const Slice& input, std::string* output) const;
+
+  // Uncompresses the input compressed by Compress(). Returns the buffer,
+  // which is allocated from "allocator" if it is not null, and sets
+  // "*size" to the uncompressed size. Returns null if it fails.
+  // REQUIRES: created by NewForUncompression().
+  CacheAllocationPtr Uncompress(const Slice& input, int* size,
+                                MemoryAllocator* allocator) const;
+
+ private:
+  explicit BlobCompressionDict(const Slice& raw) : raw_(raw.ToString()) {}
+
+  std::string raw_;
+#if defined(ZSTD) && ZSTD_VERSION_NUMBER >= 700
+  ZSTD_CDict* cdict_{nullptr};
+  ZSTD_DDict* ddict_{nullptr};
+  // Contexts not used by any record at the moment.
+  mutable port::Mutex mutex_;
+  mutable std::vector<ZSTD_CCtx*> cctxs_;
+  mutable std::vector<ZSTD_DCtx*> dctxs_;
+#endif
+};
+
+// Builds a zstd dictionary of at most "max_dict_bytes" from the samples,
+// which are concatenated in "samples" with their sizes in "sample_lens".
+// Returns an empty string if the dictionary can't be trained.
+std::string TrainCompressionDict(const std::string& samples,
+                                 const std::vector<size_t>& sample_lens,
+                                 size_t max_dict_bytes);
+
 // Compresses the input data according to the compression context.
 // Returns a slice with the output data and sets "*type" to the output
-// compression type.
+// compression type. ZSTD compression uses the dictionary if it is not
+// null.
 //
 // If compression is actually performed, fills "*output" with the
 // compressed data. However, if the compression ratio is not good, it
 // returns the input slice directly and sets "*type" to
 // kNoCompression.
 Slice Compress(const CompressionContext& ctx, const Slice& input,
-               std::string* output, CompressionType* type);
+               std::string* output, CompressionType* type,
+               const BlobCompressionDict* dict = nullptr);
 
 // Uncompresses the input data according to the uncompression type.
 // If successful, fills "*buffer" with the uncompressed data and
-// points "*output" to it.
+// points "*output" to it. The buffer is allocated from "allocator" if
+// it is not null. ZSTD data is uncompressed with the dictionary if it is
+// not null, which must be the one it is compressed with.
 Status Uncompress(const UncompressionContext& ctx, const Slice& input,
-                  OwnedSlice* output);
+                  OwnedSlice* output, MemoryAllocator* allocator = nullptr,
+                  const BlobCompressionDict* dict = nullptr);
 
 void UnrefCacheHandle(void* cache, void* handle);
 
+// A size-classed pool of blob read buffers. Freed buffers are kept for
+// reuse as long as the total size of free buffers doesn't exceed the
+// capacity. Requests larger than the largest size class bypass the pool.
+class BlobBufferPool : public MemoryAllocator {
+ public:
+  explicit BlobBufferPool(size_t capacity) : capacity_(capacity) {}
+  ~BlobBufferPool();
+
+  // No copying allowed
+  BlobBufferPool(const BlobBufferPool&) = delete;
+  void operator=(const BlobBufferPool&) = delete;
+
+  const char* Name() const override { return "BlobBufferPool"; }
+  void* Allocate(size_t size) override;
+  void Deallocate(void* p) override;
+  size_t UsableSize(void* p, size_t allocation_size) const override;
+
+  // Returns the size of the buffer an allocation of the size takes.
+  static size_t AllocatedSize(size_t size) {
+    uint32_t size_class = SizeClass(size);
+    return size_class < kNumClasses ? ClassSize(size_class) : size;
+  }
+
+  // Number of allocations served by a free buffer.
+  uint64_t hit_count() const {
+    return hit_count_.load(std::memory_order_relaxed);
+  }
+  // Number of allocations served by the underlying allocator.
+  uint64_t miss_count() const {
+    return miss_count_.load(std::memory_order_relaxed);
+  }
+  // Total size of free buffers kept in the pool.
+  size_t free_size() const {
+    return free_size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Size classes are powers of two from 4KB to 8MB.
+  static const int kMinClassShift = 12;
+  static const int kNumClasses = 12;
+  // Every buffer is preceded by a header recording its size class, which
+  // is large enough to keep the returned buffer aligned.
+  static const size_t kHeaderSize = 16;
+
+  static size_t ClassSize(uint32_t size_class) {
+    return static_cast<size_t>(1) << (kMinClassShift + size_class);
+  }
+
+  // Returns the smallest size class holding the size, or kNumClasses if
+  // the size is larger than every class.
+  static uint32_t SizeClass(size_t size) {
+    uint32_t size_class = 0;
+    while (size_class < kNumClasses && ClassSize(size_class) < size) {
+      size_class++;
+    }
+    return size_class;
+  }
+
+  struct FreeList {
+    port::Mutex mutex;
+    std::vector<char*> buffers;
+  };
+
+  const size_t capacity_;
+  std::atomic<size_t> free_size_{0};
+  std::atomic<uint64_t> hit_count_{0};
+  std::atomic<uint64_t> miss_count_{0};
+  FreeList free_lists_[kNumClasses];
+};
+
+// Returns the allocator of blob read buffers, which is the buffer pool if
+// there is one, otherwise the memory allocator of the blob cache.
+inline MemoryAllocator* GetBlobBufferAllocator(BlobBufferPool* pool,
+                                               Cache* cache) {
+  if (pool) {
+    return pool;
+  }
+  return cache ? cache->memory_allocator() : nullptr;
+}
+
+// Returns the reader slot of the calling thread. Threads take slots in
+// turn, so that concurrent readers mostly count on different cache lines.
+inline size_t ReaderSlot() {
+  static std::atomic<size_t> next_slot{0};
+  thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+  return slot;
+}
+
+// Holds an immutable object which readers access without locking and
+// writers replace in a copy-on-write manner. Readers must not keep
+// references into the object after their ReadScope is gone.
+//
+// Readers are counted per epoch in padded per-thread slots. A writer
+// advances the epoch once the readers entered before the current epoch are
+// gone, and then frees the objects replaced before the current epoch. So a
+// replaced object is freed as soon as the readers which could see it are
+// gone, without waiting for a moment with no reader at all.
+//
+// REQUIRES: Publish() and Reclaim() are serialized by the caller. Readers
+// don't hold a ReadScope across I/O or other slow work, which would delay
+// freeing every object replaced meanwhile.
+template <class T>
+class PublishedPtr {
+ public:
+  PublishedPtr() : current_(new T()) {}
+
+  ~PublishedPtr() {
+    assert(Drained(0) && Drained(1));
+    delete current_.load();
+    for (auto& retired : retired_) {
+      delete retired.obj;
+    }
+  }
+
+  // No copying allowed
+  PublishedPtr(const PublishedPtr&) = delete;
+  void operator=(const PublishedPtr&) = delete;
+
+  // Pins the currently published object during its lifetime.
+  class ReadScope {
+   public:
+    explicit ReadScope(const PublishedPtr* ptr) {
+      count_ = ptr->Enter();
+      obj_ = ptr->current_.load();
+    }
+
+    ~ReadScope() { count_->fetch_sub(1, std::memory_order_release); }
+
+    const T* operator->() const { return obj_; }
+    const T& operator*() const { return *obj_; }
+
+   private:
+    std::atomic<uint64_t>* count_;
+    const T* obj_;
+  };
+
+  // Publishes the object and takes the ownership of it. Replaced objects
+  // still visible to readers are left to a later Publish() or Reclaim(),
+  // since the caller usually holds a lock.
+  void Publish(const T* obj) {
+    retired_.push_back({current_.exchange(obj), epoch_.load()});
+    Reclaim();
+  }
+
+  // Frees the replaced objects no reader can be accessing.
+  void Reclaim() {
+    // Every pass frees all objects replaced before the current epoch, so
+    // this stops after two passes at most.
+    while (!retired_.empty()) {
+      uint64_t epoch = epoch_.load();
+      // Readers of the epoch before the current one count on the other
+      // parity. Readers of earlier epochs are already gone, since the epoch
+      // is only advanced after they are.
+      if (!Drained((epoch + 1) & 1)) {
+        return;
+      }
+      auto it = retired_.begin();
+      while (it != retired_.end() && it->epoch < epoch) {
+        delete it->obj;
+        ++it;
+      }
+      retired_.erase(retired_.begin(), it);
+      epoch_.store(epoch + 1);
+    }
+  }
+
+ private:
+  static const size_t kNumSlots = 32;
+
+  struct Slot {
+    std::atomic<uint64_t> count{0};
+    char padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+  };
+
+  struct Retired {
+    const T* obj;
+    uint64_t epoch;
+  };
+
+  // Counts a reader in the current epoch and returns its count.
+  std::atomic<uint64_t>* Enter() const {
+    size_t slot = ReaderSlot() % kNumSlots;
+    while (true) {
+      uint64_t epoch = epoch_.load();
+      auto* count = &slots_[epoch & 1][slot].count;
+      count->fetch_add(1);
+      // The epoch may have been advanced before the reader is counted, in
+      // which case the writer may not see the reader.
+      if (epoch_.load() == epoch) {
+        return count;
+      }
+      count->fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  bool Drained(size_t parity) const {
+    for (size_t i = 0; i < kNumSlots; i++) {
+      if (slots_[parity][i].count.load() != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::atomic<const T*> current_;
+  std::atomic<uint64_t> epoch_{0};
+  mutable Slot slots_[2][kNumSlots];
+  // Replaced objects in the order of replacement.
+  std::vector<Retired> retired_;
+};
+
 template <class T>
 void DeleteCacheValue(const Slice&, void* value) {
   delete reinterpret_cast<T*>(value);
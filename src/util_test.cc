@@ -23,6 +23,59 @@ TEST(UtilTest, Compression) {
   }
 }
 
+TEST(UtilTest, BlobBufferPool) {
+  BlobBufferPool pool(16 << 10);
+  void* p1 = pool.Allocate(3000);
+  ASSERT_EQ(4096, pool.UsableSize(p1, 3000));
+  ASSERT_EQ(4096, BlobBufferPool::AllocatedSize(3000));
+  ASSERT_EQ(8192, BlobBufferPool::AllocatedSize(4097));
+  ASSERT_EQ(0, pool.hit_count());
+  ASSERT_EQ(1, pool.miss_count());
+  pool.Deallocate(p1);
+  ASSERT_EQ(4096, pool.free_size());
+
+  // Reuses the free buffer of the same size class.
+  void* p2 = pool.Allocate(4096);
+  ASSERT_EQ(p1, p2);
+  ASSERT_EQ(1, pool.hit_count());
+  ASSERT_EQ(0, pool.free_size());
+
+  // Doesn't keep more free buffers than the capacity.
+  void* p3 = pool.Allocate(16 << 10);
+  void* p4 = pool.Allocate(16 << 10);
+  ASSERT_EQ(3, pool.miss_count());
+  pool.Deallocate(p3);
+  pool.Deallocate(p4);
+  pool.Deallocate(p2);
+  ASSERT_EQ(16 << 10, pool.free_size());
+
+  // Large buffers bypass the pool.
+  void* p5 = pool.Allocate(64 << 20);
+  ASSERT_EQ(64 << 20, pool.UsableSize(p5, 64 << 20));
+  ASSERT_EQ(64 << 20, BlobBufferPool::AllocatedSize(64 << 20));
+  pool.Deallocate(p5);
+  ASSERT_EQ(16 << 10, pool.free_size());
+
+  // Uncompresses into the buffers of the pool.
+  std::string input(8 << 10, 'a');
+  CompressionContext compression_ctx(kLZ4Compression);
+  CompressionType compression;
+  std::string buffer;
+  auto compressed = Compress(compression_ctx, input, &buffer, &compression);
+  if (compression != kNoCompression) {
+    UncompressionContext uncompression_ctx(compression);
+    auto allocations = pool.hit_count() + pool.miss_count();
+    {
+      OwnedSlice output;
+      ASSERT_OK(Uncompress(uncompression_ctx, compressed, &output, &pool));
+      ASSERT_EQ(output, input);
+      ASSERT_EQ(&pool, output.allocator());
+      ASSERT_EQ(8 << 10, output.usable_size());
+    }
+    ASSERT_EQ(allocations + 1, pool.hit_count() + pool.miss_count());
+  }
+}
+
 }  // namespace titandb
 }  // namespace rocksdb
 
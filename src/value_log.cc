@@ -0,0 +1,503 @@
+#include "value_log.h"
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "util/filename.h"
+#include "util/logging.h"
+#include "util/stop_watch.h"
+#include "util/string_util.h"
+#include "version_edit.h"
+
+namespace rocksdb {
+namespace titandb {
+
+namespace {
+
+const std::string kValueLogSuffix = ".vlog";
+
+// Records are aligned to blocks of this size, see BlobFileBuilder.
+const uint64_t kBlockSize = 4096;
+
+// Reads of the log when it is copied on recovery.
+const size_t kRecoveryReadSize = 1 << 20;
+
+// Scans the records of the value log. Sets "*valid_size" to the end of
+// the last valid record, or 0 if there is none. Records after a truncated
+// or corrupted one are dropped.
+Status ScanValueLog(RandomAccessFile* file, uint64_t file_size,
+                    uint64_t* valid_size) {
+  *valid_size = 0;
+  FixedSlice<BlobFileHeader::kEncodedLength> header_buffer;
+  Slice input;
+  Status s = file->Read(0, BlobFileHeader::kEncodedLength, &input,
+                        header_buffer.get());
+  if (!s.ok()) return s;
+  BlobFileHeader header;
+  if (!DecodeInto(input, &header).ok()) {
+    return Status::OK();
+  }
+
+  uint64_t offset = kBlockSize;
+  std::string buffer;
+  while (true) {
+    if (kBlockSize - offset % kBlockSize <= kBlobHeaderSize) {
+      offset = (offset / kBlockSize + 1) * kBlockSize;
+    }
+    if (offset + kBlobHeaderSize > file_size) break;
+    FixedSlice<kBlobHeaderSize> record_header;
+    s = file->Read(offset, kBlobHeaderSize, &input, record_header.get());
+    if (!s.ok()) return s;
+    BlobDecoder decoder;
+    if (input.size() != kBlobHeaderSize || !decoder.DecodeHeader(&input).ok()) {
+      break;
+    }
+    if (decoder.GetRecordSize() == 0) {
+      // Padding after a record, the next record starts at the next block.
+      if (offset % kBlockSize == 0) break;
+      offset = (offset / kBlockSize + 1) * kBlockSize;
+      continue;
+    }
+    uint64_t end = offset + kBlobHeaderSize + decoder.GetRecordSize();
+    if (end > file_size) break;
+    buffer.resize(decoder.GetRecordSize());
+    s = file->Read(offset + kBlobHeaderSize, buffer.size(), &input,
+                   &buffer[0]);
+    if (!s.ok()) return s;
+    BlobRecord record;
+    OwnedSlice uncompressed;
+    if (input.size() != buffer.size() ||
+        !decoder.DecodeRecord(&input, &record, &uncompressed).ok()) {
+      break;
+    }
+    offset = end;
+    *valid_size = end;
+  }
+  return Status::OK();
+}
+
+// Writes the valid records of the value log to the blob file, sealed with
+// the footer. Sets "*file_size" to the size of the blob file, or 0 if the
+// log has no valid records, in which case no blob file is written.
+Status SealValueLog(const TitanDBOptions& db_options,
+                    const EnvOptions& env_options, const std::string& log_name,
+                    const std::string& file_name, uint64_t* file_size) {
+  *file_size = 0;
+  Env* env = db_options.env;
+  uint64_t log_size = 0;
+  Status s = env->GetFileSize(log_name, &log_size);
+  if (!s.ok()) return s;
+  std::unique_ptr<RandomAccessFile> log;
+  s = env->NewRandomAccessFile(log_name, &log, env_options);
+  if (!s.ok()) return s;
+  uint64_t valid_size = 0;
+  s = ScanValueLog(log.get(), log_size, &valid_size);
+  if (!s.ok() || valid_size == 0) return s;
+
+  std::unique_ptr<WritableFileWriter> file;
+  {
+    std::unique_ptr<WritableFile> f;
+    s = env->NewWritableFile(file_name, &f, env_options);
+    if (!s.ok()) return s;
+    file.reset(new WritableFileWriter(std::move(f), file_name, env_options));
+  }
+  // Copies the records as they are, which keeps the blob indexes in the
+  // WAL pointing to them valid.
+  std::string buffer;
+  for (uint64_t offset = 0; offset < valid_size;) {
+    buffer.resize(static_cast<size_t>(
+        std::min<uint64_t>(kRecoveryReadSize, valid_size - offset)));
+    Slice data;
+    s = log->Read(offset, buffer.size(), &data, &buffer[0]);
+    if (s.ok() && data.size() != buffer.size()) {
+      s = Status::Corruption("Value log is truncated", log_name);
+    }
+    if (s.ok()) {
+      s = file->Append(data);
+    }
+    if (!s.ok()) return s;
+    offset += data.size();
+  }
+  if (valid_size % kBlockSize != 0) {
+    s = file->Append(std::string(kBlockSize - valid_size % kBlockSize, 0));
+  }
+  if (s.ok()) {
+    BlobFileFooter footer;
+    buffer.clear();
+    footer.EncodeTo(&buffer);
+    s = file->Append(buffer);
+  }
+  if (s.ok()) {
+    s = file->Sync(db_options.use_fsync);
+  }
+  if (s.ok()) {
+    *file_size = file->GetFileSize();
+    s = file->Close();
+  }
+  return s;
+}
+
+}  // namespace
+
+std::string ValueLogFileName(const std::string& dirname, uint32_t cf_id,
+                             uint64_t number) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/%06" PRIu64 ".%" PRIu32, number, cf_id);
+  return dirname + buf + kValueLogSuffix;
+}
+
+bool ParseValueLogFileName(const std::string& name, uint32_t* cf_id,
+                           uint64_t* number) {
+  if (name.size() <= kValueLogSuffix.size() ||
+      name.compare(name.size() - kValueLogSuffix.size(),
+                   kValueLogSuffix.size(), kValueLogSuffix) != 0) {
+    return false;
+  }
+  Slice rest(name.data(), name.size() - kValueLogSuffix.size());
+  uint64_t cf = 0;
+  if (!ConsumeDecimalNumber(&rest, number) || !rest.starts_with(".")) {
+    return false;
+  }
+  rest.remove_prefix(1);
+  if (!ConsumeDecimalNumber(&rest, &cf) || !rest.empty() ||
+      cf > port::kMaxUint32) {
+    return false;
+  }
+  *cf_id = static_cast<uint32_t>(cf);
+  return true;
+}
+
+ValueLog::ValueLog(const TitanDBOptions& db_options,
+                   const TitanCFOptions& cf_options, uint32_t cf_id,
+                   VersionSet* vset, port::Mutex* db_mutex, TitanStats* stats)
+    : db_options_(db_options),
+      cf_options_(cf_options),
+      cf_id_(cf_id),
+      env_(db_options.env),
+      env_options_(db_options),
+      vset_(vset),
+      db_mutex_(db_mutex),
+      stats_(stats),
+      blob_run_mode_(cf_options.blob_run_mode) {
+  // Records are read while the log is growing, and flushed one batch at a
+  // time, which doesn't fit mmap or direct writes.
+  env_options_.use_mmap_writes = false;
+  env_options_.use_direct_writes = false;
+}
+
+ValueLog::~ValueLog() {
+  // An unsealed log is left to recovery.
+  if (builder_) {
+    builder_->Abandon();
+  }
+}
+
+Status ValueLog::Recover(
+    const TitanDBOptions& db_options,
+    const std::map<uint32_t, TitanCFOptions>& column_families,
+    VersionSet* vset, port::Mutex* db_mutex) {
+  Env* env = db_options.env;
+  // Logs are read and copied with buffered I/O, since their sizes are not
+  // aligned.
+  EnvOptions env_options(db_options);
+  env_options.use_mmap_reads = false;
+  env_options.use_direct_reads = false;
+  env_options.use_direct_writes = false;
+  std::vector<std::string> children;
+  Status s = env->GetChildren(db_options.dirname, &children);
+  if (!s.ok()) return s;
+
+  // Logs in the order of file numbers, which are not persisted until the
+  // next manifest update.
+  std::map<uint64_t, uint32_t> logs;
+  for (auto& name : children) {
+    uint32_t cf_id = 0;
+    uint64_t number = 0;
+    if (ParseValueLogFileName(name, &cf_id, &number)) {
+      logs.emplace(number, cf_id);
+      vset->MarkFileNumberUsed(number);
+    }
+  }
+
+  for (auto& log : logs) {
+    uint64_t number = log.first;
+    uint32_t cf_id = log.second;
+    auto log_name = ValueLogFileName(db_options.dirname, cf_id, number);
+    auto file_name = BlobFileName(db_options.dirname, number);
+    std::shared_ptr<BlobStorage> storage;
+    if (column_families.count(cf_id) > 0) {
+      MutexLock l(db_mutex);
+      storage = vset->GetBlobStorage(cf_id).lock();
+    }
+    if (!storage) {
+      ROCKS_LOG_INFO(db_options.info_log,
+                     "Titan recovery delete value log %s of dropped column "
+                     "family.",
+                     log_name.c_str());
+      s = env->DeleteFile(log_name);
+      if (!s.ok()) return s;
+      continue;
+    }
+
+    if (storage->FindFile(number).lock()) {
+      // The log has been sealed and added to the manifest, but not renamed.
+      if (env->FileExists(file_name).ok()) {
+        s = env->DeleteFile(log_name);
+      } else {
+        s = env->RenameFile(log_name, file_name);
+      }
+      if (!s.ok()) return s;
+      continue;
+    }
+
+    uint64_t file_size = 0;
+    s = SealValueLog(db_options, env_options, log_name, file_name, &file_size);
+    if (!s.ok()) return s;
+    if (file_size > 0) {
+      auto file = std::make_shared<BlobFileMeta>(number, file_size);
+      file->FileStateTransit(BlobFileMeta::FileEvent::kValueLogSealed);
+      file->set_sorted(false);
+      VersionEdit edit;
+      edit.SetColumnFamilyID(cf_id);
+      edit.AddBlobFile(file);
+      {
+        MutexLock l(db_mutex);
+        s = vset->LogAndApply(edit);
+      }
+      if (!s.ok()) return s;
+      ROCKS_LOG_INFO(db_options.info_log,
+                     "Titan recovery sealed value log %s to blob file %" PRIu64
+                     " of %" PRIu64 " bytes.",
+                     log_name.c_str(), number, file_size);
+    } else {
+      ROCKS_LOG_INFO(db_options.info_log,
+                     "Titan recovery delete value log %s without valid "
+                     "records.",
+                     log_name.c_str());
+    }
+    s = env->DeleteFile(log_name);
+    if (!s.ok()) return s;
+  }
+  return s;
+}
+
+Status ValueLog::Add(const Slice& key, const Slice& value, BlobIndex* index) {
+  MutexLock l(&mutex_);
+  if (closed_) {
+    return Status::ShutdownInProgress("Value log is closed");
+  }
+  if (!status_.ok()) return status_;
+  if (!builder_) {
+    status_ = NewFile();
+    if (!status_.ok()) return status_;
+  }
+
+  StopWatch write_sw(env_, statistics(stats_), BLOB_DB_BLOB_FILE_WRITE_MICROS);
+  RecordTick(stats_, BLOB_DB_NUM_KEYS_WRITTEN);
+  MeasureTime(stats_, BLOB_DB_KEY_SIZE, key.size());
+  MeasureTime(stats_, BLOB_DB_VALUE_SIZE, value.size());
+
+  BlobRecord record;
+  record.key = key;
+  record.value = value;
+  index->file_number = file_number_;
+  builder_->Add(record, &index->blob_handle);
+  status_ = builder_->status();
+  if (!status_.ok()) return status_;
+  RecordTick(stats_, BLOB_DB_BLOB_FILE_BYTES_WRITTEN, index->blob_handle.size);
+  // The record is live once its blob index is flushed, see
+  // OnFlushCompleted().
+  auto& usage = usages_[file_number_];
+  usage.appended_size += index->blob_handle.record_size();
+  usage.num_writing++;
+
+  if (file_->GetFileSize() >= cf_options_.blob_file_target_size) {
+    status_ = SealFile();
+  }
+  return status_;
+}
+
+void ValueLog::Release(uint64_t file_number, uint64_t count,
+                       SequenceNumber sequence) {
+  MutexLock l(&mutex_);
+  auto it = usages_.find(file_number);
+  if (it == usages_.end()) return;
+  FileUsage& usage = it->second;
+  assert(usage.num_writing >= count);
+  usage.num_writing -= count;
+  usage.last_sequence = std::max(usage.last_sequence, sequence);
+  MaybeApplyUsage(file_number);
+}
+
+void ValueLog::OnFlushCompleted(
+    SequenceNumber largest_seqno,
+    const std::map<uint64_t, uint64_t>& blob_files_size) {
+  MutexLock l(&mutex_);
+  flushed_sequence_ = std::max(flushed_sequence_, largest_seqno);
+  uint64_t live_size = 0;
+  for (const auto& bfs : blob_files_size) {
+    auto it = usages_.find(bfs.first);
+    if (it != usages_.end()) {
+      it->second.flushed_size += bfs.second;
+      live_size += bfs.second;
+    }
+  }
+  AddStats(stats_, cf_id_, TitanInternalStats::LIVE_BLOB_SIZE, live_size);
+  for (auto it = usages_.begin(); it != usages_.end();) {
+    uint64_t file_number = it->first;
+    // The usage may be erased.
+    ++it;
+    MaybeApplyUsage(file_number);
+  }
+}
+
+Status ValueLog::Flush(bool sync) {
+  MutexLock l(&mutex_);
+  if (!status_.ok() || !file_) return status_;
+  status_ = file_->Flush();
+  if (status_.ok() && sync) {
+    RecordTick(stats_, BLOB_DB_BLOB_FILE_SYNCED);
+    StopWatch sync_sw(env_, statistics(stats_), BLOB_DB_BLOB_FILE_SYNC_MICROS);
+    status_ = file_->Sync(db_options_.use_fsync);
+  }
+  return status_;
+}
+
+Status ValueLog::Seal() {
+  MutexLock l(&mutex_);
+  if (status_.ok() && builder_) {
+    status_ = SealFile();
+  }
+  return status_;
+}
+
+Status ValueLog::Close() {
+  MutexLock l(&mutex_);
+  closed_ = true;
+  if (status_.ok() && builder_) {
+    status_ = SealFile();
+  }
+  return status_;
+}
+
+Status ValueLog::NewFile() {
+  mutex_.AssertHeld();
+  file_number_ = vset_->NewFileNumber();
+  file_name_ = ValueLogFileName(db_options_.dirname, cf_id_, file_number_);
+  {
+    std::unique_ptr<WritableFile> f;
+    Status s = env_->NewWritableFile(file_name_, &f, env_options_);
+    if (!s.ok()) return s;
+    file_.reset(new WritableFileWriter(std::move(f), file_name_, env_options_));
+  }
+  builder_.reset(new BlobFileBuilder(db_options_, cf_options_, file_.get()));
+  Status s = builder_->status();
+  if (s.ok()) {
+    s = file_->Flush();
+  }
+  if (!s.ok()) return s;
+
+  MutexLock l(db_mutex_);
+  auto storage = vset_->GetBlobStorage(cf_id_).lock();
+  if (!storage) {
+    return Status::Corruption("Missing blob storage of column family " +
+                              ToString(cf_id_));
+  }
+  storage->AddActiveFile(std::make_shared<BlobFileMeta>(file_number_, 0));
+  ROCKS_LOG_INFO(db_options_.info_log,
+                 "Titan value log %" PRIu64
+                 " created for column family %" PRIu32 ".",
+                 file_number_, cf_id_);
+  return s;
+}
+
+Status ValueLog::SealFile() {
+  mutex_.AssertHeld();
+  Status s = builder_->Finish();
+  builder_.reset();
+  if (s.ok()) {
+    RecordTick(stats_, BLOB_DB_BLOB_FILE_SYNCED);
+    StopWatch sync_sw(env_, statistics(stats_), BLOB_DB_BLOB_FILE_SYNC_MICROS);
+    s = file_->Sync(db_options_.use_fsync);
+  }
+  uint64_t file_size = file_->GetFileSize();
+  if (s.ok()) {
+    s = file_->Close();
+  }
+  if (!s.ok()) return s;
+  file_.reset();
+
+  auto file = std::make_shared<BlobFileMeta>(file_number_, file_size);
+  file->FileStateTransit(BlobFileMeta::FileEvent::kValueLogSealed);
+  file->set_sorted(false);
+  VersionEdit edit;
+  edit.SetColumnFamilyID(cf_id_);
+  edit.AddBlobFile(file);
+  std::shared_ptr<BlobStorage> storage;
+  {
+    MutexLock l(db_mutex_);
+    s = vset_->LogAndApply(edit);
+    storage = vset_->GetBlobStorage(cf_id_).lock();
+    if (s.ok() && storage) {
+      // Compaction may have dropped records of the log before it is
+      // sealed. From now on, it finds the sealed file instead.
+      storage->ApplyActiveFileDiscardableSize(file_number_);
+      storage->ComputeGCScore();
+    }
+  }
+  if (s.ok()) {
+    s = env_->RenameFile(file_name_,
+                         BlobFileName(db_options_.dirname, file_number_));
+  }
+  if (!s.ok()) return s;
+  // Readers switch to the sealed file from now on.
+  if (storage) {
+    storage->RemoveActiveFile(file_number_);
+  }
+  ROCKS_LOG_INFO(db_options_.info_log,
+                 "Titan value log %" PRIu64 " sealed with %" PRIu64 " bytes.",
+                 file_number_, file_size);
+  auto usage = usages_.find(file_number_);
+  if (usage != usages_.end()) {
+    usage->second.sealed = true;
+    MaybeApplyUsage(file_number_);
+  }
+  return s;
+}
+
+void ValueLog::MaybeApplyUsage(uint64_t file_number) {
+  mutex_.AssertHeld();
+  auto it = usages_.find(file_number);
+  if (it == usages_.end()) return;
+  const FileUsage& usage = it->second;
+  if (!usage.sealed || usage.num_writing > 0 ||
+      usage.last_sequence > flushed_sequence_) {
+    return;
+  }
+  // Memtables are flushed in the order of sequence numbers, so all blob
+  // indexes of the file have been flushed or dropped.
+  uint64_t discardable_size = usage.appended_size > usage.flushed_size
+                                  ? usage.appended_size - usage.flushed_size
+                                  : 0;
+  usages_.erase(it);
+  if (discardable_size == 0) return;
+
+  MutexLock l(db_mutex_);
+  auto storage = vset_->GetBlobStorage(cf_id_).lock();
+  auto file = storage ? storage->FindFile(file_number).lock() : nullptr;
+  if (!file) return;
+  file->AddDiscardableSize(discardable_size);
+  storage->ComputeGCScore();
+  ROCKS_LOG_INFO(db_options_.info_log,
+                 "Titan value log %" PRIu64 " has %" PRIu64
+                 " bytes of records not flushed.",
+                 file_number, discardable_size);
+}
+
+}  // namespace titandb
+}  // namespace rocksdb
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+
+#include "blob_file_builder.h"
+#include "blob_format.h"
+#include "port/port.h"
+#include "titan/options.h"
+#include "titan_stats.h"
+#include "util/file_reader_writer.h"
+#include "version_set.h"
+
+namespace rocksdb {
+namespace titandb {
+
+// Returns the name of the value log with the number in the column family.
+// Value logs are not recognized by ParseFileName(), so they are not taken
+// as obsolete blob files on recovery.
+std::string ValueLogFileName(const std::string& dirname, uint32_t cf_id,
+                             uint64_t number);
+
+// Parses the file name of a value log. Returns false if it is not one.
+bool ParseValueLogFileName(const std::string& name, uint32_t* cf_id,
+                           uint64_t* number);
+
+// An active blob file of a column family, which values are appended to as
+// they are written, see TitanCFOptions::separate_blob_on_write.
+//
+// The log is written in the blob file format without the footer, so the
+// records are addressed by blob indexes the same as records of other blob
+// files. It is added to the blob storage as an unsealed file, readable once
+// Flush() returns. When the log grows to blob_file_target_size, it is
+// sealed with the footer and added to the blob storage as a normal blob
+// file, and a new log is started on the next write.
+//
+// Records overwritten or deleted while their blob indexes are in the
+// memtable, or whose writes fail, are never referenced by SSTs. So the
+// bytes appended to a log are tracked until the indexes written to it are
+// flushed, and the bytes not referenced by the flushed SSTs are added to
+// the discardable size of the sealed file, see Release() and
+// OnFlushCompleted().
+//
+// Sealing a log logs the new blob file to the manifest before renaming the
+// log to the blob file name, so a crash in between leaves the log of a
+// known blob file, which is renamed on recovery. Logs of unknown blob files
+// are sealed with their valid records on recovery, see Recover().
+//
+// The lock order is ValueLog.mutex_ -> Titan mutex.
+class ValueLog {
+ public:
+  ValueLog(const TitanDBOptions& db_options, const TitanCFOptions& cf_options,
+           uint32_t cf_id, VersionSet* vset, port::Mutex* db_mutex,
+           TitanStats* stats);
+
+  ~ValueLog();
+
+  // No copying allowed
+  ValueLog(const ValueLog&) = delete;
+  void operator=(const ValueLog&) = delete;
+
+  // Recovers the value logs left by the last run. Logs of the column
+  // families are sealed with their valid records, which end at the first
+  // truncated or corrupted record, and added to the blob storages. Logs of
+  // other column families are deleted.
+  // REQUIRES: the version set is opened and the base DB is not.
+  static Status Recover(
+      const TitanDBOptions& db_options,
+      const std::map<uint32_t, TitanCFOptions>& column_families,
+      VersionSet* vset, port::Mutex* db_mutex);
+
+  // Returns true if the value should be appended to the log.
+  bool ShouldSeparate(const Slice& value) const {
+    return value.size() >= cf_options_.min_blob_size &&
+           blob_run_mode_.load() == TitanBlobRunMode::kNormal;
+  }
+
+  void SetBlobRunMode(TitanBlobRunMode mode) { blob_run_mode_.store(mode); }
+
+  // Appends the record of the key and value, and points "*index" to it.
+  // The record is readable after Flush(). If it returns OK, the caller
+  // must call Release() once the write of the blob index is done.
+  Status Add(const Slice& key, const Slice& value, BlobIndex* index);
+
+  // Releases "count" records appended to the file, whose blob indexes are
+  // written with sequence numbers up to "sequence", or 0 if the write
+  // failed.
+  void Release(uint64_t file_number, uint64_t count, SequenceNumber sequence);
+
+  // Counts the records referenced by the SST flushed with sequence numbers
+  // up to "largest_seqno", as found by BlobFileSizeCollector.
+  void OnFlushCompleted(SequenceNumber largest_seqno,
+                        const std::map<uint64_t, uint64_t>& blob_files_size);
+
+  // Flushes the appended records, and syncs them if "sync" is true.
+  Status Flush(bool sync);
+
+  // Seals the current log, if any. The next write starts a new log.
+  Status Seal();
+
+  // Seals the current log, if any. Further writes fail.
+  Status Close();
+
+ private:
+  // REQUIRES: mutex_ held
+  Status NewFile();
+  // REQUIRES: mutex_ held
+  Status SealFile();
+
+  // Bytes of records of a file, kept until the blob indexes written to it
+  // are flushed.
+  struct FileUsage {
+    uint64_t appended_size{0};
+    // Bytes of records referenced by flushed SSTs.
+    uint64_t flushed_size{0};
+    // Records whose blob indexes are being written.
+    uint64_t num_writing{0};
+    // The largest sequence number of the blob indexes written.
+    SequenceNumber last_sequence{0};
+    bool sealed{false};
+  };
+
+  // Adds the bytes of the sealed file not referenced by flushed SSTs to
+  // its discardable size, once no blob index of it is left unflushed.
+  // REQUIRES: mutex_ held
+  void MaybeApplyUsage(uint64_t file_number);
+
+  const TitanDBOptions db_options_;
+  const TitanCFOptions cf_options_;
+  const uint32_t cf_id_;
+  Env* env_;
+  EnvOptions env_options_;
+  VersionSet* vset_;
+  port::Mutex* db_mutex_;
+  TitanStats* stats_;
+  std::atomic<TitanBlobRunMode> blob_run_mode_;
+
+  port::Mutex mutex_;
+  Status status_;
+  bool closed_{false};
+  uint64_t file_number_{0};
+  std::string file_name_;
+  std::unique_ptr<WritableFileWriter> file_;
+  std::unique_ptr<BlobFileBuilder> builder_;
+  std::map<uint64_t, FileUsage> usages_;
+  // The largest sequence number flushed to SSTs.
+  SequenceNumber flushed_sequence_{0};
+};
+
+}  // namespace titandb
+}  // namespace rocksdb
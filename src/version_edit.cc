@@ -10,6 +10,8 @@ enum Tag {
   kColumnFamilyID = 10,
   kAddedBlobFile = 11,
   kDeletedBlobFile = 12,
+  // Same as kAddedBlobFile, for a file whose records are not sorted by key.
+  kAddedUnsortedBlobFile = 13,
 };
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -20,7 +22,7 @@ void VersionEdit::EncodeTo(std::string* dst) const {
   PutVarint32Varint32(dst, kColumnFamilyID, column_family_id_);
 
   for (auto& file : added_files_) {
-    PutVarint32(dst, kAddedBlobFile);
+    PutVarint32(dst, file->sorted() ? kAddedBlobFile : kAddedUnsortedBlobFile);
     file->EncodeTo(dst);
   }
   for (auto& file : deleted_files_) {
@@ -55,8 +57,10 @@ Status VersionEdit::DecodeFrom(Slice* src) {
         }
         break;
       case kAddedBlobFile:
+      case kAddedUnsortedBlobFile:
         blob_file = std::make_shared<BlobFileMeta>();
         if (blob_file->DecodeFrom(src).ok()) {
+          blob_file->set_sorted(tag == kAddedBlobFile);
           AddBlobFile(blob_file);
         } else {
           error = "added blob file";
@@ -230,12 +230,13 @@ Status VersionSet::LogAndApply(VersionEdit& edit) {
 void VersionSet::AddColumnFamilies(
     const std::map<uint32_t, TitanCFOptions>& column_families) {
   for (auto& cf : column_families) {
-    auto file_cache = std::make_shared<BlobFileCache>(db_options_, cf.second,
-                                                      file_cache_, stats_);
+    auto file_cache = std::make_shared<BlobFileCache>(
+        db_options_, cf.second, cf.first, file_cache_, stats_);
     auto blob_storage = std::make_shared<BlobStorage>(
         db_options_, cf.second, cf.first, file_cache, stats_);
     column_families_.emplace(cf.first, blob_storage);
   }
+  PublishColumnFamilies();
 }
 
 Status VersionSet::DropColumnFamilies(
@@ -271,6 +272,7 @@ Status VersionSet::DestroyColumnFamily(uint32_t cf_id) {
     it->second->MarkDestroyed();
     if (it->second->MaybeRemove()) {
       column_families_.erase(it);
+      PublishColumnFamilies();
     }
     return Status::OK();
   }
@@ -281,6 +283,7 @@ Status VersionSet::DestroyColumnFamily(uint32_t cf_id) {
 
 void VersionSet::GetObsoleteFiles(std::vector<std::string>* obsolete_files,
                                   SequenceNumber oldest_sequence) {
+  bool removed = false;
   for (auto it = column_families_.begin(); it != column_families_.end();) {
     auto& cf_id = it->first;
     auto& blob_storage = it->second;
@@ -297,10 +300,16 @@ void VersionSet::GetObsoleteFiles(std::vector<std::string>* obsolete_files,
     // deleted.
     if (blob_storage->MaybeRemove()) {
       it = column_families_.erase(it);
+      removed = true;
       continue;
     }
     ++it;
   }
+  if (removed) {
+    PublishColumnFamilies();
+  } else {
+    published_column_families_.Reclaim();
+  }
 
   obsolete_files->insert(obsolete_files->end(), obsolete_manifests_.begin(),
                          obsolete_manifests_.end());
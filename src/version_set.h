@@ -55,6 +55,15 @@ class VersionSet {
   // Allocates a new file number.
   uint64_t NewFileNumber() { return next_file_number_.fetch_add(1); }
 
+  // Makes sure the file number will not be allocated again. It is used for
+  // files found on recovery whose numbers may not be persisted.
+  void MarkFileNumberUsed(uint64_t number) {
+    uint64_t next = next_file_number_.load();
+    while (next <= number &&
+           !next_file_number_.compare_exchange_weak(next, number + 1)) {
+    }
+  }
+
   // REQUIRES: mutex is held
   std::weak_ptr<BlobStorage> GetBlobStorage(uint32_t cf_id) {
     auto it = column_families_.find(cf_id);
@@ -64,6 +73,18 @@ class VersionSet {
     return std::weak_ptr<BlobStorage>();
   }
 
+  // Same as GetBlobStorage(), but looks up the published view of the
+  // column families without holding mutex. It is used on the read path.
+  std::weak_ptr<BlobStorage> GetBlobStorageLockFree(uint32_t cf_id) const {
+    PublishedPtr<ColumnFamilyMap>::ReadScope column_families(
+        &published_column_families_);
+    auto it = column_families->find(cf_id);
+    if (it != column_families->end()) {
+      return it->second;
+    }
+    return std::weak_ptr<BlobStorage>();
+  }
+
   // REQUIRES: mutex is held
   void GetObsoleteFiles(std::vector<std::string>* obsolete_files,
                         SequenceNumber oldest_sequence);
@@ -79,6 +100,15 @@ class VersionSet {
   friend class BlobFileSizeCollectorTest;
   friend class VersionTest;
 
+  using ColumnFamilyMap =
+      std::unordered_map<uint32_t, std::shared_ptr<BlobStorage>>;
+
+  // Publishes a copy of column_families_ for lock-free readers.
+  // REQUIRES: mutex is held
+  void PublishColumnFamilies() {
+    published_column_families_.Publish(new ColumnFamilyMap(column_families_));
+  }
+
   Status Recover();
 
   Status OpenManifest(uint64_t number);
@@ -103,7 +133,10 @@ class VersionSet {
   // the dropped column family but the handler is not destroyed.
   std::unordered_set<uint32_t> obsolete_columns_;
 
-  std::unordered_map<uint32_t, std::shared_ptr<BlobStorage>> column_families_;
+  ColumnFamilyMap column_families_;
+  // Copy-on-write view of column_families_, updated whenever
+  // column_families_ changes.
+  PublishedPtr<ColumnFamilyMap> published_column_families_;
   std::unique_ptr<log::Writer> manifest_;
   std::atomic<uint64_t> next_file_number_{1};
 };
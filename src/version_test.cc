@@ -40,7 +40,7 @@ class VersionTest : public testing::Test {
     env_->CreateDirIfMissing(db_options_.dirname);
     auto cache = NewLRUCache(db_options_.max_open_files);
     file_cache_.reset(
-        new BlobFileCache(db_options_, cf_options_, cache, nullptr));
+        new BlobFileCache(db_options_, cf_options_, 0, cache, nullptr));
     Reset();
   }
 
@@ -116,6 +116,7 @@ TEST_F(VersionTest, VersionEdit) {
   CheckCodec(input);
   auto file1 = std::make_shared<BlobFileMeta>(3, 4);
   auto file2 = std::make_shared<BlobFileMeta>(5, 6);
+  file2->set_sorted(false);
   input.AddBlobFile(file1);
   input.AddBlobFile(file2);
   input.DeleteBlobFile(7);
@@ -146,6 +146,8 @@ DEFINE_string(
     "\treadseq       -- read N times sequentially\n"
     "\treadtocache   -- 1 thread reading database sequentially\n"
     "\treadreverse   -- read N times in reverse order\n"
+    "\tparallelscan  -- 1 thread scanning the whole Titan database with "
+    "parallel_scan_threads threads\n"
     "\treadrandom    -- read N times in random order\n"
     "\treadmissing   -- read N missing keys in random order\n"
     "\treadwhilewriting      -- 1 writer, N threads doing random "
@@ -757,6 +759,9 @@ DEFINE_uint64(titan_db_min_blob_size, 0,
               "Smallest blob to store in a file. Blobs smaller than this "
               "will be inlined with the key in the LSM tree.");
 
+DEFINE_int32(parallel_scan_threads, 4,
+             "Number of threads scanning the database in parallelscan.");
+
 #endif  // ROCKSDB_LITE
 
 DEFINE_bool(report_bg_io_stats, false,
@@ -2638,6 +2643,9 @@ class Benchmark {
         reads_ = num_;
       } else if (name == "readreverse") {
         method = &Benchmark::ReadReverse;
+      } else if (name == "parallelscan") {
+        method = &Benchmark::ParallelScan;
+        num_threads = 1;
       } else if (name == "readrandom") {
         method = &Benchmark::ReadRandom;
       } else if (name == "readrandomfast") {
@@ -4361,6 +4369,45 @@ class Benchmark {
     }
   }
 
+  void ParallelScan(ThreadState* thread) {
+    if (!FLAGS_use_titan) {
+      fprintf(stderr, "parallelscan requires use_titan\n");
+      exit(1);
+    }
+    if (db_.db != nullptr) {
+      ParallelScan(thread, db_.db);
+    } else {
+      for (const auto& db_with_cfh : multi_dbs_) {
+        ParallelScan(thread, db_with_cfh.db);
+      }
+    }
+  }
+
+  void ParallelScan(ThreadState* thread, DB* db) {
+    auto titan_db = static_cast<titandb::TitanDB*>(db);
+    titandb::TitanReadOptions options;
+    options.verify_checksums = FLAGS_verify_checksum;
+    titandb::TitanDB::ParallelScanResult result;
+    Status s = titan_db->ParallelScan(
+        options, titan_db->DefaultColumnFamily(), FLAGS_parallel_scan_threads,
+        [](size_t /*partition*/, const Slice& /*key*/, const Slice& /*value*/) {
+          return Status::OK();
+        },
+        &result);
+    if (!s.ok()) {
+      fprintf(stderr, "parallelscan failed: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    // Ops are counted after the scan, since the stats of a thread are not
+    // thread-safe.
+    thread->stats.FinishedOps(nullptr, db, result.num_keys, kRead);
+    thread->stats.AddBytes(result.num_bytes);
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%" ROCKSDB_PRIszt " ranges)",
+             result.num_partitions);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadReverse(ThreadState* thread) {
     if (db_.db != nullptr) {
       ReadReverse(thread, db_.db);